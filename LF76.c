@@ -17,6 +17,7 @@
 #endif
 #include "cfg.h"
 #include "opus_data.h"
+#include "opus_toc.h"
 
 #define OTA_URL "https://xrobo.qiniuapi.com/v1/ota/"
 #define MAC "D4:06:06:B6:A9:FB"
@@ -29,6 +30,7 @@ static char g_ws_url[512]   = {0};
 static struct lws *g_ws_client = NULL;
 static int g_connected = 0;
 static int g_shaked = 0;
+static int g_frame_duration_ms = AUDIO_FRAME_DURATION_MS;  /* 本次会话的 Opus 帧时长, 写入 hello 消息 */
 
 /* 音频发送队列：从内存数组读取数据，排队后由WS二进制发送 */
 typedef struct audio_node {
@@ -113,11 +115,190 @@ static size_t audio_dequeue(unsigned char *out, size_t maxlen) {
     return n;
 }
 
+/* 下行音频处理 */
+static int g_udp_send_fd = -1;
+static struct sockaddr_in g_udp_send_addr;
+
+static int init_udp_sender(void) {
+    g_udp_send_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (g_udp_send_fd < 0) {
+        perror("udp sender socket");
+        return -1;
+    }
+    memset(&g_udp_send_addr, 0, sizeof(g_udp_send_addr));
+    g_udp_send_addr.sin_family = AF_INET;
+    g_udp_send_addr.sin_port = htons(AUDIO_PORT_DOWN);
+    inet_pton(AF_INET, "127.0.0.1", &g_udp_send_addr.sin_addr);
+    return 0;
+}
+
+static void audio_udp_senddownlink(const void *data, size_t len) {
+    if (g_udp_send_fd < 0 || !data || len == 0) return;
+    sendto(g_udp_send_fd, (const char*)data, (int)len, 0,
+           (struct sockaddr*)&g_udp_send_addr, sizeof(g_udp_send_addr));
+}
+
+/* 上行拥塞反馈: 把 websocket 发送队列的字节数 (4 字节大端) 发给 sound_app, 它据此调整上行码率
+ * 拥塞发生在 websocket 这一段, sound_app 到这里的本机 UDP 不会积压 */
+static void audio_udp_sendfeedback(void) {
+    if (g_udp_send_fd < 0) return;
+    struct sockaddr_in addr = g_udp_send_addr;
+    addr.sin_port = htons(AUDIO_PORT_FEEDBACK);
+
+    pthread_mutex_lock(&g_audio_mtx);
+    size_t queued = g_audio_queue_bytes;
+    pthread_mutex_unlock(&g_audio_mtx);
+
+    unsigned char msg[4];
+    msg[0] = (unsigned char)(queued >> 24);
+    msg[1] = (unsigned char)(queued >> 16);
+    msg[2] = (unsigned char)(queued >> 8);
+    msg[3] = (unsigned char)queued;
+    sendto(g_udp_send_fd, (const char*)msg, sizeof(msg), MSG_DONTWAIT, (struct sockaddr*)&addr, sizeof(addr));
+}
+
+/* 预录环形缓冲: 只在采集线程中访问, 不需要加锁
+ * 没有 listen 时保存最近 AUDIO_PREROLL_MS 的帧; listen 开始后新采集的帧排在它们后面,
+ * 按补发节奏取出放入发送队列, 取空 (追上实时) 后新采集的帧直接放入发送队列
+ * 槽位按最短的 2.5ms Opus 包计算, 任何帧时长下都能存满 AUDIO_PREROLL_MS; 帧数据按实际长度分配 */
+#define PREROLL_SLOTS       (AUDIO_PREROLL_MS * 2 / 5 + 2)
+
+typedef struct preroll_frame {
+    size_t len;
+    int duration_us;
+    unsigned char *data;
+} preroll_frame_t;
+
+typedef struct preroll_stats {
+    int turns;                  /* listen 的轮数 */
+    int turn_frames;            /* 本轮补发的预录帧数 */
+    long turn_us;               /* 本轮补发的预录时长 */
+    long total_frames;          /* 累计补发的预录帧数 */
+    long dropped_frames;        /* 没有 listen 时超出预录时长被丢弃的最早的帧 */
+    long forced_frames;         /* listen 时缓冲满, 不等补发节奏直接发出的帧 */
+} preroll_stats_t;
+
+static preroll_frame_t g_preroll[PREROLL_SLOTS];
+static int g_preroll_head = 0;       /* 最早的一帧 */
+static int g_preroll_count = 0;
+static long g_preroll_us = 0;        /* 缓冲中帧的总时长 */
+static int g_preroll_pending = 0;    /* listen 开始时已在缓冲中、还没有补发的帧数 */
+static preroll_stats_t g_preroll_stats;
+
+// 取出最早的一帧: send 为1时放入发送队列, 否则丢弃
+static void preroll_pop_oldest(int send) {
+    preroll_frame_t *f = &g_preroll[g_preroll_head];
+    if (send) {
+        audio_enqueue(f->data, f->len);
+        if (g_preroll_pending > 0) {
+            g_preroll_stats.turn_frames++;
+            g_preroll_stats.turn_us += f->duration_us;
+            g_preroll_stats.total_frames++;
+        }
+    } else {
+        g_preroll_stats.dropped_frames++;
+    }
+    if (g_preroll_pending > 0)
+        g_preroll_pending--;
+    free(f->data);
+    f->data = NULL;
+    g_preroll_us -= f->duration_us;
+    g_preroll_head = (g_preroll_head + 1) % PREROLL_SLOTS;
+    g_preroll_count--;
+}
+
+static void preroll_push(const unsigned char *data, size_t len, int duration_us) {
+    if (g_preroll_count == PREROLL_SLOTS) {
+        // listen 时缓冲中都是本轮还没发出的帧, 不能丢: 提前发出最早的一帧
+        if (g_listen_active) {
+            fprintf(stderr, "预录缓冲已满 (%d帧)，提前发送最早的一帧\n", PREROLL_SLOTS);
+            g_preroll_stats.forced_frames++;
+            preroll_pop_oldest(1);
+            if (g_ws_client)
+                lws_callback_on_writable(g_ws_client);
+        } else {
+            preroll_pop_oldest(0);
+        }
+    }
+    preroll_frame_t *f = &g_preroll[(g_preroll_head + g_preroll_count) % PREROLL_SLOTS];
+    f->data = (unsigned char*)malloc(len);
+    if (!f->data) {
+        fprintf(stderr, "预录帧内存分配失败，丢弃\n");
+        return;
+    }
+    memcpy(f->data, data, len);
+    f->len = len;
+    f->duration_us = duration_us;
+    g_preroll_count++;
+    g_preroll_us += duration_us;
+}
+
+// 没有 listen 时只保留最近 AUDIO_PREROLL_MS 的帧
+static void preroll_trim(void) {
+    while (!g_listen_active && g_preroll_count > 0 && g_preroll_us > AUDIO_PREROLL_MS * 1000L)
+        preroll_pop_oldest(0);
+}
+
+// 按补发节奏从缓冲取出帧放入发送队列: 至少取一帧, 取出的总时长不超过 budget_us
+static void preroll_send(long budget_us) {
+    long sent_us = 0;
+    while (g_preroll_count > 0) {
+        int duration_us = g_preroll[g_preroll_head].duration_us;
+        if (sent_us > 0 && sent_us + duration_us > budget_us)
+            break;
+        preroll_pop_oldest(1);
+        sent_us += duration_us;
+    }
+    if (sent_us > 0 && g_ws_client)
+        lws_callback_on_writable(g_ws_client);
+}
+
+// 发送start命令, 不再等待: start 之前采集的帧已经在预录缓冲中, 随后补发
+static void listen_start(void) {
+    unsigned char start_buf[LWS_PRE + 256];
+    int n = snprintf((char*)start_buf + LWS_PRE, 256,
+        "{\"session_id\":\"%s\",\"type\":\"listen\",\"state\":\"start\",\"mode\":\"manual\"}", g_session_id);
+    lws_write(g_ws_client, start_buf + LWS_PRE, (size_t)n, LWS_WRITE_TEXT);
+
+    g_preroll_pending = g_preroll_count;
+    g_preroll_stats.turns++;
+    g_preroll_stats.turn_frames = 0;
+    g_preroll_stats.turn_us = 0;
+    g_listen_active = 1;
+    printf("已发送start命令，预录缓冲中有%d帧 (%ld ms)，先补发再发送实时数据\n",
+           g_preroll_count, g_preroll_us / 1000);
+}
+
+static void listen_stop(void) {
+    // 还没有补发完的帧属于这一轮, 按补发节奏发完
+    int frame_us = g_frame_duration_ms * 1000;
+    while (g_preroll_count > 0) {
+        preroll_send((long)frame_us * AUDIO_PREROLL_CATCHUP);
+        usleep(frame_us);
+    }
+
+    // 等待一段时间让服务器处理完所有数据
+    sleep(2);
+
+    if (g_connected && g_shaked && g_ws_client && g_session_id[0]) {
+        unsigned char stop_buf[LWS_PRE + 256];
+        int n = snprintf((char*)stop_buf + LWS_PRE, 256,
+            "{\"session_id\":\"%s\",\"type\":\"listen\",\"state\":\"stop\"}", g_session_id);
+        lws_write(g_ws_client, stop_buf + LWS_PRE, (size_t)n, LWS_WRITE_TEXT);
+        printf("已发送stop命令（音频数据发送完成）\n");
+    }
+    g_listen_active = 0;
+    printf("第%d轮补发预录帧%d帧 (%ld ms)，累计补发%ld帧，丢弃%ld帧，缓冲满提前发送%ld帧\n", g_preroll_stats.turns,
+           g_preroll_stats.turn_frames, g_preroll_stats.turn_us / 1000, g_preroll_stats.total_frames,
+           g_preroll_stats.dropped_frames, g_preroll_stats.forced_frames);
+}
+
 // 从内存数组解析并发送opus数据
+// 模拟一直在运行的采集: 连接建立后就按帧的节奏读取, 会话建立后才能 listen, 之前的帧进入预录缓冲
 static void *opus_memory_reader_thread(void *arg) {
     // 等待WebSocket连接就绪
     printf("等待WebSocket连接就绪...\n");
-    while (!g_connected || !g_shaked) {
+    while (!g_connected) {
         usleep(100000);
     }
     
@@ -125,25 +306,19 @@ static void *opus_memory_reader_thread(void *arg) {
     
     size_t offset = 0;
     int frame_count = 0;
+    int started = 0;
     
     g_audio_thread_ready = 1;
     
-    // 先发送start命令
-    if (g_connected && g_shaked && g_ws_client && g_session_id[0]) {
-        unsigned char start_buf[LWS_PRE + 256];
-        int n = snprintf((char*)start_buf + LWS_PRE, 256,
-            "{\"session_id\":\"%s\",\"type\":\"listen\",\"state\":\"start\",\"mode\":\"manual\"}", g_session_id);
-        lws_write(g_ws_client, start_buf + LWS_PRE, (size_t)n, LWS_WRITE_TEXT);
-        g_listen_active = 1;
-        printf("已发送start命令，开始发送opus音频数据\n");
-        
-        // 等待一段时间确保start命令生效
-        sleep(1);
-    }
-    
     printf("开始解析并发送opus音频数据...\n");
     
-    while (offset < opus_audio_data_size && g_listen_active) {
+    while (offset < opus_audio_data_size) {
+        // 会话建立后发送start命令
+        if (!started && g_connected && g_shaked && g_ws_client && g_session_id[0]) {
+            listen_start();
+            started = 1;
+        }
+
         // 读取帧长度（4字节，小端格式）
         if (offset + sizeof(int32_t) > opus_audio_data_size) {
             fprintf(stderr, "数据不完整，无法读取帧长度\n");
@@ -172,64 +347,50 @@ static void *opus_memory_reader_thread(void *arg) {
             break;
         }
         
-        // 将数据加入队列
-        audio_enqueue(&opus_audio_data[offset], opus_len);
+        // 按包的实际时长控制发送节奏, TOC 无效时按会话的帧时长
+        int packet_us = opus_packet_duration_us(&opus_audio_data[offset], opus_len);
+        if (packet_us <= 0)
+            packet_us = g_frame_duration_ms * 1000;
+
+        if (!g_listen_active) {
+            // 还没有 listen: 放入预录缓冲, 只保留最近的一段
+            if (AUDIO_PREROLL_MS > 0) {
+                preroll_push(&opus_audio_data[offset], opus_len, packet_us);
+                preroll_trim();
+            }
+        } else if (g_preroll_count > 0) {
+            // 正在补发: 排在预录帧后面, 每个帧时长内补发 AUDIO_PREROLL_CATCHUP 倍的数据
+            preroll_push(&opus_audio_data[offset], opus_len, packet_us);
+            preroll_send((long)packet_us * AUDIO_PREROLL_CATCHUP);
+        } else {
+            // 将数据加入队列, 通知WebSocket线程有数据可写
+            audio_enqueue(&opus_audio_data[offset], opus_len);
+            if (g_ws_client) {
+                lws_callback_on_writable(g_ws_client);
+            }
+        }
         offset += opus_len;
+
+        // 每收到一个上行包回报一次发送队列深度
+        audio_udp_sendfeedback();
         
         frame_count++;
         printf("已解析第%d帧, 长度: %d字节, 总进度: %zu/%u字节\n", 
                frame_count, opus_len, offset, opus_audio_data_size);
         
-        // 通知WebSocket线程有数据可写
-        if (g_ws_client) {
-            lws_callback_on_writable(g_ws_client);
-        }
-        
-        // 模拟实时发送的间隔（60ms，符合Opus帧时长）
-        usleep(60000);
+        // 模拟实时采集的间隔（符合Opus帧时长）
+        usleep(packet_us);
     }
     
     printf("Opus音频数据解析完成，共%d帧\n", frame_count);
     
-    // 等待一段时间让服务器处理完所有数据
-    sleep(2);
-    
     // 数据发送完成后发送stop命令
-    if (g_connected && g_shaked && g_ws_client && g_session_id[0]) {
-        unsigned char stop_buf[LWS_PRE + 256];
-        int n = snprintf((char*)stop_buf + LWS_PRE, 256,
-            "{\"session_id\":\"%s\",\"type\":\"listen\",\"state\":\"stop\"}", g_session_id);
-        lws_write(g_ws_client, stop_buf + LWS_PRE, (size_t)n, LWS_WRITE_TEXT);
-        g_listen_active = 0;
-        printf("已发送stop命令（音频数据发送完成）\n");
-    }
+    if (g_listen_active)
+        listen_stop();
     
     return NULL;
 }
 
-/* 下行音频处理 */
-static int g_udp_send_fd = -1;
-static struct sockaddr_in g_udp_send_addr;
-
-static int init_udp_sender(void) {
-    g_udp_send_fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (g_udp_send_fd < 0) {
-        perror("udp sender socket");
-        return -1;
-    }
-    memset(&g_udp_send_addr, 0, sizeof(g_udp_send_addr));
-    g_udp_send_addr.sin_family = AF_INET;
-    g_udp_send_addr.sin_port = htons(AUDIO_PORT_DOWN);
-    inet_pton(AF_INET, "127.0.0.1", &g_udp_send_addr.sin_addr);
-    return 0;
-}
-
-static void audio_udp_senddownlink(const void *data, size_t len) {
-    if (g_udp_send_fd < 0 || !data || len == 0) return;
-    sendto(g_udp_send_fd, (const char*)data, (int)len, 0,
-           (struct sockaddr*)&g_udp_send_addr, sizeof(g_udp_send_addr));
-}
-
 /* ---------- 其余函数保持不变 ---------- */
 
 struct memory_struct {
@@ -424,7 +585,7 @@ static int ws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *
             int n = snprintf((char*)buf + LWS_PRE, 512,
                 "{\"type\":\"hello\",\"version\":1,\"transport\":\"websocket\","
                 "\"audio_params\":{\"format\":\"opus\",\"sample_rate\":16000,"
-                "\"channels\":1,\"frame_duration\":60}}");
+                "\"channels\":1,\"frame_duration\":%d}}", g_frame_duration_ms);
             lws_write(wsi, buf + LWS_PRE, (size_t)n, LWS_WRITE_TEXT);
             printf("已发送 hello\n");
             lws_callback_on_writable(wsi);
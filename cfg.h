@@ -5,6 +5,16 @@
 #define AUDIO_PORT_DOWN  5677   /* control_center向sound_app的这个端口下发音频 */
 #define UI_PORT_UP    5678      /* GUI向control_center的这个端口上传UI信息 */
 #define UI_PORT_DOWN  5679      /* control_center向GUI的这个端口下发UI信息 */
+#define AUDIO_PORT_FEEDBACK 5680 /* control_center向sound_app的这个端口回报websocket发送队列的字节数 (4字节大端) */
+
+/* Opus 帧时长 (ms), 可选 20/40/60/120: 20ms 延迟低, 120ms 包头开销小
+ * hello 消息中的 frame_duration、发送节奏和录音工具都使用这个值, 需要与 sound_app/cfg.h 保持一致 */
+#define AUDIO_FRAME_DURATION_MS  60
+
+/* 预录: 采集一直在运行, 没有 listen 时保留最近 AUDIO_PREROLL_MS 的 Opus 帧, listen 开始后先补发, 开口说话的头几个字不会丢
+ * 补发时每个帧时长内最多发出 AUDIO_PREROLL_CATCHUP 倍时长的数据, 追上实时后按正常节奏发送; AUDIO_PREROLL_MS 为0表示不预录 */
+#define AUDIO_PREROLL_MS         500
+#define AUDIO_PREROLL_CATCHUP    2
 
 
 #define CFG_FILE "/etc/xiaozhi.cfg"
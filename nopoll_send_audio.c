@@ -15,7 +15,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #endif
+#include "cfg.h"
 #include "opus_data.h"
+#include "opus_toc.h"
 
 //#define OTA_URL "http://114.66.50.145:8003/xiaozhi/ota/"
 #define OTA_URL "https://xrobo.qiniuapi.com/v1/ota/"
@@ -30,6 +32,7 @@ static noPollConn *g_nopoll_conn = NULL;
 static noPollCtx *g_nopoll_ctx = NULL;
 static int g_connected = 0;
 static int g_shaked = 0;
+static int g_frame_duration_ms = AUDIO_FRAME_DURATION_MS;  /* 本次会话的 Opus 帧时长, 写入 hello 消息 */
 
 static volatile int g_listen_active = 0;
 static volatile int g_audio_thread_ready = 0;
@@ -110,10 +113,15 @@ static void opus_memory_reader_send_test(void)
             continue; 
         }
         
+        // 按包的实际时长控制发送节奏, TOC 无效时按会话的帧时长
+        int packet_us = opus_packet_duration_us(&opus_audio_data[offset], opus_len);
+        if (packet_us <= 0)
+            packet_us = g_frame_duration_ms * 1000;
+
         offset += opus_len;
         frame_count++;
-        // 模拟实时发送的间隔（60ms，符合Opus帧时长）
-        usleep(60000);
+        // 模拟实时发送的间隔（符合Opus帧时长）
+        usleep(packet_us);
     }
 
     printf("音频数据发送完成，共发送%d帧，总大小: %zu/%u字节\n", frame_count, offset, opus_audio_data_size);
@@ -524,7 +532,10 @@ static void *websocket_thread(void *arg) {
 
     printf("发送hello消息\n");
     // 发送hello消息
-    const char *hello_msg = "{\"type\":\"hello\",\"version\":1,\"transport\":\"websocket\",\"audio_params\":{\"format\":\"opus\",\"sample_rate\":16000,\"channels\":1,\"frame_duration\":60}}";
+    char hello_msg[256];
+    snprintf(hello_msg, sizeof(hello_msg),
+        "{\"type\":\"hello\",\"version\":1,\"transport\":\"websocket\",\"audio_params\":{\"format\":\"opus\",\"sample_rate\":16000,\"channels\":1,\"frame_duration\":%d}}",
+        g_frame_duration_ms);
     ret = nopoll_conn_send_text(g_nopoll_conn, hello_msg, strlen(hello_msg));
     if(ret>0){
         printf("hello, 已发送 hello: %s\n", hello_msg);
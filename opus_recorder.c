@@ -7,12 +7,14 @@
 #include <alsa/asoundlib.h>
 #include <opus/opus.h>
 
+#include "cfg.h"
+
 // 音频参数定义
 #define PROTOCOL_VERSION 1
 #define SAMPLE_RATE 16000
 #define CHANNELS 1
-#define FRAME_DURATION_MS 60
-#define FRAME_SIZE (SAMPLE_RATE * FRAME_DURATION_MS / 1000)  // 960 samples
+#define FRAME_DURATION_MS AUDIO_FRAME_DURATION_MS
+#define FRAME_SIZE (SAMPLE_RATE * FRAME_DURATION_MS / 1000)  // 60ms 时为 960 samples
 #define RECORD_SECONDS 3
 #define MAX_PACKET_SIZE (3*1276)
 
@@ -80,6 +82,8 @@ int main() {
     // 设置Opus编码器参数
     opus_encoder_ctl(encoder, OPUS_SET_BITRATE(16000));
     opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(8));
+    opus_int32 lookahead = 0;
+    opus_encoder_ctl(encoder, OPUS_GET_LOOKAHEAD(&lookahead));
 
     printf("开始录制3秒音频...\n");
     printf("音频参数:\n");
@@ -87,6 +91,7 @@ int main() {
     printf("  采样率: %dHz\n", SAMPLE_RATE);
     printf("  通道数: %d\n", CHANNELS);
     printf("  帧长: %dms\n", FRAME_DURATION_MS);
+    printf("  编码器前瞻: %.1fms\n", lookahead * 1000.0 / SAMPLE_RATE);
     printf("按Ctrl+C可提前停止录制\n");
 
     short *pcm_buffer = (short *)malloc(FRAME_SIZE * CHANNELS * sizeof(short));
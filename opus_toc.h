@@ -0,0 +1,50 @@
+#ifndef __OPUS_TOC_H
+#define __OPUS_TOC_H
+
+/* 从 Opus 包的 TOC 字节计算这个包包含的音频时长, 不依赖 libopus (RFC 6716 3.1 节) */
+
+/**
+ * 计算 Opus 包的时长
+ * 
+ * @param data Opus 包
+ * @param len 包长度（字节）
+ * @return 时长（微秒），包无效时返回-1
+ */
+static inline int opus_packet_duration_us(const unsigned char *data, int len)
+{
+    static const int silk_us[4] = { 10000, 20000, 40000, 60000 };
+    static const int celt_us[4] = { 2500, 5000, 10000, 20000 };
+    int config, frame_us, frames;
+
+    if (!data || len < 1)
+        return -1;
+
+    config = data[0] >> 3;
+    if (config < 12)
+        frame_us = silk_us[config & 3];        /* SILK */
+    else if (config < 16)
+        frame_us = (config & 1) ? 20000 : 10000; /* Hybrid */
+    else
+        frame_us = celt_us[config & 3];        /* CELT */
+
+    switch (data[0] & 3) {
+    case 0:
+        frames = 1;
+        break;
+    case 1:
+    case 2:
+        frames = 2;
+        break;
+    default:
+        if (len < 2)
+            return -1;
+        frames = data[1] & 0x3f;
+        break;
+    }
+
+    if (frames * frame_us > 120000)
+        return -1;
+    return frames * frame_us;
+}
+
+#endif
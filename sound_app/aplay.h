@@ -3,9 +3,35 @@
 
 #include <stddef.h> // For size_t
 
+#include "audio_dev.h"
+#include "pcm_aec.h"
+#include "pcm_latency.h"
+#include "pipeline.h"
+
 // Define the callback function type
+// 回调在独立的取数线程中调用, 返回写入 buffer 的字节数, 暂时没有数据时应立即返回0, 不要阻塞等待
 typedef int (*audio_play_callback_t)(unsigned char *buffer, size_t size);
 
+/* 播放线程的运行统计 */
+typedef struct aplay_stats {
+    int mmap;                       /* 1: 声卡使用 mmap 方式, 0: writei 方式或不是声卡 */
+    unsigned long periods;          /* 写入声卡的 period 数 */
+    unsigned long silence_periods;  /* 环形缓冲为空, 整个 period 写入静音的次数 */
+    unsigned long partial_periods;  /* 数据不足一个 period, 用静音补齐的次数 */
+    unsigned long underruns;        /* 声卡欠载 (XRUN) 次数 */
+    unsigned long wakeups;          /* 播放线程被唤醒的次数 */
+    unsigned long copied_bytes;     /* 播放线程拷贝的字节数: 从环形缓冲取出, writei 方式下再加上 writei 拷到 DMA 区的数据量 */
+    long delay_us;                  /* 最近一次写入后的延迟: 刚写入的数据要多久才从喇叭放出;
+                                     * 没有数据时也一直用静音补满, 所以这个值总是接近整个设备缓冲 */
+    long max_delay_us;              /* 写入到放出延迟的最大值 */
+    unsigned long starts;           /* 从静音开始放出声音的次数 */
+    long start_delay_us;            /* 最近一次从静音开始放出声音时, 第一个有声音的采样写入后要多久才从喇叭放出 */
+    long max_start_delay_us;
+    int ring_bytes;                 /* 环形缓冲中待播放的字节数 */
+    long play_cpu_us;               /* 播放线程累计占用的 CPU 时间 */
+    long feed_cpu_us;               /* 取数线程 (调用回调、解码) 累计占用的 CPU 时间 */
+} aplay_stats;
+
 /**
  * 创建播放音频的线程
  * 
@@ -18,6 +44,54 @@ typedef int (*audio_play_callback_t)(unsigned char *buffer, size_t size);
  */
 pthread_t create_play_thread(audio_play_callback_t cb, void *user_data);
 
+/**
+ * 设置播放线程和取数 (解码) 线程的调度策略, 需要在 create_play_thread 之前调用
+ * 
+ * @param play 播放线程 (读写声卡) 的调度策略, 会被复制; NULL 表示使用系统默认
+ * @param feed 取数线程 (调用回调解码) 的调度策略, 会被复制; NULL 表示使用系统默认
+ */
+void set_play_thread_policy(const pipeline_thread_policy *play, const pipeline_thread_policy *feed);
+
+/**
+ * 设置播放设备, 需要在 create_play_thread 之前调用
+ * 设备可以是声卡, 也可以是 WAV 文件、null 或 loopback, 用于在没有声卡的机器上运行
+ * 
+ * @param dev 播放设备, 由调用者创建和销毁; NULL 表示使用 ALSA "default"
+ */
+void set_play_device(p_audio_dev_t dev);
+
+/**
+ * 设置是否使用 mmap 方式播放, 需要在 create_play_thread 之前调用
+ * mmap 方式下直接从环形缓冲拷到声卡的 DMA 区, 省去经过 writei 的一次拷贝; 声卡不支持时自动改用 writei
+ * 
+ * @param enable 1: 优先使用 mmap, 0: 使用 writei
+ */
+void set_play_mmap(int enable);
+
+/**
+ * 设置播放的延迟档位, 需要在 create_play_thread 之前调用
+ * period 取 Opus 帧长的整数分之一, 写入第一个 period 就开始播放
+ * 
+ * @param profile 延迟档位, PCM_LATENCY_DEFAULT 表示使用驱动默认值
+ * @param frame_ms Opus 帧长（毫秒）
+ */
+void set_play_latency(pcm_latency_profile profile, unsigned int frame_ms);
+
+/**
+ * 设置回声消除的远端参考, 需要在 create_play_thread 之前调用
+ * 播放线程把写入设备的数据 (包括补的静音) 和放出的时刻保存到参考中, 供录音线程消除回声
+ * 
+ * @param ref 远端参考, 由调用者创建和销毁, 同一个实例交给 set_record_aec; NULL 表示不保存
+ */
+void set_play_echo_ref(echo_ref *ref);
+
+/**
+ * 获取播放线程的运行统计
+ * 
+ * @param stats 返回统计信息
+ */
+void get_play_stats(aplay_stats *stats);
+
 /**
  * 获取实际播放设置
  * 
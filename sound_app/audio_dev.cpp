@@ -0,0 +1,574 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * 不需要声卡的音频设备: WAV 文件、null 和 loopback, 按 speed 模拟声卡的节奏
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "audio_dev.h"
+#include "pipeline.h"
+#include "spsc_ring.h"
+
+#define WAV_HEADER_SIZE     44
+#define WAV_UPDATE_PERIODS  50      /* 写 WAV 文件时每隔多少个 period 更新一次文件头里的长度, 进程被杀掉时文件也能打开 */
+#define DEFAULT_PERIOD_MS   20
+
+/* 按 speed 模拟声卡的节奏: 第 n 帧在 start + n / (rate * speed) 时才 "采集到" 或 "播放完" */
+typedef struct pacer {
+    double speed;                   /* 0 表示不等待 */
+    unsigned int sample_rate;
+    int64_t start_us;
+    uint64_t frames;
+} pacer;
+
+typedef struct soft_stream {
+    int opened;
+    pacer pace;
+    unsigned int sample_rate;
+    unsigned int channels;
+    unsigned long period;           /* 每次读写的帧数 */
+    size_t period_bytes;
+    unsigned char *buffer;
+} soft_stream;
+
+typedef struct soft_priv {
+    double speed;
+    soft_stream stream[2];          /* [0]: 录音, [1]: 播放 */
+
+    /* WAV 文件 */
+    char path[256];
+    FILE *fp;
+    uint32_t data_bytes;            /* 播放: 已写入的数据长度; 录音: 剩余的数据长度 */
+
+    /* loopback: 播放写入, 录音读出 */
+    spsc_ring<unsigned char> *loop;
+} soft_priv;
+
+// 等到这 frames 帧按 speed 应该处理完的时刻, 返回设备的延迟 (us): 这 frames 帧的时长加上比计划晚了多少
+// 录音时是其中最早的一帧到现在的时长, 播放时是刚写入的最后一帧要多久才放完, 与声卡的含义相同
+static long pacer_wait(pacer *p, unsigned long frames) {
+    if (p->speed <= 0)
+        return 0;
+    int64_t now = pipeline_now_us();
+    if (!p->start_us)
+        p->start_us = now;
+    p->frames += frames;
+    int64_t due = p->start_us + (int64_t)(p->frames * 1000000.0 / p->sample_rate / p->speed);
+    long period_us = (long)(frames * 1000000.0 / p->sample_rate / p->speed);
+    if (due > now) {
+        usleep((useconds_t)(due - now));
+        return period_us;
+    }
+    return period_us + (long)(now - due);
+}
+
+static void update_delay(audio_dev_counters *c, long delay_us) {
+    c->delay_us = delay_us;
+    if (delay_us > c->max_delay_us)
+        c->max_delay_us = delay_us;
+}
+
+static int stream_open(soft_priv *priv, int playback, unsigned int sample_rate, unsigned int channels,
+                       unsigned int frame_ms, audio_dev_info *info) {
+    soft_stream *st = &priv->stream[playback];
+    st->sample_rate = sample_rate;
+    st->channels = channels;
+    st->period = (unsigned long)sample_rate * (frame_ms ? frame_ms : DEFAULT_PERIOD_MS) / 1000;
+    st->period_bytes = st->period * channels * 2;
+    st->buffer = (unsigned char *)malloc(st->period_bytes);
+    if (!st->buffer) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return -1;
+    }
+    memset(st->buffer, 0, st->period_bytes);
+    memset(&st->pace, 0, sizeof(st->pace));
+    st->pace.speed = priv->speed;
+    st->pace.sample_rate = sample_rate;
+    st->opened = 1;
+
+    info->sample_rate = sample_rate;
+    info->channels = channels;
+    info->format = SND_PCM_FORMAT_S16_LE;
+    info->period_frames = st->period;
+    info->mmap = 0;
+    return 0;
+}
+
+static void stream_close(soft_stream *st) {
+    free(st->buffer);
+    st->buffer = NULL;
+    st->opened = 0;
+}
+
+// 取一个 period 的播放数据, 不足的部分补静音
+static void stream_fill(soft_stream *st, audio_dev_fill_cb fill, void *arg) {
+    size_t size = fill(st->buffer, st->period_bytes, arg);
+    if (size < st->period_bytes)
+        memset(st->buffer + size, 0, st->period_bytes - size);
+}
+
+/* ---- WAV 文件 ---- */
+
+static void put_le16(unsigned char *p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    put_le16(p, v & 0xffff);
+    put_le16(p + 2, v >> 16);
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int write_wav_header(FILE *fp, unsigned int sample_rate, unsigned int channels, uint32_t data_bytes) {
+    unsigned char h[WAV_HEADER_SIZE];
+    memcpy(h, "RIFF", 4);
+    put_le32(h + 4, 36 + data_bytes);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_le32(h + 16, 16);
+    put_le16(h + 20, 1);                            // PCM
+    put_le16(h + 22, channels);
+    put_le32(h + 24, sample_rate);
+    put_le32(h + 28, sample_rate * channels * 2);
+    put_le16(h + 32, channels * 2);
+    put_le16(h + 34, 16);
+    memcpy(h + 36, "data", 4);
+    put_le32(h + 40, data_bytes);
+
+    long pos = ftell(fp);
+    if (fseek(fp, 0, SEEK_SET) || fwrite(h, 1, sizeof(h), fp) != sizeof(h))
+        return -1;
+    if (pos > WAV_HEADER_SIZE)
+        fseek(fp, pos, SEEK_SET);
+    return fflush(fp);
+}
+
+// 找到 fmt 和 data 块, 文件停在数据开头
+static int read_wav_header(FILE *fp, unsigned int *sample_rate, unsigned int *channels, uint32_t *data_bytes) {
+    unsigned char h[16];
+    int have_fmt = 0;
+
+    if (fread(h, 1, 12, fp) != 12 || memcmp(h, "RIFF", 4) || memcmp(h + 8, "WAVE", 4))
+        return -1;
+    while (fread(h, 1, 8, fp) == 8) {
+        uint32_t size = get_le32(h + 4);
+        if (!memcmp(h, "fmt ", 4)) {
+            if (size < 16 || fread(h, 1, 16, fp) != 16)
+                return -1;
+            // 只支持 16bit 整数 PCM, 与声卡使用的 S16_LE 相同
+            if ((h[0] | (h[1] << 8)) != 1 || (h[14] | (h[15] << 8)) != 16)
+                return -1;
+            *channels = h[2] | (h[3] << 8);
+            *sample_rate = get_le32(h + 4);
+            have_fmt = 1;
+            size -= 16;
+        } else if (!memcmp(h, "data", 4)) {
+            *data_bytes = size;
+            return have_fmt ? 0 : -1;
+        }
+        if (fseek(fp, size + (size & 1), SEEK_CUR))
+            return -1;
+    }
+    return -1;
+}
+
+static int wav_open(p_audio_dev_t self, int playback, const audio_dev_config *config, audio_dev_info *info) {
+    soft_priv *priv = (soft_priv *)self->priv;
+    unsigned int sample_rate = config->sample_rate;
+    unsigned int channels = config->channels;
+
+    if (priv->fp) {
+        fprintf(stderr, "%s is already opened\n", priv->path);
+        return -1;
+    }
+    priv->fp = fopen(priv->path, playback ? "wb" : "rb");
+    if (!priv->fp) {
+        fprintf(stderr, "Failed to open %s: %s\n", priv->path, strerror(errno));
+        return -1;
+    }
+
+    // 录音时以文件的采样率和声道数为准, 与声卡给出的实际参数不同于期望值是一样的
+    if (playback)
+        priv->data_bytes = 0;
+    if (playback ? write_wav_header(priv->fp, sample_rate, channels, 0)
+                 : read_wav_header(priv->fp, &sample_rate, &channels, &priv->data_bytes)) {
+        fprintf(stderr, "%s: %s\n", priv->path, playback ? "write failed" : "not a 16 bit PCM wav file");
+        fclose(priv->fp);
+        priv->fp = NULL;
+        return -1;
+    }
+    if (stream_open(priv, playback, sample_rate, channels, config->frame_ms, info)) {
+        fclose(priv->fp);
+        priv->fp = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static int wav_capture(p_audio_dev_t self, audio_dev_capture_cb cb, void *arg) {
+    soft_priv *priv = (soft_priv *)self->priv;
+    soft_stream *st = &priv->stream[0];
+    size_t bytes_per_frame = st->channels * 2;
+
+    size_t want = st->period_bytes < priv->data_bytes ? st->period_bytes : priv->data_bytes;
+    size_t got = fread(st->buffer, 1, want, priv->fp);
+    int frames = (int)(got / bytes_per_frame);
+    if (frames == 0)
+        return AUDIO_DEV_EOF;
+    priv->data_bytes -= got;
+
+    update_delay(&self->counters[0], pacer_wait(&st->pace, frames));
+    cb(st->buffer, frames * bytes_per_frame, arg);
+    self->counters[0].periods++;
+    self->counters[0].copied_bytes += got;
+    return frames;
+}
+
+static int wav_play(p_audio_dev_t self, audio_dev_fill_cb fill, void *arg) {
+    soft_priv *priv = (soft_priv *)self->priv;
+    soft_stream *st = &priv->stream[1];
+
+    update_delay(&self->counters[1], pacer_wait(&st->pace, st->period));
+    stream_fill(st, fill, arg);
+    if (fwrite(st->buffer, 1, st->period_bytes, priv->fp) != st->period_bytes) {
+        fprintf(stderr, "Failed to write %s: %s\n", priv->path, strerror(errno));
+        return -EIO;
+    }
+    priv->data_bytes += st->period_bytes;
+    self->counters[1].copied_bytes += st->period_bytes;
+    if (++self->counters[1].periods % WAV_UPDATE_PERIODS == 0)
+        write_wav_header(priv->fp, st->sample_rate, st->channels, priv->data_bytes);
+    return (int)st->period;
+}
+
+static void wav_close(p_audio_dev_t self, int playback) {
+    soft_priv *priv = (soft_priv *)self->priv;
+    soft_stream *st = &priv->stream[playback];
+    if (!st->opened)
+        return;
+    if (playback)
+        write_wav_header(priv->fp, st->sample_rate, st->channels, priv->data_bytes);
+    fclose(priv->fp);
+    priv->fp = NULL;
+    stream_close(st);
+}
+
+/* ---- null ---- */
+
+static int null_open(p_audio_dev_t self, int playback, const audio_dev_config *config, audio_dev_info *info) {
+    return stream_open((soft_priv *)self->priv, playback, config->sample_rate, config->channels, config->frame_ms, info);
+}
+
+static int null_capture(p_audio_dev_t self, audio_dev_capture_cb cb, void *arg) {
+    soft_stream *st = &((soft_priv *)self->priv)->stream[0];
+    update_delay(&self->counters[0], pacer_wait(&st->pace, st->period));
+    cb(st->buffer, st->period_bytes, arg);     // buffer 一直是静音
+    self->counters[0].periods++;
+    return (int)st->period;
+}
+
+static int null_play(p_audio_dev_t self, audio_dev_fill_cb fill, void *arg) {
+    soft_stream *st = &((soft_priv *)self->priv)->stream[1];
+    update_delay(&self->counters[1], pacer_wait(&st->pace, st->period));
+    stream_fill(st, fill, arg);
+    self->counters[1].periods++;
+    return (int)st->period;
+}
+
+static void null_close(p_audio_dev_t self, int playback) {
+    soft_stream *st = &((soft_priv *)self->priv)->stream[playback];
+    if (st->opened)
+        stream_close(st);
+}
+
+/* ---- loopback ---- */
+
+static int loop_open(p_audio_dev_t self, int playback, const audio_dev_config *config, audio_dev_info *info) {
+    soft_priv *priv = (soft_priv *)self->priv;
+    soft_stream *other = &priv->stream[!playback];
+    unsigned int sample_rate = other->opened ? other->sample_rate : config->sample_rate;
+    unsigned int channels = other->opened ? other->channels : config->channels;
+
+    // 环形缓冲可以存 1s 的数据, 实时运行时两边的节奏相同, 不会用满
+    if (!priv->loop)
+        priv->loop = new spsc_ring<unsigned char>(sample_rate * channels * 2);
+    return stream_open(priv, playback, sample_rate, channels, config->frame_ms, info);
+}
+
+static int loop_capture(p_audio_dev_t self, audio_dev_capture_cb cb, void *arg) {
+    soft_priv *priv = (soft_priv *)self->priv;
+    soft_stream *st = &priv->stream[0];
+
+    // 不等待时以播放为准: 还没有一个 period 就过一会儿再来; 按节奏运行时有多少读多少, 其余补静音
+    if (st->pace.speed <= 0 && priv->loop->size() < st->period_bytes) {
+        usleep(1000);
+        return 0;
+    }
+    update_delay(&self->counters[0], pacer_wait(&st->pace, st->period));
+    size_t size = priv->loop->read(st->buffer, st->period_bytes);
+    if (size < st->period_bytes)
+        memset(st->buffer + size, 0, st->period_bytes - size);
+    cb(st->buffer, st->period_bytes, arg);
+    self->counters[0].periods++;
+    self->counters[0].copied_bytes += size;
+    return (int)st->period;
+}
+
+static int loop_play(p_audio_dev_t self, audio_dev_fill_cb fill, void *arg) {
+    soft_priv *priv = (soft_priv *)self->priv;
+    soft_stream *st = &priv->stream[1];
+
+    // 不等待时以录音为准: 缓冲满了就等录音读走; 按节奏运行时缓冲满说明录音没有在读, 丢掉这个 period
+    if (st->pace.speed <= 0 && priv->loop->space() < st->period_bytes) {
+        usleep(1000);
+        return 0;
+    }
+    update_delay(&self->counters[1], pacer_wait(&st->pace, st->period));
+    stream_fill(st, fill, arg);
+    if (priv->loop->write(st->buffer, st->period_bytes) != st->period_bytes)
+        self->counters[1].xruns++;
+    self->counters[1].periods++;
+    self->counters[1].copied_bytes += st->period_bytes;
+    return (int)st->period;
+}
+
+static void loop_close(p_audio_dev_t self, int playback) {
+    soft_stream *st = &((soft_priv *)self->priv)->stream[playback];
+    if (st->opened)
+        stream_close(st);
+}
+
+/* ---- 创建和销毁 ---- */
+
+static p_audio_dev_t soft_create(const char *name, double speed) {
+    p_audio_dev_t dev = (p_audio_dev_t)calloc(1, sizeof(audio_dev_t));
+    soft_priv *priv = (soft_priv *)calloc(1, sizeof(soft_priv));
+    if (!dev || !priv) {
+        free(dev);
+        free(priv);
+        return NULL;
+    }
+    priv->speed = speed;
+    dev->priv = priv;
+    dev->name = name;
+    return dev;
+}
+
+/**
+ * 创建 WAV 文件设备
+ */
+p_audio_dev_t audio_dev_create_wav(const char *path, double speed) {
+    p_audio_dev_t dev = soft_create("wav", speed);
+    if (!dev)
+        return NULL;
+    snprintf(((soft_priv *)dev->priv)->path, sizeof(((soft_priv *)dev->priv)->path), "%s", path);
+    dev->open = wav_open;
+    dev->capture = wav_capture;
+    dev->play = wav_play;
+    dev->close = wav_close;
+    return dev;
+}
+
+/**
+ * 创建 null 设备
+ */
+p_audio_dev_t audio_dev_create_null(double speed) {
+    p_audio_dev_t dev = soft_create("null", speed);
+    if (!dev)
+        return NULL;
+    dev->open = null_open;
+    dev->capture = null_capture;
+    dev->play = null_play;
+    dev->close = null_close;
+    return dev;
+}
+
+/**
+ * 创建 loopback 设备
+ */
+p_audio_dev_t audio_dev_create_loopback(double speed) {
+    p_audio_dev_t dev = soft_create("loopback", speed);
+    if (!dev)
+        return NULL;
+    dev->open = loop_open;
+    dev->capture = loop_capture;
+    dev->play = loop_play;
+    dev->close = loop_close;
+    return dev;
+}
+
+/**
+ * 按描述创建设备: "alsa[:设备名]", "wav:路径", "null", "loopback"
+ */
+p_audio_dev_t audio_dev_create(const char *spec, double speed) {
+    if (!strcmp(spec, "alsa"))
+        return audio_dev_create_alsa("default");
+    if (!strncmp(spec, "alsa:", 5))
+        return audio_dev_create_alsa(spec + 5);
+    if (!strncmp(spec, "wav:", 4) && spec[4])
+        return audio_dev_create_wav(spec + 4, speed);
+    if (!strcmp(spec, "null"))
+        return audio_dev_create_null(speed);
+    if (!strcmp(spec, "loopback"))
+        return audio_dev_create_loopback(speed);
+    fprintf(stderr, "Unknown audio device \"%s\", use alsa[:name], wav:path, null or loopback\n", spec);
+    return NULL;
+}
+
+/**
+ * 销毁设备, 还开着的方向会先关闭
+ */
+void audio_dev_destroy(p_audio_dev_t dev) {
+    if (!dev)
+        return;
+    dev->close(dev, 0);
+    dev->close(dev, 1);
+    if (dev->open == loop_open)
+        delete ((soft_priv *)dev->priv)->loop;
+    free(dev->priv);
+    free(dev);
+}
+
+#ifdef TEST
+/* 测试: make audio_dev_test, 不需要声卡
+ * 1. WAV: 写一个文件再读回来, 检查参数和数据一致
+ * 2. loopback: 不等待, 播放线程写入递增的采样, 录音线程检查连续
+ * 3. 节奏: null 设备实时和 10 倍速各录 0.5s 的数据, 检查耗时; 不等待时的吞吐量
+ */
+#include <pthread.h>
+
+static int16_t g_test_next;
+
+static size_t ramp_fill(unsigned char *data, size_t size, void *arg) {
+    int16_t *pcm = (int16_t *)data;
+    for (size_t i = 0; i < size / 2; i++)
+        pcm[i] = g_test_next++;
+    return size;
+}
+
+static int16_t g_test_expect;
+static int g_test_errors;
+static unsigned long g_test_bytes;
+
+static void check_capture(unsigned char *data, size_t size, void *arg) {
+    const int16_t *pcm = (const int16_t *)data;
+    for (size_t i = 0; i < size / 2; i++) {
+        if (pcm[i] != g_test_expect++)
+            g_test_errors++;
+    }
+    g_test_bytes += size;
+}
+
+static void count_capture(unsigned char *data, size_t size, void *arg) {
+    g_test_bytes += size;
+}
+
+static int test_wav(void) {
+    const char *path = "/tmp/audio_dev_test.wav";
+    audio_dev_config config = { 16000, 2, PCM_LATENCY_DEFAULT, 20, 0 };
+    audio_dev_info info;
+
+    p_audio_dev_t sink = audio_dev_create_wav(path, 0);
+    if (!sink || sink->open(sink, 1, &config, &info))
+        return -1;
+    g_test_next = 0;
+    for (int i = 0; i < 100; i++)
+        sink->play(sink, ramp_fill, sink);
+    audio_dev_destroy(sink);
+
+    config.sample_rate = 48000;     // 以文件为准
+    config.channels = 1;
+    p_audio_dev_t src = audio_dev_create_wav(path, 0);
+    if (!src || src->open(src, 0, &config, &info))
+        return -1;
+    g_test_expect = 0;
+    g_test_errors = 0;
+    g_test_bytes = 0;
+    while (src->capture(src, check_capture, NULL) > 0)
+        ;
+    audio_dev_destroy(src);
+    unlink(path);
+
+    printf("wav: %u Hz %u ch, read back %lu bytes, %d errors\n", info.sample_rate, info.channels, g_test_bytes,
+           g_test_errors);
+    return info.sample_rate == 16000 && info.channels == 2 && g_test_bytes == 100 * 640 * 2 && !g_test_errors ? 0 : -1;
+}
+
+#define LOOP_PERIODS 2000
+static volatile int g_test_stop;
+
+static void *loop_player(void *arg) {
+    p_audio_dev_t dev = (p_audio_dev_t)arg;
+    while (!g_test_stop)
+        dev->play(dev, ramp_fill, dev);
+    return NULL;
+}
+
+static int test_loopback(void) {
+    audio_dev_config config = { 48000, 2, PCM_LATENCY_DEFAULT, 10, 0 };
+    audio_dev_info cap_info, play_info;
+    p_audio_dev_t dev = audio_dev_create_loopback(0);
+    if (!dev || dev->open(dev, 0, &config, &cap_info))
+        return -1;
+    config.sample_rate = 16000;     // 以先打开的录音为准
+    if (dev->open(dev, 1, &config, &play_info))
+        return -1;
+
+    g_test_next = 0;
+    g_test_expect = 0;
+    g_test_errors = 0;
+    g_test_bytes = 0;
+    g_test_stop = 0;
+    pthread_t tid;
+    pthread_create(&tid, NULL, loop_player, dev);
+    while (dev->counters[0].periods < LOOP_PERIODS)
+        dev->capture(dev, check_capture, NULL);
+    g_test_stop = 1;
+    pthread_join(tid, NULL);
+    unsigned long xruns = dev->counters[1].xruns;
+    audio_dev_destroy(dev);
+
+    printf("loopback: %u Hz, %d periods, %lu bytes, %d errors, %lu xruns\n", play_info.sample_rate, LOOP_PERIODS,
+           g_test_bytes, g_test_errors, xruns);
+    return play_info.sample_rate == 48000 && !g_test_errors && !xruns ? 0 : -1;
+}
+
+// 录 ms 毫秒的数据, 返回实际耗时 (ms)
+static double run_null(double speed, int ms) {
+    audio_dev_config config = { 16000, 2, PCM_LATENCY_DEFAULT, 20, 0 };
+    audio_dev_info info;
+    p_audio_dev_t dev = audio_dev_create_null(speed);
+    if (!dev || dev->open(dev, 0, &config, &info))
+        return -1;
+    int64_t start = pipeline_now_us();
+    for (int i = 0; i < ms / 20; i++)
+        dev->capture(dev, count_capture, NULL);
+    double elapsed = (pipeline_now_us() - start) / 1000.0;
+    audio_dev_destroy(dev);
+    return elapsed;
+}
+
+int main(int argc, char **argv) {
+    int fail = 0;
+    fail |= test_wav();
+    fail |= test_loopback();
+
+    double t1 = run_null(1, 500);
+    double t10 = run_null(10, 500);
+    double t0 = run_null(0, 60000);
+    printf("null: 500 ms at 1x in %.1f ms, at 10x in %.1f ms, 60 s unpaced in %.1f ms (%.0fx)\n", t1, t10, t0,
+           t0 > 0 ? 60000 / t0 : 0.0);
+    if (t1 < 490 || t1 > 560 || t10 < 48 || t10 > 80)
+        fail = -1;
+
+    printf("%s\n", fail ? "FAILED" : "ok");
+    return fail ? 1 : 0;
+}
+#endif
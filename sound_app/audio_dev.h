@@ -0,0 +1,125 @@
+#ifndef AUDIO_DEV_H
+#define AUDIO_DEV_H
+
+#include <stddef.h>
+#include <alsa/asoundlib.h>
+
+#include "pcm_latency.h"
+
+/* 音频设备接口: 录音线程和播放线程只通过它读写音频, 不直接调用 ALSA
+ * ALSA 声卡是其中一种实现; 另外有 WAV 文件 (录音读文件, 播放写文件)、null (录音给静音, 播放丢弃)
+ * 和 loopback (播放写入的数据从录音读出), 用于在没有声卡的机器上跑完整的编码/解码/IPC 流程
+ * 非声卡设备按 speed 控制节奏: 1 表示实时, N 表示 N 倍速, 0 表示不等待, 尽快处理 */
+
+#define AUDIO_DEV_EOF  (-ENODATA)   /* capture 的返回值: 录音数据已经读完 (WAV 文件结束) */
+
+/* 期望的设备参数 */
+typedef struct audio_dev_config {
+    unsigned int sample_rate;
+    unsigned int channels;
+    pcm_latency_profile latency;    /* 声卡的延迟档位 */
+    unsigned int frame_ms;          /* period 要对齐的编码帧长, 非声卡设备的 period 就是一帧 */
+    int mmap;                       /* 声卡优先使用 mmap 方式 */
+} audio_dev_config;
+
+/* 实际的设备参数, 格式总是 S16_LE 交错存放 */
+typedef struct audio_dev_info {
+    unsigned int sample_rate;
+    unsigned int channels;
+    snd_pcm_format_t format;
+    unsigned long period_frames;    /* 每次读写的帧数 */
+    int mmap;                       /* 1: 声卡使用 mmap 方式 */
+} audio_dev_info;
+
+/* 每个方向的运行统计, 只由读写这个方向的线程更新 */
+typedef struct audio_dev_counters {
+    unsigned long periods;          /* 读出/写入的 period 数 */
+    unsigned long xruns;            /* 录音溢出/播放欠载次数 */
+    unsigned long copied_bytes;     /* 设备内部拷贝的字节数, 如 readi/writei 与 DMA 区之间的拷贝 */
+    long delay_us;                  /* 录音: 最早的采样到交给回调的时长; 播放: 刚写入的数据要多久才放出 */
+    long max_delay_us;
+} audio_dev_counters;
+
+/* 录音数据回调, 与 audio_record_callback_t 相同; data 只在回调期间有效 */
+typedef void (*audio_dev_capture_cb)(unsigned char *data, size_t size, void *arg);
+
+/* 播放取数回调: 往 data 里最多写 size 字节, 返回写入的字节数, 不足的部分由设备补静音 */
+typedef size_t (*audio_dev_fill_cb)(unsigned char *data, size_t size, void *arg);
+
+typedef struct audio_dev_t {
+    void *priv;
+    const char *name;
+    audio_dev_counters counters[2]; /* [0]: 录音, [1]: 播放 */
+
+    /**
+     * 打开录音或播放方向, loopback 设备两个方向都要打开
+     * @return 成功返回0, 失败返回-1
+     */
+    int (*open)(struct audio_dev_t *self, int playback, const audio_dev_config *config, audio_dev_info *info);
+
+    /**
+     * 等待并读取录音数据, 每读到一个 period 调用一次 cb
+     * @return 读到的帧数 (超时返回0), AUDIO_DEV_EOF 表示数据已经读完, 其他负数表示出错
+     */
+    int (*capture)(struct audio_dev_t *self, audio_dev_capture_cb cb, void *arg);
+
+    /**
+     * 等待设备可以写入, 每个 period 调用一次 fill 取数据
+     * @return 写入的帧数 (超时或欠载后恢复返回0), 负数表示出错
+     */
+    int (*play)(struct audio_dev_t *self, audio_dev_fill_cb fill, void *arg);
+
+    void (*close)(struct audio_dev_t *self, int playback);
+} audio_dev_t, *p_audio_dev_t;
+
+/**
+ * 创建 ALSA 声卡设备
+ *
+ * @param device PCM 设备名, 如 "default", "hw:0,0"
+ * @return 成功返回设备, 失败返回NULL
+ */
+p_audio_dev_t audio_dev_create_alsa(const char *device);
+
+/**
+ * 创建 WAV 文件设备: 录音时读文件 (采样率和声道数以文件为准), 播放时写文件
+ *
+ * @param path 文件路径
+ * @param speed 1: 实时, N: N 倍速, 0: 不等待
+ * @return 成功返回设备, 失败返回NULL
+ */
+p_audio_dev_t audio_dev_create_wav(const char *path, double speed);
+
+/**
+ * 创建 null 设备: 录音时给出静音, 播放时丢弃数据
+ *
+ * @param speed 1: 实时, N: N 倍速, 0: 不等待
+ * @return 成功返回设备, 失败返回NULL
+ */
+p_audio_dev_t audio_dev_create_null(double speed);
+
+/**
+ * 创建 loopback 设备: 播放写入的数据从录音读出, 同一个设备要同时交给录音和播放
+ * 先打开的方向决定采样率和声道数; 不等待 (speed 为0) 时录音等待播放写入, 播放在缓冲满时等待录音读走
+ *
+ * @param speed 1: 实时, N: N 倍速, 0: 不等待
+ * @return 成功返回设备, 失败返回NULL
+ */
+p_audio_dev_t audio_dev_create_loopback(double speed);
+
+/**
+ * 按描述创建设备: "alsa[:设备名]", "wav:路径", "null", "loopback"
+ *
+ * @param spec 设备描述
+ * @param speed 非声卡设备的速度
+ * @return 成功返回设备, 失败返回NULL
+ */
+p_audio_dev_t audio_dev_create(const char *spec, double speed);
+
+/**
+ * 销毁设备, 需要先关闭已经打开的方向
+ *
+ * @param dev 设备
+ */
+void audio_dev_destroy(p_audio_dev_t dev);
+
+#endif // AUDIO_DEV_H
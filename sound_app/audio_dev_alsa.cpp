@@ -0,0 +1,303 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * ALSA 声卡设备: 录音用 readi 或 mmap, 播放用 writei 或 mmap, period/buffer 按延迟档位与编码帧对齐
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <alsa/asoundlib.h>
+
+#include "audio_dev.h"
+
+typedef struct alsa_stream {
+    snd_pcm_t *pcm;
+    int mmap;
+    unsigned int sample_rate;
+    size_t bytes_per_frame;
+    snd_pcm_uframes_t period;
+    unsigned char *buffer;          /* readi/writei 方式的一个 period */
+} alsa_stream;
+
+typedef struct alsa_priv {
+    char device[64];
+    alsa_stream stream[2];          /* [0]: 录音, [1]: 播放 */
+} alsa_priv;
+
+static int alsa_open(p_audio_dev_t self, int playback, const audio_dev_config *config, audio_dev_info *info) {
+    alsa_priv *priv = (alsa_priv *)self->priv;
+    alsa_stream *st = &priv->stream[playback];
+    const char *dir = playback ? "play" : "record";
+    snd_pcm_hw_params_t *hw_params = NULL;
+    snd_pcm_format_t format = SND_PCM_FORMAT_S16_LE;
+    unsigned int sample_rate = config->sample_rate;
+    unsigned int channels = config->channels;
+    int rc;
+
+    rc = snd_pcm_open(&st->pcm, priv->device, playback ? SND_PCM_STREAM_PLAYBACK : SND_PCM_STREAM_CAPTURE, 0);
+    if (rc < 0) {
+        fprintf(stderr, "Failed to open PCM device %s: %s\n", priv->device, snd_strerror(rc));
+        st->pcm = NULL;
+        return -1;
+    }
+
+    snd_pcm_hw_params_alloca(&hw_params);
+    snd_pcm_hw_params_any(st->pcm, hw_params);
+
+    // 优先使用 mmap, 声卡 (或插件) 不支持时退回 readi/writei
+    snd_pcm_access_t access = SND_PCM_ACCESS_RW_INTERLEAVED;
+    if (config->mmap) {
+        if (snd_pcm_hw_params_test_access(st->pcm, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0)
+            access = SND_PCM_ACCESS_MMAP_INTERLEAVED;
+        else
+            printf("mmap %s is not supported by %s, use %s\n", dir, priv->device, playback ? "writei" : "readi");
+    }
+    st->mmap = access == SND_PCM_ACCESS_MMAP_INTERLEAVED;
+    rc = snd_pcm_hw_params_set_access(st->pcm, hw_params, access);
+    rc |= snd_pcm_hw_params_set_format(st->pcm, hw_params, format);
+    rc |= snd_pcm_hw_params_set_channels(st->pcm, hw_params, channels);
+    rc |= snd_pcm_hw_params_set_rate_near(st->pcm, hw_params, &sample_rate, 0);
+    if (rc < 0) {
+        fprintf(stderr, "Failed to set parameters: %s\n", snd_strerror(rc));
+        goto fail;
+    }
+    rc = pcm_latency_set_hw_params(st->pcm, hw_params, sample_rate, config->latency, config->frame_ms);
+    if (rc < 0)
+        fprintf(stderr, "Failed to apply %s latency profile for %s: %s, use driver defaults\n",
+                pcm_latency_profile_name(config->latency), dir, snd_strerror(rc));
+
+    rc = snd_pcm_hw_params(st->pcm, hw_params);
+    if (rc < 0) {
+        fprintf(stderr, "Failed to apply parameters for %s: %s, sample_rate = %d, channels = %d\n",
+                dir, snd_strerror(rc), sample_rate, channels);
+        goto fail;
+    }
+    if (pcm_latency_set_sw_params(st->pcm, playback) < 0)
+        fprintf(stderr, "Failed to set sw parameters for %s\n", dir);
+    pcm_latency_report(st->pcm, dir, config->frame_ms);
+
+    snd_pcm_hw_params_get_period_size(hw_params, &st->period, 0);
+    snd_pcm_hw_params_get_rate(hw_params, &sample_rate, 0);
+    snd_pcm_hw_params_get_channels(hw_params, &channels);
+    snd_pcm_hw_params_get_format(hw_params, &format);
+    st->sample_rate = sample_rate;
+    st->bytes_per_frame = snd_pcm_format_width(format) / 8 * channels;
+
+    st->buffer = (unsigned char *)malloc(st->period * st->bytes_per_frame);
+    if (!st->buffer) {
+        fprintf(stderr, "Memory allocation failed\n");
+        goto fail;
+    }
+    memset(st->buffer, 0, st->period * st->bytes_per_frame);   // 先写一遍, 运行时不会缺页
+
+    info->sample_rate = sample_rate;
+    info->channels = channels;
+    info->format = format;
+    info->period_frames = st->period;
+    info->mmap = st->mmap;
+
+    // mmap 方式的录音不会像 readi 那样自动启动
+    if (!playback && st->mmap)
+        snd_pcm_start(st->pcm);
+    return 0;
+
+fail:
+    snd_pcm_close(st->pcm);
+    st->pcm = NULL;
+    return -1;
+}
+
+// 记录采集到回调的延迟: 还在驱动里的数据 (delay) 加上这次交给回调的数据都是在回调之前采集的
+static void update_capture_delay(audio_dev_counters *c, alsa_stream *st, snd_pcm_uframes_t pending) {
+    long delay_us = pcm_latency_delay_us(st->pcm, st->sample_rate);
+    if (delay_us < 0)
+        return;
+    c->delay_us = delay_us + (long)((long long)pending * 1000000 / st->sample_rate);
+    if (c->delay_us > c->max_delay_us)
+        c->max_delay_us = c->delay_us;
+}
+
+// 录音溢出后恢复; mmap 方式下不会像 readi 那样自动启动, 要重新 start
+static int recover_capture(audio_dev_counters *c, alsa_stream *st, int err) {
+    if (err == -EPIPE) {
+        fprintf(stderr, "Buffer overrun detected, recovering...\n");
+        c->xruns++;
+    }
+    int rc = snd_pcm_recover(st->pcm, err, 1);
+    if (rc == 0 && st->mmap)
+        rc = snd_pcm_start(st->pcm);
+    return rc;
+}
+
+// mmap 方式: 等到至少有一个 period 的数据, 直接把 DMA 区交给回调, 回调返回后再交还给驱动
+static int capture_mmap(audio_dev_counters *c, alsa_stream *st, audio_dev_capture_cb cb, void *arg) {
+    int rc = snd_pcm_wait(st->pcm, 1000);
+    snd_pcm_sframes_t avail = rc < 0 ? rc : snd_pcm_avail_update(st->pcm);
+    if (avail < 0)
+        return recover_capture(c, st, (int)avail);
+
+    int total = 0;
+    while (avail >= (snd_pcm_sframes_t)st->period) {
+        const snd_pcm_channel_area_t *areas;
+        snd_pcm_uframes_t offset;
+        snd_pcm_uframes_t n = st->period;   // DMA 区回绕时会少于一个 period
+
+        rc = snd_pcm_mmap_begin(st->pcm, &areas, &offset, &n);
+        if (rc < 0)
+            return recover_capture(c, st, rc);
+
+        // interleaved: 所有声道在同一块区域里, 第一个声道的起始地址就是这一帧的起始地址
+        unsigned char *data = (unsigned char *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+        update_capture_delay(c, st, 0);     // mmap 方式下还没提交的数据包含在 delay 里
+        cb(data, n * st->bytes_per_frame, arg);
+        c->periods++;
+
+        snd_pcm_sframes_t committed = snd_pcm_mmap_commit(st->pcm, offset, n);
+        if (committed < 0 || (snd_pcm_uframes_t)committed != n)
+            return recover_capture(c, st, committed < 0 ? (int)committed : -EPIPE);
+        avail -= n;
+        total += n;
+    }
+    return total;
+}
+
+static int alsa_capture(p_audio_dev_t self, audio_dev_capture_cb cb, void *arg) {
+    alsa_stream *st = &((alsa_priv *)self->priv)->stream[0];
+    audio_dev_counters *c = &self->counters[0];
+
+    if (st->mmap)
+        return capture_mmap(c, st, cb, arg);
+
+    int rc = snd_pcm_readi(st->pcm, st->buffer, st->period);
+    if (rc == -EPIPE) {
+        fprintf(stderr, "Buffer overrun detected, recovering...\n");
+        c->xruns++;
+        snd_pcm_prepare(st->pcm);
+        return 0;
+    }
+    if (rc < 0)
+        return rc;
+
+    update_capture_delay(c, st, rc);
+    cb(st->buffer, rc * st->bytes_per_frame, arg);
+    c->periods++;
+    c->copied_bytes += rc * st->bytes_per_frame;
+    return rc;
+}
+
+// mmap 方式: 直接让 fill 把数据写到 DMA 区, 返回写入的帧数或负的错误码
+static snd_pcm_sframes_t play_mmap(alsa_stream *st, audio_dev_fill_cb fill, void *arg) {
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t n = st->period;   // DMA 区回绕时会少于一个 period
+
+    int rc = snd_pcm_mmap_begin(st->pcm, &areas, &offset, &n);
+    if (rc < 0)
+        return rc;
+
+    unsigned char *data = (unsigned char *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+    size_t bytes = n * st->bytes_per_frame;
+    size_t size = fill(data, bytes, arg);
+    if (size < bytes)
+        memset(data + size, 0, bytes - size);
+
+    snd_pcm_sframes_t committed = snd_pcm_mmap_commit(st->pcm, offset, n);
+    if (committed < 0 || (snd_pcm_uframes_t)committed != n)
+        return committed < 0 ? committed : -EPIPE;
+
+    // mmap 方式不会像 writei 那样自动启动
+    if (snd_pcm_state(st->pcm) == SND_PCM_STATE_PREPARED) {
+        rc = snd_pcm_start(st->pcm);
+        if (rc < 0)
+            return rc;
+    }
+    return committed;
+}
+
+// 等声卡可以写入一个 period 再写, 欠载时恢复, 不在这里等待网络或解码
+static int alsa_play(p_audio_dev_t self, audio_dev_fill_cb fill, void *arg) {
+    alsa_stream *st = &((alsa_priv *)self->priv)->stream[1];
+    audio_dev_counters *c = &self->counters[1];
+
+    int rc = snd_pcm_wait(st->pcm, 1000);
+    snd_pcm_sframes_t avail = rc < 0 ? rc : snd_pcm_avail_update(st->pcm);
+    if (avail < 0) {
+        if (avail == -EPIPE)
+            c->xruns++;
+        rc = snd_pcm_recover(st->pcm, (int)avail, 1);
+        if (rc < 0) {
+            fprintf(stderr, "Playback error: %s\n", snd_strerror(rc));
+            snd_pcm_prepare(st->pcm);
+        }
+        return 0;
+    }
+
+    int total = 0;
+    while (avail >= (snd_pcm_sframes_t)st->period) {
+        snd_pcm_sframes_t err;
+        if (st->mmap) {
+            err = play_mmap(st, fill, arg);
+        } else {
+            size_t bytes = st->period * st->bytes_per_frame;
+            size_t size = fill(st->buffer, bytes, arg);
+            if (size < bytes)
+                memset(st->buffer + size, 0, bytes - size);
+            err = snd_pcm_writei(st->pcm, st->buffer, st->period);
+            if (err > 0)
+                c->copied_bytes += bytes;
+        }
+        if (err < 0) {
+            if (err == -EPIPE)
+                c->xruns++;
+            if (snd_pcm_recover(st->pcm, (int)err, 1) < 0) {
+                fprintf(stderr, "Playback error: %s\n", snd_strerror((int)err));
+                snd_pcm_prepare(st->pcm);
+            }
+            break;
+        }
+        c->periods++;
+        avail -= err;
+        total += err;
+
+        // 刚写入的数据前面还有多少没放完, 就是写入到喇叭的延迟
+        c->delay_us = pcm_latency_delay_us(st->pcm, st->sample_rate);
+        if (c->delay_us > c->max_delay_us)
+            c->max_delay_us = c->delay_us;
+    }
+    return total;
+}
+
+static void alsa_close(p_audio_dev_t self, int playback) {
+    alsa_stream *st = &((alsa_priv *)self->priv)->stream[playback];
+    if (!st->pcm)
+        return;
+    snd_pcm_drain(st->pcm);
+    snd_pcm_close(st->pcm);
+    free(st->buffer);
+    st->pcm = NULL;
+    st->buffer = NULL;
+}
+
+/**
+ * 创建 ALSA 声卡设备
+ *
+ * @param device PCM 设备名, 如 "default", "hw:0,0"
+ * @return 成功返回设备, 失败返回NULL
+ */
+p_audio_dev_t audio_dev_create_alsa(const char *device) {
+    p_audio_dev_t dev = (p_audio_dev_t)calloc(1, sizeof(audio_dev_t));
+    alsa_priv *priv = (alsa_priv *)calloc(1, sizeof(alsa_priv));
+    if (!dev || !priv) {
+        free(dev);
+        free(priv);
+        return NULL;
+    }
+    snprintf(priv->device, sizeof(priv->device), "%s", device && device[0] ? device : "default");
+    dev->priv = priv;
+    dev->name = "alsa";
+    dev->open = alsa_open;
+    dev->capture = alsa_capture;
+    dev->play = alsa_play;
+    dev->close = alsa_close;
+    return dev;
+}
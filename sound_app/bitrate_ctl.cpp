@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * 上行码率控制 (AIMD): 发送失败或发送队列积压时把码率按比例降低, 连续畅通一段时间后逐步增加
+ * 只做决策, 由调用者把结果通过 opus_encoder_set_bitrate/opus_encoder_set_complexity 设置给编码器
+ */
+#include <stddef.h>
+#include <new>
+
+#include "bitrate_ctl.h"
+
+struct bitrate_ctl {
+    bitrate_ctl_config cfg;
+    bitrate_ctl_stats stats;
+    int good_frames;          // 连续畅通的帧数
+    int holdoff;              // 距离下一次允许降低码率还剩的帧数
+    int loss_q16;             // 发送失败率的滑动平均 (%, Q16)
+};
+
+#define LOSS_AVG_SHIFT 5      // 滑动平均的窗口约为 32 帧
+
+// 码率在上下限之间线性映射到复杂度: 码率最低时复杂度最高
+static int complexity_for_bitrate(const bitrate_ctl_config *cfg, int bitrate) {
+    int range = cfg->max_bitrate - cfg->min_bitrate;
+    if (range <= 0)
+        return cfg->max_complexity;
+    int span = cfg->max_complexity - cfg->min_complexity;
+    return cfg->max_complexity - span * (bitrate - cfg->min_bitrate) / range;
+}
+
+bitrate_ctl *create_bitrate_ctl(const bitrate_ctl_config *cfg) {
+    if (!cfg || cfg->min_bitrate <= 0 || cfg->min_bitrate > cfg->max_bitrate ||
+        cfg->backoff_percent <= 0 || cfg->backoff_percent >= 100 ||
+        cfg->queue_low_bytes > cfg->queue_high_bytes)
+        return NULL;
+
+    bitrate_ctl *ctl = new (std::nothrow) bitrate_ctl();
+    if (!ctl)
+        return NULL;
+
+    ctl->cfg = *cfg;
+    int start = cfg->start_bitrate;
+    if (start < cfg->min_bitrate)
+        start = cfg->min_bitrate;
+    if (start > cfg->max_bitrate)
+        start = cfg->max_bitrate;
+    ctl->stats.bitrate = start;
+    ctl->stats.complexity = complexity_for_bitrate(cfg, start);
+    ctl->stats.queue_bytes = -1;
+    return ctl;
+}
+
+void destroy_bitrate_ctl(bitrate_ctl *ctl) {
+    delete ctl;
+}
+
+int bitrate_ctl_update(bitrate_ctl *ctl, int queue_bytes, int send_failed) {
+    const bitrate_ctl_config *cfg = &ctl->cfg;
+    bitrate_ctl_stats *st = &ctl->stats;
+    int bitrate = st->bitrate;
+
+    st->frames++;
+    st->queue_bytes = queue_bytes;
+    if (send_failed)
+        st->send_failures++;
+    ctl->loss_q16 += ((send_failed ? (100 << 16) : 0) - ctl->loss_q16) >> LOSS_AVG_SHIFT;
+    int loss_percent = (ctl->loss_q16 + (1 << 15)) >> 16;
+    if (ctl->holdoff > 0)
+        ctl->holdoff--;
+
+    if (send_failed || queue_bytes >= cfg->queue_high_bytes) {
+        st->congestions++;
+        ctl->good_frames = 0;
+        if (ctl->holdoff == 0 && bitrate > cfg->min_bitrate) {
+            bitrate = bitrate * cfg->backoff_percent / 100;
+            if (bitrate < cfg->min_bitrate)
+                bitrate = cfg->min_bitrate;
+            ctl->holdoff = cfg->holdoff_frames;
+            st->decreases++;
+        }
+    } else if (queue_bytes <= cfg->queue_low_bytes) {
+        // 队列深度未知 (-1) 时只依据发送是否失败
+        if (++ctl->good_frames >= cfg->stable_frames && bitrate < cfg->max_bitrate) {
+            bitrate += cfg->step_up;
+            if (bitrate > cfg->max_bitrate)
+                bitrate = cfg->max_bitrate;
+            ctl->good_frames = 0;
+            st->increases++;
+        }
+    } else {
+        // 介于高低水位之间: 保持当前码率
+        ctl->good_frames = 0;
+    }
+
+    if (bitrate == st->bitrate && loss_percent == st->loss_percent)
+        return 0;
+    st->loss_percent = loss_percent;
+    st->bitrate = bitrate;
+    st->complexity = complexity_for_bitrate(cfg, bitrate);
+    return 1;
+}
+
+void bitrate_ctl_get_stats(bitrate_ctl *ctl, bitrate_ctl_stats *stats) {
+    *stats = ctl->stats;
+}
+
+#ifdef TEST
+/* 测试: g++ -DTEST -O2 -I ./ -o bitrate_ctl_test bitrate_ctl.cpp
+ * 模拟一条容量会变化的上行链路, 检查拥塞时码率能降到容量以下、恢复后能回升
+ */
+#include <stdio.h>
+
+int main(int argc, char **argv) {
+    bitrate_ctl_config cfg = {
+        12000, 32000, 24000, 2000, 75,
+        8 * 1024, 2 * 1024, 25, 5, 5, 9,
+    };
+    bitrate_ctl *ctl = create_bitrate_ctl(&cfg);
+    if (!ctl)
+        return 1;
+
+    const int frame_ms = 60;
+    double queue = 0;              // 模拟的发送队列 (字节)
+    int fail = 0;
+    // 0~30s 链路 64kbps, 30~60s 掉到 10kbps 以下, 60~90s 恢复到 40kbps
+    for (int i = 0; i < 1500; ++i) {
+        double t = i * frame_ms / 1000.0;
+        int capacity = t < 30 ? 64000 : (t < 60 ? 9000 : 40000);
+        bitrate_ctl_stats st;
+        bitrate_ctl_get_stats(ctl, &st);
+
+        queue += st.bitrate / 8.0 * frame_ms / 1000;
+        queue -= capacity / 8.0 * frame_ms / 1000;
+        if (queue < 0)
+            queue = 0;
+        int failed = queue > 32 * 1024;   // 模拟发送缓冲区满
+        if (failed)
+            queue = 32 * 1024;
+
+        if (bitrate_ctl_update(ctl, (int)queue, failed)) {
+            bitrate_ctl_get_stats(ctl, &st);
+            printf("%6.2fs capacity %5d queue %6d -> bitrate %5d complexity %d loss %d%%\n",
+                   t, capacity, (int)queue, st.bitrate, st.complexity, st.loss_percent);
+        }
+
+        bitrate_ctl_get_stats(ctl, &st);
+        if (i == 499 && st.bitrate != cfg.max_bitrate)
+            fail = 1;                     // 链路充足时应升到上限
+        if (i == 999 && st.bitrate != cfg.min_bitrate)
+            fail = 1;                     // 链路不足时应降到下限
+        if (i == 1499 && st.bitrate != cfg.max_bitrate)
+            fail = 1;                     // 恢复后应回到上限
+        if (i == 1499 && st.loss_percent != 0)
+            fail = 1;                     // 不再丢包后丢包率应回到0
+    }
+
+    bitrate_ctl_stats st;
+    bitrate_ctl_get_stats(ctl, &st);
+    printf("frames %lu, send failures %lu, congestions %lu, decreases %lu, increases %lu\n",
+           st.frames, st.send_failures, st.congestions, st.decreases, st.increases);
+    printf("%s\n", fail ? "FAIL" : "OK");
+    destroy_bitrate_ctl(ctl);
+    return fail;
+}
+#endif
@@ -0,0 +1,67 @@
+#ifndef BITRATE_CTL_H
+#define BITRATE_CTL_H
+
+/* 上行码率控制: 根据发送队列深度和发送失败调整编码码率 (拥塞时乘性降低, 畅通时加性增加) */
+
+typedef struct bitrate_ctl_config {
+    int min_bitrate;          /* 码率下限 (bps) */
+    int max_bitrate;          /* 码率上限 (bps) */
+    int start_bitrate;        /* 初始码率 (bps) */
+    int step_up;              /* 畅通时每次增加的码率 (bps) */
+    int backoff_percent;      /* 拥塞时码率降为当前的百分比 */
+    int queue_high_bytes;     /* 发送队列超过该值视为拥塞 */
+    int queue_low_bytes;      /* 发送队列低于该值视为畅通 */
+    int stable_frames;        /* 连续畅通多少帧后增加码率 */
+    int holdoff_frames;       /* 降低码率后至少间隔多少帧才能再次降低, 等待队列消化 */
+    int min_complexity;       /* 最高码率时使用的复杂度 */
+    int max_complexity;       /* 最低码率时使用的复杂度, 码率越低越需要编码器多花算力保证音质 */
+} bitrate_ctl_config;
+
+typedef struct bitrate_ctl_stats {
+    int bitrate;                  /* 当前码率 (bps) */
+    int complexity;               /* 当前复杂度 */
+    int queue_bytes;              /* 最近一次观测到的发送队列深度 */
+    int loss_percent;             /* 最近约 32 帧的发送失败率 (%), 用于设置编码器的 PACKET_LOSS_PERC */
+    unsigned long frames;         /* 已观测的帧数 */
+    unsigned long send_failures;  /* 发送失败的帧数 */
+    unsigned long congestions;    /* 判定为拥塞的帧数 */
+    unsigned long decreases;      /* 降低码率的次数 */
+    unsigned long increases;      /* 增加码率的次数 */
+} bitrate_ctl_stats;
+
+typedef struct bitrate_ctl bitrate_ctl;
+
+/**
+ * 创建码率控制器
+ * 
+ * @param cfg 配置, 会被复制
+ * @return 成功返回控制器，配置无效或内存不足时返回NULL
+ */
+bitrate_ctl *create_bitrate_ctl(const bitrate_ctl_config *cfg);
+
+/**
+ * 销毁码率控制器
+ * 
+ * @param ctl 控制器，可以为NULL
+ */
+void destroy_bitrate_ctl(bitrate_ctl *ctl);
+
+/**
+ * 每发送一帧后调用一次, 输入这一帧的发送结果
+ * 
+ * @param ctl 控制器
+ * @param queue_bytes 发送后发送队列中的字节数 (本机套接字或 control_center 回报的 websocket 队列), 未知时传-1
+ * @param send_failed 这一帧发送失败时为1
+ * @return 码率、复杂度或丢包率需要改变时返回1，否则返回0
+ */
+int bitrate_ctl_update(bitrate_ctl *ctl, int queue_bytes, int send_failed);
+
+/**
+ * 获取当前码率、复杂度和统计信息
+ * 
+ * @param ctl 控制器
+ * @param stats 返回统计信息
+ */
+void bitrate_ctl_get_stats(bitrate_ctl *ctl, bitrate_ctl_stats *stats);
+
+#endif // BITRATE_CTL_H
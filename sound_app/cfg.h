@@ -5,5 +5,123 @@
 #define AUDIO_PORT_DOWN  5677   /* control_center向sound_app的这个端口下发音频 */
 #define UI_PORT_UP    5678      /* GUI向control_center的这个端口上传UI信息 */
 #define UI_PORT_DOWN  5679      /* control_center向GUI的这个端口下发UI信息 */
+#define AUDIO_PORT_FEEDBACK 5680 /* control_center向sound_app的这个端口回报websocket发送队列的字节数 (4字节大端) */
+
+/* Opus 帧时长 (ms), 可选 20/40/60/120: 20ms 延迟低, 120ms 包头开销小
+ * 采集的 period、编解码、发送节奏和 hello 消息中的 frame_duration 都使用这个值, 需要与上层 cfg.h 保持一致 */
+#define AUDIO_FRAME_DURATION_MS  60
+
+/* 上行合包: 按 AUDIO_ENCODE_FRAME_MS 采集和编码, 再用 opus_repacketizer 合并成 AUDIO_FRAME_DURATION_MS 的包发送
+ * 编码帧短则响应快, 发送的包长则消息少; 两者相等表示不合并, AUDIO_FRAME_DURATION_MS 必须是它的整数倍 */
+#define AUDIO_ENCODE_FRAME_MS    20
+#define AUDIO_REPACK_FLUSH_ON_SILENCE 1 /* 1: 人声结束时立即发出未凑满的包; 0: 总是凑满固定帧数 */
+
+/* 下行解码的采样率处理: CODEC_RATE_NATIVE 直接按播放设备的采样率解码, CODEC_RATE_RESAMPLE 按16kHz解码后重采样 */
+#define AUDIO_DECODE_RATE_MODE  CODEC_RATE_NATIVE
+/* 上行编码的采样率处理: CODEC_RATE_NATIVE 按采集的采样率编码并限制为宽带, CODEC_RATE_RESAMPLE 重采样到16kHz再编码 */
+#define AUDIO_ENCODE_RATE_MODE  CODEC_RATE_NATIVE
+
+/* 上行编码器预设: OPUS_PROFILE_LOWDELAY / OPUS_PROFILE_VOIP / OPUS_PROFILE_QUALITY
+ * LOWDELAY 的前瞻是 2.5ms (VOIP/QUALITY 为 6.5ms), 只用 CELT, 低码率下音质稍差; 复杂度随后由码率控制调整 */
+#define AUDIO_ENCODER_PROFILE    OPUS_PROFILE_VOIP
+
+/* 上行码率控制: control_center 回报的 websocket 发送队列积压时降低码率, 畅通时逐步恢复
+ * 本机 UDP 发送失败也视为拥塞; 超过 AUDIO_FEEDBACK_TIMEOUT_MS 没有收到回报时只看本机发送队列 */
+#define AUDIO_BITRATE_MIN        12000  /* 码率下限, 16kHz 单声道语音仍可用于识别 */
+#define AUDIO_BITRATE_MAX        32000  /* 码率上限, 再高对 16kHz 语音没有明显收益 */
+#define AUDIO_BITRATE_START      24000
+#define AUDIO_BITRATE_STEP_UP    2000   /* 畅通时每次增加的码率 */
+#define AUDIO_BITRATE_BACKOFF    75     /* 拥塞时降为当前码率的百分比 */
+#define AUDIO_SEND_QUEUE_HIGH    (4 * 1024)   /* 发送队列超过该字节数视为拥塞, 32kbps 时约 1s */
+#define AUDIO_SEND_QUEUE_LOW     1024         /* 发送队列低于该字节数视为畅通 */
+#define AUDIO_FEEDBACK_TIMEOUT_MS 1000        /* 发送队列回报的有效期 */
+#define AUDIO_BITRATE_STABLE_FRAMES  25  /* 连续畅通 25 帧(1.5s)后增加码率 */
+#define AUDIO_BITRATE_HOLDOFF_FRAMES 5   /* 降低码率后至少间隔 5 帧再次降低 */
+#define AUDIO_COMPLEXITY_MIN     5      /* 最高码率时的编码复杂度 */
+#define AUDIO_COMPLEXITY_MAX     9      /* 最低码率时的编码复杂度 */
+
+/* 上行带内 FEC: 每个包附带前一帧的低码率副本, 接收端丢包时可以恢复; lowdelay 预设只用 CELT, 没有 FEC
+ * 编码器只在预期丢包率大于 0 时才附带副本; 目前没有接收端的丢包回报, 本机 UDP 的发送失败率几乎总是 0,
+ * 所以打开 FEC 时预期丢包率至少取 AUDIO_UPLINK_FEC_MIN_LOSS, 有了接收端回报后再改为实测值 */
+#define AUDIO_UPLINK_FEC         1
+#define AUDIO_UPLINK_FEC_MIN_LOSS 10    /* 打开 FEC 时告诉编码器的最低预期丢包率 (%) */
+
+/* 下行抖动缓冲: 接收线程把包放入缓冲, 播放线程按序号取出, 缺失的包用 PLC/FEC 补出 */
+#define AUDIO_JITTER_MIN_MS      40     /* 开始播放前至少缓冲的时长 */
+#define AUDIO_JITTER_MAX_MS      400    /* 抖动再大也不超过这个缓冲深度 */
+#define AUDIO_JITTER_CAPACITY    256    /* 最多缓存的包数, TTS 可能一次下发十几秒的音频 */
+/* 下行包是否带序号: 1 表示每个 UDP 包前有 4 字节大端格式的序号 (需要 control_center 配合),
+ * 0 表示按到达顺序编号, 此时只能平滑抖动, 不能发现丢包 */
+#define AUDIO_DOWNLINK_SEQ_HEADER 0
+
+/* 上行静音抑制: 打开 Opus DTX, 并按本地 VAD 结果不发送静音帧
+ * 打开后服务端的 VAD/ASR 只能收到人声和之后 480ms 的 hangover, 需要确认服务端能接受再打开 */
+#define AUDIO_UPLINK_DTX         0      /* 0: 每一帧都发送; 1: 静音帧不发送 */
+#define AUDIO_VAD_THRESHOLD_DB   9      /* 高于噪声底多少 dB 视为人声 */
+#define AUDIO_VAD_MIN_LEVEL_DB   (-50)  /* 低于该电平 (dBFS) 一律视为静音 */
+#define AUDIO_VAD_HANGOVER_FRAMES (480 / AUDIO_ENCODE_FRAME_MS) /* 人声结束后继续发送 480ms, 避免切掉字尾 */
+#define AUDIO_VAD_KEEPALIVE_FRAMES 0    /* 静音期间每隔多少个编码帧发送一帧, 0 表示完全不发送 */
+#define AUDIO_VAD_PREROLL        1      /* 人声开始时补发前一个静音帧, 避免切掉字头 */
+
+/* 上行流水线: 采集、编码、发送各用一个线程, 之间用无锁队列连接, 编码慢时只增加延迟而不丢麦克风数据 */
+#define AUDIO_CAPTURE_QUEUE_MS   1000   /* 采集到编码之间最多缓存的 PCM 时长 */
+#define AUDIO_SEND_QUEUE_PACKETS 64     /* 编码到发送之间最多缓存的包数 */
+#define AUDIO_ENCODE_BACKLOG_MS  200    /* 待编码的 PCM 超过该时长时临时降低编码复杂度, 追上后恢复 */
+#define AUDIO_BACKLOG_COMPLEXITY 2      /* 追赶积压时使用的编码复杂度 */
+#define AUDIO_CAPTURE_CPU        (-1)   /* 各线程绑定的 CPU, -1 表示不绑定 */
+#define AUDIO_ENCODE_CPU         (-1)
+#define AUDIO_SEND_CPU           (-1)
+#define AUDIO_PLAY_CPU           (-1)
+#define AUDIO_FEED_CPU           (-1)   /* 播放取数 (解码) 线程 */
+
+/* 音频线程的实时调度: SCHED_FIFO 优先级, 0 表示普通调度; 需要 root 或 CAP_SYS_NICE, 没有权限时自动退回普通调度
+ * 还没有在板子上测过, 先用普通调度; 编码线程在高复杂度下一帧可能占用几毫秒, 打开前要在板子上确认
+ * 不会饿死 websocket 等普通线程, 并且 XRUN 确实减少; 建议的取值: 声卡线程 80, 编解码 70, 发送 60 */
+#define AUDIO_RT_PRIORITY_CAPTURE 0
+#define AUDIO_RT_PRIORITY_PLAY    0
+#define AUDIO_RT_PRIORITY_ENCODE  0
+#define AUDIO_RT_PRIORITY_FEED    0
+#define AUDIO_RT_PRIORITY_SEND    0
+#define AUDIO_THREAD_STACK       (256 * 1024)       /* 音频线程的栈, 预先分配并写入, 0 表示系统默认 */
+#define AUDIO_MLOCK              0                  /* 1: 锁定进程内存, 避免音频线程因为换页而停顿; 和实时调度一起在板子上确认后再打开 */
+#define AUDIO_HEAP_RESERVE       (4 * 1024 * 1024)  /* 锁定内存时预先写入的堆内存 */
+
+/* 声卡使用 mmap 方式读写, 省去 readi/writei 的一次拷贝; 声卡不支持时自动退回 readi/writei
+ * 还没有在声卡上跑过, 先在板子上用 "record_test mmap" 和 "aplay_test <jitter> mmap" 确认录音和播放都正常再打开 */
+#define AUDIO_ALSA_MMAP          0
+
+/* 声卡延迟档位 (见 pcm_latency.h): period 取帧长的整数分之一
+ * 还没有在声卡上测过, 先用驱动默认值; 在板子上用 record_test / aplay_test 比较各档位的采集延迟和播放的 start delay,
+ * 没有 XRUN 再改, 候选: 录音 PCM_LATENCY_BALANCED (对齐 20ms 编码帧, 10ms period), 播放 PCM_LATENCY_LOW (15ms period) */
+#define AUDIO_CAPTURE_LATENCY    PCM_LATENCY_DEFAULT
+#define AUDIO_PLAY_LATENCY       PCM_LATENCY_DEFAULT
+
+/* 采集预处理 (见 pcm_preprocess.h): 在录音线程中用 Speex 做降噪、自动增益和语音检测
+ * 录音 period 是 Speex 帧长的整数倍时不增加延迟 (驱动默认的 period 不一定是, 会多出最多一帧); 先用 pcm_preprocess_test 在板子上确认每帧的耗时再打开 */
+#define AUDIO_PREPROCESS         0
+#define AUDIO_PREPROCESS_FRAME_MS 10    /* Speex 帧长, 10 或 20 */
+#define AUDIO_DENOISE            1
+#define AUDIO_NOISE_SUPPRESS_DB  (-15)  /* 噪声的最大衰减 */
+#define AUDIO_AGC                1
+#define AUDIO_AGC_TARGET         8000   /* AGC 目标电平 (样本幅度) */
+#define AUDIO_AGC_MAX_GAIN_DB    20
+#define AUDIO_SPEEX_VAD          1
+#define AUDIO_VAD_PROB_START     85     /* 从静音进入人声的概率阈值 (%) */
+#define AUDIO_VAD_PROB_CONTINUE  65     /* 保持人声的概率阈值 (%) */
+
+/* 回声消除 (见 pcm_aec.h): 以播放的 PCM 为参考, 在预处理之前消除喇叭传回麦克风的声音, 要求录音和播放的采样率相同
+ * 先用 pcm_aec_test 在板子上确认每帧的耗时, 再用实际录下的文件确认 ERLE 后打开 */
+#define AUDIO_AEC                0
+#define AUDIO_AEC_FRAME_MS       10     /* Speex 帧长, 10 或 20 */
+#define AUDIO_AEC_FILTER_MS      128    /* 回声尾长, 要覆盖喇叭到麦克风的回声路径 */
+#define AUDIO_AEC_LEAD_MS        10     /* 参考提前取的时长, 容纳延迟估计的误差 */
+#define AUDIO_AEC_RESYNC_MS      8      /* 对齐位置偏差超过这个值才重新对齐 */
+#define AUDIO_AEC_HISTORY_MS     1000   /* 保存的参考时长, 要大于播放延迟 + 采集延迟 + 回声尾长 */
+
+/* 音频设备 (见 audio_dev.h): "alsa[:设备名]", "wav:路径", "null", "loopback", 可以用命令行参数覆盖
+ * 没有声卡的机器上可以用 wav:in.wav 作为录音、null 作为播放, 按 AUDIO_DEVICE_SPEED 倍速跑完整的编解码和 IPC 流程 */
+#define AUDIO_CAPTURE_DEVICE     "alsa:default"
+#define AUDIO_PLAY_DEVICE        "alsa:default"
+#define AUDIO_DEVICE_SPEED       1      /* 非声卡设备的速度: 1 表示实时, N 表示 N 倍速, 0 表示不等待 */
 
 #endif
\ No newline at end of file
@@ -36,6 +36,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <pthread.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 
 #include "ipc_udp.h"
 
@@ -57,6 +60,9 @@ static int udp_send_data(ipc_endpoint_t *pendpoint, const char *data, int len);
 // 接收数据的函数声明
 static int udp_recv_data(ipc_endpoint_t *pendpoint, unsigned char *data, int maxlen, int *retlen);
 
+// 获取发送队列深度的函数声明
+static int udp_get_send_queue(ipc_endpoint_t *pendpoint);
+
 // 创建一个UDP类型的IPC端点
 // 参数:
 //   port_local: 本地端口号
@@ -90,6 +96,7 @@ p_ipc_endpoint_t ipc_endpoint_create_udp(int port_local, int port_remote, transf
     pendpoint->user_data = user_data;
     pendpoint->send = udp_send_data;
     pendpoint->recv = udp_recv_data;
+    pendpoint->get_send_queue = udp_get_send_queue;
 
     // 设置远程和本地端口号
     pudpdata->port_remote = port_remote;
@@ -230,11 +237,12 @@ static int udp_send_data(ipc_endpoint_t *pendpoint, const char *data, int len)
         return -1;
     }
 
-    // 发送数据到客户端
-    ssize_t bytes_sent = sendto(fd, data, len, 0, (struct sockaddr *)p_server_addr, sizeof(*p_server_addr));
+    // 发送数据到客户端, 不阻塞: 发送缓冲区满时直接返回失败, 由调用者降低码率, 而不是卡住录音线程
+    ssize_t bytes_sent = sendto(fd, data, len, MSG_DONTWAIT, (struct sockaddr *)p_server_addr, sizeof(*p_server_addr));
     // 检查发送的数据量是否与预期相符
     if (bytes_sent != len) {
-        perror("Failed to send data to client");
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS)
+            perror("Failed to send data to client");
         return -1;
     }
 
@@ -281,3 +289,20 @@ static int udp_recv_data(ipc_endpoint_t *pendpoint, unsigned char *data, int max
     return 0;
 }
 
+/**
+ * 获取发送套接字中还没有发出去的字节数
+ * 
+ * @param pendpoint 指向ipc_endpoint_t结构体的指针
+ * @return 成功返回字节数，失败返回-1
+ */
+static int udp_get_send_queue(ipc_endpoint_t *pendpoint)
+{
+    p_upd_data_t pudpdata = (p_upd_data_t)pendpoint->priv;
+    int queued = 0;
+
+    if (pudpdata->socket_send < 0)
+        return -1;
+    if (ioctl(pudpdata->socket_send, SIOCOUTQ, &queued) < 0)
+        return -1;
+    return queued;
+}
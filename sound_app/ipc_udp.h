@@ -27,6 +27,7 @@ typedef struct ipc_endpoint_t {
     transfer_callback_t cb;  // 接收到远端的客户端发来的信息后使用它来处理
     int (*send)(struct ipc_endpoint_t *self, const char *data, int len); // 发送数据的函数指针
     int (*recv)(struct ipc_endpoint_t *self, unsigned char *data, int maxlen, int *retlen); // 接收数据的函数指针
+    int (*get_send_queue)(struct ipc_endpoint_t *self); // 获取发送队列中尚未发出的字节数, 失败返回-1
 } ipc_endpoint_t, *p_ipc_endpoint_t;
 
 // 创建一个UDP类型的IPC端点
@@ -0,0 +1,454 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * 下行抖动缓冲: 按序号排队, 根据到达时间的抖动决定开始播放前缓冲多少
+ * 抖动的估计: 由序号和每个包的实际时长推算它应到达的时间, 实际到达时间与之的差 (transit) 减去观测到的最小值就是这个包的迟到量,
+ * 迟到量的峰值 (缓慢衰减) 就是需要的缓冲深度
+ * 延迟的回落: 抖动变小后多出来的缓冲深度靠跳过静音包消化; 只在包按实时节奏到达、缓冲一直比目标深时跳过,
+ * TTS 一次下发很多包时缓冲深是正常的, 不跳过
+ */
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <vector>
+#include <new>
+#include <opus/opus.h>
+
+#include "opus.h"
+#include "jitter_buf.h"
+
+#define JITTER_DECAY_SHIFT 6   // 峰值每个包向当前迟到量衰减 1/64
+#define DRAIN_WINDOW       32  // 每取出多少个包判断一次是否有多余的缓冲深度
+#define SIZE_AVG_SHIFT     5   // 包长的滑动平均约为 32 个包
+
+typedef struct jitter_slot {
+    int used;
+    uint32_t seq;
+    int size;
+    int duration_ms;
+} jitter_slot;
+
+struct jitter_buf {
+    jitter_buf_config cfg;
+    jitter_buf_stats stats;
+    pthread_mutex_t lock;
+    std::vector<jitter_slot> slots;         // 按 seq % capacity 存放
+    std::vector<unsigned char> data;        // 每个槽 OPUS_MAX_PACKET_SIZE 字节
+
+    int started;                            // 是否收到过包
+    int playing;                            // 缓冲已达到目标深度, 正在播放
+    uint32_t nextSeq;                       // 下一个要播放的序号
+
+    /* 抖动估计, 每次重新缓冲时重置参考点, 避免说话间隙被当成抖动
+     * 包的媒体时间由序号最大的包累加得到, 中间缺失的包按它前一个包的时长估算 */
+    int haveRef;
+    uint32_t lastSeq;                       // 已收到的序号最大的包
+    int64_t lastMediaMs;                    // 它相对参考点的媒体时间
+    int lastDurationMs;                     // 它的时长
+    int64_t minTransit;
+    int jitterPeakQ8;                       // 迟到量峰值 (ms, Q8)
+    int sizeAvgQ4;                          // 包长的滑动平均 (字节, Q4), 用于判断静音包
+
+    /* 延迟回落: 每 DRAIN_WINDOW 次取包统计一次最小缓冲深度和到达的音频时长 */
+    int windowGets;
+    int windowMinDepthMs;
+    int windowInMs;                         // 窗口内放入的音频时长
+    int windowOutMs;                        // 窗口内取出的音频时长
+    int drainMs;                            // 还需要跳过的音频时长
+};
+
+static void update_target(jitter_buf *jb) {
+    int target = jb->stats.jitter_ms;
+    if (target < jb->cfg.min_delay_ms)
+        target = jb->cfg.min_delay_ms;
+    if (target > jb->cfg.max_delay_ms)
+        target = jb->cfg.max_delay_ms;
+    jb->stats.target_ms = target;
+}
+
+// 包的标称时长: 最近收到的包的时长, 还没有收到包时用配置的值
+static int packet_ms(jitter_buf *jb) {
+    return jb->lastDurationMs > 0 ? jb->lastDurationMs : jb->cfg.frame_ms;
+}
+
+static void update_jitter(jitter_buf *jb, uint32_t seq, int duration_ms, int64_t arrival_ms) {
+    if (!jb->haveRef) {
+        jb->haveRef = 1;
+        jb->lastSeq = seq;
+        jb->lastMediaMs = 0;
+        jb->lastDurationMs = duration_ms;
+        jb->minTransit = arrival_ms;
+    }
+    // 下行包长由服务端决定, 不一定等于本端的帧时长, 应到达的时间按实际收到的包长累加
+    int32_t offset = (int32_t)(seq - jb->lastSeq);
+    int64_t media;
+    if (offset > 0) {
+        media = jb->lastMediaMs + (int64_t)offset * jb->lastDurationMs;
+        jb->lastSeq = seq;
+        jb->lastMediaMs = media;
+        jb->lastDurationMs = duration_ms;
+    } else {
+        media = jb->lastMediaMs + (int64_t)offset * duration_ms;
+    }
+    int64_t transit = arrival_ms - media;
+    if (transit < jb->minTransit)
+        jb->minTransit = transit;
+
+    int lateQ8 = (int)((transit - jb->minTransit) << 8);
+    if (lateQ8 > jb->jitterPeakQ8)
+        jb->jitterPeakQ8 = lateQ8;
+    else
+        jb->jitterPeakQ8 -= (jb->jitterPeakQ8 - lateQ8) >> JITTER_DECAY_SHIFT;
+    jb->stats.jitter_ms = (jb->jitterPeakQ8 + 255) >> 8;
+    update_target(jb);
+}
+
+jitter_buf *create_jitter_buf(const jitter_buf_config *cfg) {
+    if (!cfg || cfg->frame_ms <= 0 || cfg->capacity <= 0 || cfg->min_delay_ms > cfg->max_delay_ms)
+        return NULL;
+
+    jitter_buf *jb = new (std::nothrow) jitter_buf();
+    if (!jb)
+        return NULL;
+    jb->cfg = *cfg;
+    try {
+        jb->slots.resize(cfg->capacity);
+        jb->data.resize((size_t)cfg->capacity * OPUS_MAX_PACKET_SIZE);
+    } catch (const std::bad_alloc &) {
+        delete jb;
+        return NULL;
+    }
+    pthread_mutex_init(&jb->lock, NULL);
+    update_target(jb);
+    return jb;
+}
+
+void destroy_jitter_buf(jitter_buf *jb) {
+    if (!jb)
+        return;
+    pthread_mutex_destroy(&jb->lock);
+    delete jb;
+}
+
+int jitter_buf_put(jitter_buf *jb, uint32_t seq, const unsigned char *data, int size, int64_t arrival_ms) {
+    if (size <= 0 || size > OPUS_MAX_PACKET_SIZE)
+        return -1;
+    int samples = opus_packet_get_nb_samples(data, size, 48000);
+    if (samples <= 0)
+        return -1;
+
+    pthread_mutex_lock(&jb->lock);
+    jitter_buf_stats *st = &jb->stats;
+    st->received++;
+
+    if (!jb->started) {
+        jb->started = 1;
+        jb->nextSeq = seq;
+    } else if (!jb->playing && st->depth_packets == 0) {
+        // 取空后重新开始缓冲: 说话间隙不算抖动
+        jb->haveRef = 0;
+    }
+
+    int32_t offset = (int32_t)(seq - jb->nextSeq);
+    if (offset < 0 && !jb->playing && st->played == 0 && st->lost == 0 && -offset < jb->cfg.capacity) {
+        // 还没开始播放时乱序到达的包: 从更早的序号开始播放
+        jb->nextSeq = seq;
+        offset = 0;
+    }
+    if (offset < 0) {
+        st->late++;
+        pthread_mutex_unlock(&jb->lock);
+        return 1;
+    }
+    if (offset >= jb->cfg.capacity) {
+        st->overflows++;
+        pthread_mutex_unlock(&jb->lock);
+        return 1;
+    }
+
+    int index = seq % jb->cfg.capacity;
+    jitter_slot *slot = &jb->slots[index];
+    if (slot->used) {
+        st->duplicates++;
+        pthread_mutex_unlock(&jb->lock);
+        return 1;
+    }
+
+    memcpy(&jb->data[(size_t)index * OPUS_MAX_PACKET_SIZE], data, size);
+    slot->used = 1;
+    slot->seq = seq;
+    slot->size = size;
+    slot->duration_ms = samples / 48;
+    st->depth_packets++;
+    st->depth_ms += slot->duration_ms;
+    jb->windowInMs += slot->duration_ms;
+    jb->sizeAvgQ4 += ((size << 4) - jb->sizeAvgQ4) >> SIZE_AVG_SHIFT;
+    update_jitter(jb, seq, slot->duration_ms, arrival_ms);
+
+    pthread_mutex_unlock(&jb->lock);
+    return 0;
+}
+
+/* 每 DRAIN_WINDOW 次取包判断一次: 整个窗口里缓冲都比目标深两个包以上, 并且到达的音频时长和取出的相当 (按实时节奏到达),
+ * 说明多出来的深度是之前的抖动留下的, 之后跳过静音包把它消化掉
+ * TTS 快于实时下发时到达的比取出的多, 下发结束后到达的比取出的少, 这两种情况都不跳过 */
+static void update_drain(jitter_buf *jb) {
+    jitter_buf_stats *st = &jb->stats;
+    if (jb->windowGets == 0 || st->depth_ms < jb->windowMinDepthMs)
+        jb->windowMinDepthMs = st->depth_ms;
+    if (++jb->windowGets < DRAIN_WINDOW)
+        return;
+
+    int excess = jb->windowMinDepthMs - st->target_ms;
+    int paced = jb->windowInMs * 2 >= jb->windowOutMs && jb->windowInMs <= jb->windowOutMs * 3 / 2;
+    jb->drainMs = excess > 2 * packet_ms(jb) && paced ? excess - packet_ms(jb) : 0;
+    jb->windowGets = 0;
+    jb->windowInMs = 0;
+    jb->windowOutMs = 0;
+}
+
+// 可以跳过的包: DTX 静音包, 或者需要回落延迟时明显小于平均包长的包 (VBR 编码的停顿)
+static int can_skip(jitter_buf *jb, const jitter_slot *slot) {
+    if (slot->size <= 2)
+        return jb->stats.depth_ms > jb->stats.target_ms + 2 * packet_ms(jb);
+    return jb->drainMs > 0 && (slot->size << 5) <= jb->sizeAvgQ4;
+}
+
+int jitter_buf_get(jitter_buf *jb, unsigned char *data, int maxsize, uint32_t *seq) {
+    pthread_mutex_lock(&jb->lock);
+    jitter_buf_stats *st = &jb->stats;
+    int ret = -1;
+
+    if (!jb->playing) {
+        // 缓冲到目标深度再开始播放; 缓存已满时也开始, 避免一直等下去
+        if (jb->started && st->depth_packets > 0 &&
+            (st->depth_ms >= st->target_ms || st->depth_packets >= jb->cfg.capacity / 2))
+            jb->playing = 1;
+    } else if (st->depth_packets == 0) {
+        jb->playing = 0;
+        st->underruns++;
+    }
+    if (!jb->playing) {
+        jb->windowGets = 0;
+        jb->windowInMs = 0;
+        jb->windowOutMs = 0;
+        jb->drainMs = 0;
+    }
+
+    // 抖动减小后缓冲比目标深: 跳过静音包把延迟降下来, 不丢有声音的包
+    if (jb->playing)
+        update_drain(jb);
+    while (jb->playing) {
+        int index = jb->nextSeq % jb->cfg.capacity;
+        jitter_slot *slot = &jb->slots[index];
+        if (!slot->used || slot->seq != jb->nextSeq || !can_skip(jb, slot))
+            break;
+        slot->used = 0;
+        st->depth_packets--;
+        st->depth_ms -= slot->duration_ms;
+        jb->drainMs -= slot->duration_ms;
+        st->skipped++;
+        jb->nextSeq++;
+    }
+    if (jb->playing && st->depth_packets == 0) {
+        jb->playing = 0;
+        st->underruns++;
+    }
+
+    if (jb->playing) {
+        int index = jb->nextSeq % jb->cfg.capacity;
+        jitter_slot *slot = &jb->slots[index];
+        if (seq)
+            *seq = jb->nextSeq;
+        if (slot->used && slot->seq == jb->nextSeq) {
+            if (slot->size <= maxsize) {
+                memcpy(data, &jb->data[(size_t)index * OPUS_MAX_PACKET_SIZE], slot->size);
+                ret = slot->size;
+                st->played++;
+            } else {
+                ret = 0;
+                st->lost++;
+            }
+            slot->used = 0;
+            st->depth_packets--;
+            st->depth_ms -= slot->duration_ms;
+            jb->windowOutMs += slot->duration_ms;
+        } else {
+            // 这个包没有按时到达, 后面的包已经到了
+            ret = 0;
+            st->lost++;
+            jb->windowOutMs += packet_ms(jb);
+        }
+        jb->nextSeq++;
+    }
+
+    pthread_mutex_unlock(&jb->lock);
+    return ret;
+}
+
+int jitter_buf_peek(jitter_buf *jb, unsigned char *data, int maxsize) {
+    int ret = 0;
+    pthread_mutex_lock(&jb->lock);
+    int index = jb->nextSeq % jb->cfg.capacity;
+    jitter_slot *slot = &jb->slots[index];
+    if (jb->started && slot->used && slot->seq == jb->nextSeq && slot->size <= maxsize) {
+        memcpy(data, &jb->data[(size_t)index * OPUS_MAX_PACKET_SIZE], slot->size);
+        ret = slot->size;
+    }
+    pthread_mutex_unlock(&jb->lock);
+    return ret;
+}
+
+void jitter_buf_get_stats(jitter_buf *jb, jitter_buf_stats *stats) {
+    pthread_mutex_lock(&jb->lock);
+    *stats = jb->stats;
+    pthread_mutex_unlock(&jb->lock);
+}
+
+#ifdef TEST
+/* 测试: make jitter_buf_test
+ * 模拟一条有抖动、丢包和乱序的下行链路: 发送端每 60ms 发一个包, 播放端每 60ms 取一个包, 每 3s 中有 0.6s 停顿 (小包),
+ * 检查缓冲深度会随抖动增大, 丢失的包都被报告为缺失, 抖动稳定后不再取空, 抖动变小后多出来的延迟能在停顿中消化
+ * 另外检查: 配置的帧时长和实际包长不同时不会误判为抖动; TTS 一次下发很多包时不跳过任何包
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+// SILK 宽带 60ms 单帧包的 TOC
+#define TEST_TOC_60MS (11 << 3)
+
+// 配置 20ms, 服务端按 60ms 的包、没有抖动地下发: 目标深度应保持在下限
+static int test_frame_mismatch(void) {
+    jitter_buf_config cfg = { 20, 40, 400, 64 };
+    jitter_buf *jb = create_jitter_buf(&cfg);
+    unsigned char packet[8] = { TEST_TOC_60MS, 0, 2, 3, 4, 5, 6, 7 };
+    unsigned char out[OPUS_MAX_PACKET_SIZE];
+    int maxTarget = 0;
+    for (int i = 0; i < 200; ++i) {
+        packet[1] = (unsigned char)i;
+        jitter_buf_put(jb, (uint32_t)i, packet, sizeof(packet), 1000 + i * 60);
+        jitter_buf_get(jb, out, sizeof(out), NULL);
+        jitter_buf_stats st;
+        jitter_buf_get_stats(jb, &st);
+        if (st.target_ms > maxTarget)
+            maxTarget = st.target_ms;
+    }
+    destroy_jitter_buf(jb);
+    printf("20 ms config, paced 60 ms packets: max target %d ms\n", maxTarget);
+    return maxTarget > cfg.min_delay_ms;
+}
+
+// TTS 一次下发 9s 的音频 (其中有停顿), 之后按实时取出: 缓冲很深但不是抖动造成的, 不能跳过
+static int test_burst(void) {
+    jitter_buf_config cfg = { 60, 40, 400, 256 };
+    jitter_buf *jb = create_jitter_buf(&cfg);
+    unsigned char packet[64] = { TEST_TOC_60MS };
+    unsigned char out[OPUS_MAX_PACKET_SIZE];
+    const int total = 150;
+    for (int i = 0; i < total; ++i) {
+        packet[1] = (unsigned char)i;
+        jitter_buf_put(jb, (uint32_t)i, packet, i % 50 < 40 ? 60 : 10, 1000 + i / 10);
+    }
+    for (int i = 0; i < total + 5; ++i)
+        jitter_buf_get(jb, out, sizeof(out), NULL);
+    jitter_buf_stats st;
+    jitter_buf_get_stats(jb, &st);
+    destroy_jitter_buf(jb);
+    printf("burst of %d packets: played %lu, skipped %lu\n", total, st.played, st.skipped);
+    return st.played != (unsigned long)total || st.skipped != 0;
+}
+
+int main(int argc, char **argv) {
+    const int frame_ms = 60;
+    jitter_buf_config cfg = { frame_ms, 40, 400, 64 };
+    jitter_buf *jb = create_jitter_buf(&cfg);
+    if (!jb)
+        return 1;
+
+    unsigned char packet[64] = { TEST_TOC_60MS };
+    unsigned char out[OPUS_MAX_PACKET_SIZE];
+    const int total = 1000;                       // 60s
+    std::vector<int64_t> arrival(total, -1);
+    int dropped = 0, fail = 0;
+    srand(3);
+
+    // 0~20s 抖动 0~10ms, 20~40s 抖动 0~150ms, 40~60s 抖动 0~30ms; 3% 丢包
+    for (int i = 0; i < total; ++i) {
+        int64_t send = (int64_t)i * frame_ms;
+        int jitter = send < 20000 ? 10 : (send < 40000 ? 150 : 30);
+        if (rand() % 100 < 3 && i > 0) {
+            dropped++;
+            continue;
+        }
+        arrival[i] = send + 20 + rand() % (jitter + 1);
+    }
+
+    unsigned long underrunsAt[3] = { 0, 0, 0 };
+    int maxTarget[3] = { 0, 0, 0 };
+    int depthAt[3] = { 0, 0, 0 }, targetAt[3] = { 0, 0, 0 };
+    int next = 0;
+    for (int64_t now = 0; now < (int64_t)total * frame_ms + 1000; ++now) {
+        // 到达时间可能乱序, 每毫秒检查所有已经到达的包
+        for (int i = next; i < total && i < next + 16; ++i) {
+            if (arrival[i] == now) {
+                // 语音包 60 字节, 停顿中的包 10 字节
+                packet[1] = (unsigned char)i;
+                jitter_buf_put(jb, (uint32_t)i, packet, i % 50 < 40 ? 60 : 10, now);
+            }
+        }
+        while (next < total && (arrival[next] < 0 || arrival[next] <= now))
+            next++;
+
+        if (now % frame_ms == 0) {
+            uint32_t seq;
+            int ret = jitter_buf_get(jb, out, sizeof(out), &seq);
+            if (ret > 0 && out[1] != (unsigned char)seq)
+                fail = 1;                        // 取出的包与序号不符
+        }
+
+        if (now % 20000 == 19999) {
+            jitter_buf_stats st;
+            jitter_buf_get_stats(jb, &st);
+            int phase = (int)(now / 20000);
+            underrunsAt[phase] = st.underruns;
+            depthAt[phase] = st.depth_ms;
+            targetAt[phase] = st.target_ms;
+            printf("%2ds: depth %d (%d ms), target %d ms, jitter %d ms, played %lu, lost %lu, late %lu, underruns %lu\n",
+                   (int)(now / 1000) + 1, st.depth_packets, st.depth_ms, st.target_ms, st.jitter_ms,
+                   st.played, st.lost, st.late, st.underruns);
+        }
+        if (now % 100 == 0) {
+            jitter_buf_stats st;
+            jitter_buf_get_stats(jb, &st);
+            int phase = (int)(now / 20000);
+            if (phase < 3 && st.target_ms > maxTarget[phase])
+                maxTarget[phase] = st.target_ms;
+        }
+    }
+
+    jitter_buf_stats st;
+    jitter_buf_get_stats(jb, &st);
+    printf("dropped by network %d, reported lost %lu, late %lu, skipped %lu\n",
+           dropped, st.lost, st.late, st.skipped);
+    // 每个被网络丢掉的包都应该被报告为缺失
+    if (st.lost < (unsigned long)dropped)
+        fail = 1;
+    // 大抖动阶段的目标深度应明显增大
+    if (maxTarget[1] < 100 || maxTarget[0] > 60)
+        fail = 1;
+    // 第二、三阶段开始一段时间后不应再频繁取空
+    if (underrunsAt[2] - underrunsAt[1] > 3)
+        fail = 1;
+    // 抖动变小 20s 后, 大抖动阶段留下的延迟应已在停顿中消化
+    if (depthAt[2] > targetAt[2] + 2 * frame_ms)
+        fail = 1;
+    destroy_jitter_buf(jb);
+
+    if (test_frame_mismatch())
+        fail = 1;
+    if (test_burst())
+        fail = 1;
+
+    printf("%s\n", fail ? "FAIL" : "OK");
+    return fail;
+}
+#endif
@@ -0,0 +1,86 @@
+#ifndef JITTER_BUF_H
+#define JITTER_BUF_H
+
+#include <stdint.h>
+
+/* 下行抖动缓冲: 接收线程按到达顺序放入 Opus 包, 播放线程按序号取出
+ * 缓冲深度根据观测到的到达抖动自适应调整, 缺失的包由调用者用 PLC/FEC 补出
+ * 抖动变小后多出来的延迟只靠跳过静音包和停顿中的小包消化: 没有停顿的连续语音或 CBR 编码的流要等到停顿或重新缓冲才能回落 */
+
+typedef struct jitter_buf_config {
+    int frame_ms;             /* 包的标称时长 (ms), 还没有收到包时使用; 应到达的时间按收到的每个包的实际时长推算 */
+    int min_delay_ms;         /* 开始播放前至少缓冲的时长 */
+    int max_delay_ms;         /* 自适应缓冲深度的上限 */
+    int capacity;             /* 最多缓存的包数, TTS 可能以快于实时的速度下发, 应留足余量 */
+} jitter_buf_config;
+
+typedef struct jitter_buf_stats {
+    int depth_packets;            /* 当前缓存的包数 */
+    int depth_ms;                 /* 当前缓存的音频时长 (ms), 即抖动缓冲额外增加的延迟 */
+    int target_ms;                /* 根据抖动计算出的目标缓冲时长 (ms) */
+    int jitter_ms;                /* 观测到的到达抖动 (ms, 峰值的衰减平均) */
+    unsigned long received;       /* 放入的包数 */
+    unsigned long played;         /* 按时取出的包数 */
+    unsigned long late;           /* 到达时已经错过播放时间而丢弃的包数 */
+    unsigned long duplicates;     /* 重复的包数 */
+    unsigned long lost;           /* 播放时缺失、需要补出的包数 */
+    unsigned long underruns;      /* 缓冲取空、重新开始缓冲的次数 */
+    unsigned long overflows;      /* 缓冲区满而丢弃的包数 */
+    unsigned long skipped;        /* 抖动减小后为缩短延迟而跳过的静音 (DTX) 包和停顿中的小包数 */
+} jitter_buf_stats;
+
+typedef struct jitter_buf jitter_buf;
+
+/**
+ * 创建抖动缓冲
+ * 
+ * @param cfg 配置, 会被复制
+ * @return 成功返回实例，配置无效或内存不足时返回NULL
+ */
+jitter_buf *create_jitter_buf(const jitter_buf_config *cfg);
+
+/**
+ * 销毁抖动缓冲
+ * 
+ * @param jb 实例，可以为NULL
+ */
+void destroy_jitter_buf(jitter_buf *jb);
+
+/**
+ * 放入一个收到的 Opus 包 (接收线程调用)
+ * 
+ * @param jb 实例
+ * @param seq 包的序号, 每个包加1, 允许回绕
+ * @param data Opus 包
+ * @param size 包的长度（字节）, 不超过 OPUS_MAX_PACKET_SIZE
+ * @param arrival_ms 到达时间 (单调时钟, ms)
+ * @return 成功返回0，迟到、重复或缓冲区满而丢弃时返回1，参数无效时返回-1
+ */
+int jitter_buf_put(jitter_buf *jb, uint32_t seq, const unsigned char *data, int size, int64_t arrival_ms);
+
+/**
+ * 取出下一个要播放的包 (播放线程调用)
+ * 
+ * @param jb 实例
+ * @param data 输出缓冲区
+ * @param maxsize 输出缓冲区大小
+ * @param seq 返回取出的 (或缺失的) 包的序号，可以为NULL
+ * @return >0: 包的长度;
+ *          0: 这个包缺失, 后面的包已经到了, 调用者应补出一帧 (可以用 jitter_buf_peek 取下一个包做 FEC);
+ *         -1: 正在缓冲或已取空, 调用者应播放静音
+ */
+int jitter_buf_get(jitter_buf *jb, unsigned char *data, int maxsize, uint32_t *seq);
+
+/**
+ * 查看下一个要播放的包但不取出, 用于对刚缺失的包做 FEC 恢复
+ * 
+ * @return 包的长度, 下一个包还没到时返回0
+ */
+int jitter_buf_peek(jitter_buf *jb, unsigned char *data, int maxsize);
+
+/**
+ * 获取缓冲深度和统计信息
+ */
+void jitter_buf_get_stats(jitter_buf *jb, jitter_buf_stats *stats);
+
+#endif // JITTER_BUF_H
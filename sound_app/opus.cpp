@@ -28,128 +28,537 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <algorithm>
 #include <cstring>
 #include <iomanip>
 #include <sstream>
+#include <new>
 #include <opus/opus.h>
 #include <speex/speex_resampler.h>  // 新增重采样头文件
+#include "opus.h"
+#include "pcm_mix.h"
+#include "resampler.h"
+
+/* 编码/解码流程, 创建实例时按配置绑定到特化版本或通用版本 */
+typedef int (*encode_frames_fn)(opus_encoder *enc, unsigned char* pcmdata, int pcmsize, unsigned char* opusdata, int* opussize);
+typedef int (*decode_packet_fn)(opus_decoder *dec, const unsigned char* packet, int packetsize, unsigned char* pcmdata);
 
 typedef struct opus_encoder {
     unsigned int inputSampleRate;
     unsigned int inputChannels;
-    unsigned int outputSampleRate;
+    unsigned int outputSampleRate;           // Opus 编码器工作的采样率
     unsigned int outputChannels;
     unsigned int duration_ms;
-    SpeexResamplerState* resampler;
+    codec_rate_mode rateMode;
+    int maxBandwidth;                        // NATIVE 模式下限制的最大音频带宽, 否则为 OPUS_AUTO
+    int bitrate;                             // 当前目标码率
+    int complexity;                          // 当前复杂度
+    int dtx;                                 // 是否打开了 DTX
+    int fec;                                 // 是否打开了带内 FEC
+    int packetLoss;                          // 预期丢包率 (%)
+    opus_encoder_profile profile;            // 当前预设
+    int lookahead;                           // 编码器前瞻 (outputSampleRate 下的样本数)
+    unsigned long statFrames;                // 累计编码的帧数
+    unsigned long statBytes;                 // 累计输出的字节数
+    SpeexResamplerState* resampler;          // 采样率相同或使用 fastResampler 时为NULL
+    fixed_resampler* fastResampler;          // 单声道常用比例的快速实现, 否则为NULL
     OpusEncoder* encoder;
+    encode_frames_fn encodeFrames;
+
+    /* 编码用的临时缓冲区, 在创建实例时一次性分配, 稳态编码时不再申请内存 */
+    std::vector<opus_int16> rawFrame;        // 输入缓冲区（多声道）
+    std::vector<opus_int16> pcmFrame;        // 中间缓冲区（多声道原始采样率）
+    std::vector<opus_int16> resampledFrame;  // 输出缓冲区（多声道目标采样率）
+    std::vector<unsigned char> opusFrame;    // Opus 数据缓冲区
 } opus_encoder;
 
 typedef struct opus_decoder {
-    int inputSampleRate;
-    int inputChannels;
+    int inputSampleRate;                     // Opus 解码器输出的采样率
+    int inputChannels;                       // Opus 解码器输出的通道数
     int outputSampleRate;
     int outputChannels;
     int duration_ms;
-    SpeexResamplerState* resampler;
+    codec_rate_mode rateMode;
+    SpeexResamplerState* resampler;          // 采样率相同或使用 fastResampler 时为NULL
+    fixed_resampler* fastResampler;          // 单声道常用比例的快速实现, 否则为NULL
     OpusDecoder* decoder;
+    decode_packet_fn decodePacket;
+
+    /* 按序号解码时的丢包检测 */
+    int haveSeq;                             // 是否已收到过带序号的包
+    uint32_t lastSeq;                        // 上一个包的序号
+    opus_decoder_stats stats;
+
+    /* 解码用的临时缓冲区, 在创建实例时一次性分配, 稳态解码时不再申请内存 */
+    int maxFrameSize;                        // 一个 Opus 包最多解码出的样本数（每通道, 解码器采样率）
+    int maxOutFrameSize;                     // 一个 Opus 包重采样后最多的样本数（每通道, 目标采样率）
+    std::vector<opus_int16> pcmFrame;        // 解码输出（解码器采样率）
+    std::vector<opus_int16> resampledFrame;  // 重采样输出（目标采样率, 解码器通道数）
+    std::vector<opus_int16> finalPcmFrame;   // 通道转换后的输出
 } opus_decoder;
 
-static opus_encoder g_opus_encoder;
-static opus_decoder g_opus_decoder;
+/* init_opus_encoder/init_opus_decoder 及 pcm2opus/opus2pcm 使用的默认实例 */
+static opus_encoder *g_opus_encoder = NULL;
+static opus_decoder *g_opus_decoder = NULL;
 
-int init_opus_encoder(unsigned int inputSampleRate, unsigned int inputChannels, unsigned int duration_ms, 
-                     unsigned int outputSampleRate, unsigned int outputChannels) {
-    // 设置全局配置结构体
-    g_opus_encoder.inputSampleRate = inputSampleRate;
-    g_opus_encoder.inputChannels = inputChannels;
-    g_opus_encoder.duration_ms = duration_ms;
-    g_opus_encoder.outputSampleRate = outputSampleRate;
-    g_opus_encoder.outputChannels = outputChannels;
-
-    int resampleErr;
-    g_opus_encoder.resampler = speex_resampler_init(
-        g_opus_encoder.outputChannels,
-        g_opus_encoder.inputSampleRate,
-        g_opus_encoder.outputSampleRate,
-        SPEEX_RESAMPLER_QUALITY_DEFAULT,
-        &resampleErr
-    );
+int opus_rate_supported(int sampleRate) {
+    return sampleRate == 8000 || sampleRate == 12000 || sampleRate == 16000 ||
+           sampleRate == 24000 || sampleRate == 48000;
+}
+
+// 采样率对应的 Opus 音频带宽, 用于限制 NATIVE 模式下编码的带宽
+static int bandwidth_for_rate(unsigned int sampleRate) {
+    if (sampleRate <= 8000)
+        return OPUS_BANDWIDTH_NARROWBAND;
+    if (sampleRate <= 12000)
+        return OPUS_BANDWIDTH_MEDIUMBAND;
+    if (sampleRate <= 16000)
+        return OPUS_BANDWIDTH_WIDEBAND;
+    if (sampleRate <= 24000)
+        return OPUS_BANDWIDTH_SUPERWIDEBAND;
+    return OPUS_BANDWIDTH_FULLBAND;
+}
+
+static int pcm2opus_generic(opus_encoder *enc, unsigned char* pcmdata, int pcmsize, unsigned char* opusdata, int* opussize);
+static int decode_packet_generic(opus_decoder *dec, const unsigned char* packet, int packetsize, unsigned char* pcmdata);
+static int convert_decoded_frame(opus_decoder *dec, int decodedSamples, unsigned char* pcmdata);
+
+/*
+ * 按固定配置特化的编码流程: 帧长和缓冲区大小都是编译期常量, 声道转换和重采样的分支在编译期确定
+ * 输出总是单声道, IN_RATE != OUT_RATE 时要求实例使用 fixed_resampler
+ */
+template <int IN_RATE, int IN_CH, int OUT_RATE, int DURATION_MS>
+static int pcm2opus_profile(opus_encoder *enc, unsigned char* pcmdata, int pcmsize, unsigned char* opusdata, int* opussize) {
+    static_assert(IN_CH == 1 || IN_CH == 2, "只支持单声道和立体声输入");
+    const int IN_FRAME = IN_RATE * DURATION_MS / 1000;
+    const int OUT_FRAME = OUT_RATE * DURATION_MS / 1000;
+    const int FRAME_BYTES = IN_FRAME * IN_CH * (int)sizeof(opus_int16);
+
+    opus_int16 *rawFrame = enc->rawFrame.data();
+    opus_int16 *pcmFrame = enc->pcmFrame.data();
+    opus_int16 *resampledFrame = enc->resampledFrame.data();
+    const int opusMax = (int)enc->opusFrame.size();
+
+    int frameCount = 0;
+    int totalEncodedBytes = 0;
+    for (int offset = 0; offset < pcmsize; offset += FRAME_BYTES) {
+        // 只有最后一个不完整帧需要补零
+        int bytes = std::min(FRAME_BYTES, pcmsize - offset);
+        memcpy(rawFrame, pcmdata + offset, bytes);
+        if (bytes < FRAME_BYTES)
+            memset(reinterpret_cast<unsigned char*>(rawFrame) + bytes, 0, FRAME_BYTES - bytes);
+
+        const opus_int16 *frame = rawFrame;
+        if (IN_CH == 2) {
+            pcm_downmix_2to1(rawFrame, pcmFrame, IN_FRAME);
+            frame = pcmFrame;
+        }
+        if (IN_RATE != OUT_RATE) {
+            if (fixed_resampler_process(enc->fastResampler, frame, IN_FRAME, resampledFrame, OUT_FRAME) != OUT_FRAME) {
+                std::cerr << "重采样样本数不匹配" << std::endl;
+                continue;
+            }
+            frame = resampledFrame;
+        }
+
+        int encodedBytes = opus_encode(enc->encoder, frame, OUT_FRAME, opusdata + totalEncodedBytes, opusMax);
+        if (encodedBytes < 0) {
+            std::cerr << "帧 " << frameCount << " 编码失败: " << opus_strerror(encodedBytes) << std::endl;
+            continue;
+        }
+        totalEncodedBytes += encodedBytes;
+        frameCount++;
+    }
+
+    *opussize = totalEncodedBytes;
+    return frameCount * OUT_FRAME;
+}
 
-    if (resampleErr != RESAMPLER_ERR_SUCCESS) {
-        std::cerr << "重采样器初始化失败 for encoder: " << resampleErr << std::endl;
+/*
+ * 按固定配置特化的解码流程, DEC_RATE/DEC_CH 是 Opus 解码器输出的格式
+ * DEC_RATE != OUT_RATE 时要求实例使用 fixed_resampler
+ */
+template <int DEC_RATE, int DEC_CH, int OUT_RATE, int OUT_CH>
+static int decode_packet_profile(opus_decoder *dec, const unsigned char* packet, int packetsize, unsigned char* pcmdata) {
+    static_assert((DEC_CH == 1 || DEC_CH == 2) && (OUT_CH == 1 || OUT_CH == 2), "只支持单声道和立体声");
+    const int MAX_FRAME = DEC_RATE * 120 / 1000;
+
+    int samples = opus_decode(dec->decoder, packet, packetsize, dec->pcmFrame.data(), MAX_FRAME, 0);
+    if (samples < 0) {
+        std::cerr << "解码失败: " << opus_strerror(samples) << std::endl;
         return -1;
     }
 
+    const opus_int16 *frame = dec->pcmFrame.data();
+    if (DEC_RATE != OUT_RATE) {
+        samples = fixed_resampler_process(dec->fastResampler, frame, samples, dec->resampledFrame.data(), dec->maxOutFrameSize);
+        if (samples < 0) {
+            std::cerr << "重采样输出缓冲区不足" << std::endl;
+            return -1;
+        }
+        frame = dec->resampledFrame.data();
+    }
+
+    const int bytes = samples * OUT_CH * (int)sizeof(opus_int16);
+    if (DEC_CH == OUT_CH) {
+        memcpy(pcmdata, frame, bytes);
+    } else {
+        if (OUT_CH == 1)
+            pcm_downmix_2to1(frame, dec->finalPcmFrame.data(), samples);
+        else
+            pcm_upmix_1to2(frame, dec->finalPcmFrame.data(), samples);
+        memcpy(pcmdata, dec->finalPcmFrame.data(), bytes);
+    }
+    return bytes;
+}
+
+typedef struct encode_profile {
+    int inputSampleRate;
+    int inputChannels;
+    int outputSampleRate;            // Opus 编码器工作的采样率, 输出固定为单声道
+    int duration_ms;
+    encode_frames_fn fn;
+} encode_profile;
+
+typedef struct decode_profile {
+    int inputSampleRate;             // Opus 解码器输出的采样率
+    int inputChannels;
+    int outputSampleRate;
+    int outputChannels;
+    decode_packet_fn fn;
+} decode_profile;
+
+#define ENCODE_PROFILE(inRate, inCh, outRate, ms) \
+    { inRate, inCh, outRate, ms, pcm2opus_profile<inRate, inCh, outRate, ms> }
+#define DECODE_PROFILE(decRate, decCh, outRate, outCh) \
+    { decRate, decCh, outRate, outCh, decode_packet_profile<decRate, decCh, outRate, outCh> }
+
+// 开发板上实际使用的配置, 每种帧时长 (20/40/60/120ms) 各一组, 其他配置走通用流程
+#define ENCODE_PROFILES_FOR(ms) \
+    ENCODE_PROFILE(16000, 1, 16000, ms), \
+    ENCODE_PROFILE(16000, 2, 16000, ms), \
+    ENCODE_PROFILE(48000, 1, 48000, ms), \
+    ENCODE_PROFILE(48000, 2, 48000, ms), \
+    ENCODE_PROFILE(48000, 1, 16000, ms), \
+    ENCODE_PROFILE(48000, 2, 16000, ms), \
+    ENCODE_PROFILE(44100, 1, 16000, ms), \
+    ENCODE_PROFILE(44100, 2, 16000, ms)
+
+static const encode_profile g_encode_profiles[] = {
+    ENCODE_PROFILES_FOR(20),
+    ENCODE_PROFILES_FOR(40),
+    ENCODE_PROFILES_FOR(60),
+    ENCODE_PROFILES_FOR(120),
+};
+
+static const decode_profile g_decode_profiles[] = {
+    DECODE_PROFILE(16000, 1, 16000, 1),
+    DECODE_PROFILE(16000, 2, 16000, 2),
+    DECODE_PROFILE(48000, 1, 48000, 1),
+    DECODE_PROFILE(48000, 2, 48000, 2),
+    DECODE_PROFILE(16000, 1, 48000, 1),
+    DECODE_PROFILE(16000, 1, 48000, 2),
+    DECODE_PROFILE(16000, 1, 44100, 1),
+    DECODE_PROFILE(16000, 1, 44100, 2),
+};
+
+/* 编码器预设 */
+struct encoder_preset {
+    const char *name;
+    int application;
+    int complexity;
+    int vbr;
+    int vbrConstraint;
+    int signal;
+};
+
+static const encoder_preset g_encoder_presets[] = {
+    /* lowdelay: 前瞻 2.5ms, 约束 VBR 让包长平稳, 复杂度留给码率控制调整 */
+    { "lowdelay", OPUS_APPLICATION_RESTRICTED_LOWDELAY, 6, 1, 1, OPUS_SIGNAL_VOICE },
+    { "voip",     OPUS_APPLICATION_VOIP,                8, 1, 0, OPUS_SIGNAL_VOICE },
+    { "quality",  OPUS_APPLICATION_AUDIO,              10, 1, 0, OPUS_AUTO },
+};
+
+const char *opus_encoder_profile_name(opus_encoder_profile profile) {
+    if (profile < OPUS_PROFILE_LOWDELAY || profile > OPUS_PROFILE_QUALITY)
+        return "unknown";
+    return g_encoder_presets[profile].name;
+}
+
+int opus_encoder_profile_from_name(const char *name) {
+    for (int i = 0; i < (int)(sizeof(g_encoder_presets) / sizeof(g_encoder_presets[0])); i++) {
+        if (strcmp(name, g_encoder_presets[i].name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// 按预设设置编码器, 并恢复码率、带宽限制和 DTX
+static int apply_encoder_preset(opus_encoder *enc, opus_encoder_profile profile) {
+    const encoder_preset& p = g_encoder_presets[profile];
+    opus_encoder_ctl(enc->encoder, OPUS_SET_COMPLEXITY(p.complexity));
+    opus_encoder_ctl(enc->encoder, OPUS_SET_VBR(p.vbr));
+    opus_encoder_ctl(enc->encoder, OPUS_SET_VBR_CONSTRAINT(p.vbrConstraint));
+    opus_encoder_ctl(enc->encoder, OPUS_SET_SIGNAL(p.signal));
+    opus_encoder_ctl(enc->encoder, OPUS_SET_BITRATE(enc->bitrate));
+    if (enc->maxBandwidth != OPUS_AUTO)
+        opus_encoder_ctl(enc->encoder, OPUS_SET_MAX_BANDWIDTH(enc->maxBandwidth));
+    opus_encoder_ctl(enc->encoder, OPUS_SET_DTX(enc->dtx));
+    opus_encoder_ctl(enc->encoder, OPUS_SET_INBAND_FEC(enc->fec));
+    opus_encoder_ctl(enc->encoder, OPUS_SET_PACKET_LOSS_PERC(enc->packetLoss));
+
+    opus_int32 lookahead = 0;
+    opus_encoder_ctl(enc->encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+    enc->lookahead = lookahead;
+    enc->complexity = p.complexity;
+    enc->profile = profile;
+    return 0;
+}
+
+// 在实例创建完成后调用, 找不到匹配的特化版本时使用通用流程
+static void bind_encode_profile(opus_encoder *enc) {
+    enc->encodeFrames = pcm2opus_generic;
+    if (enc->outputChannels != 1 || enc->resampler)
+        return;
+    for (const encode_profile& p : g_encode_profiles) {
+        if (p.inputSampleRate == (int)enc->inputSampleRate && p.inputChannels == (int)enc->inputChannels &&
+            p.outputSampleRate == (int)enc->outputSampleRate && p.duration_ms == (int)enc->duration_ms) {
+            enc->encodeFrames = p.fn;
+            return;
+        }
+    }
+}
+
+static void bind_decode_profile(opus_decoder *dec) {
+    dec->decodePacket = decode_packet_generic;
+    if (dec->resampler)
+        return;
+    for (const decode_profile& p : g_decode_profiles) {
+        if (p.inputSampleRate == dec->inputSampleRate && p.inputChannels == dec->inputChannels &&
+            p.outputSampleRate == dec->outputSampleRate && p.outputChannels == dec->outputChannels) {
+            dec->decodePacket = p.fn;
+            return;
+        }
+    }
+}
+
+opus_encoder *create_opus_encoder(unsigned int inputSampleRate, unsigned int inputChannels, unsigned int duration_ms, 
+                                  unsigned int outputSampleRate, unsigned int outputChannels, codec_rate_mode mode) {
+    opus_encoder *enc = new (std::nothrow) opus_encoder();
+    if (!enc) {
+        std::cerr << "编码器实例分配失败" << std::endl;
+        return NULL;
+    }
+
+    // Opus 包与编码器输入的采样率无关: 直接以采集的采样率编码, 再把带宽限制到目标采样率,
+    // 得到的包可以被按目标采样率工作的一端直接解码
+    enc->maxBandwidth = OPUS_AUTO;
+    if (mode == CODEC_RATE_NATIVE && opus_rate_supported(inputSampleRate)) {
+        enc->maxBandwidth = bandwidth_for_rate(outputSampleRate);
+        outputSampleRate = inputSampleRate;
+    } else {
+        mode = CODEC_RATE_RESAMPLE;
+    }
+
+    // 设置实例配置
+    enc->inputSampleRate = inputSampleRate;
+    enc->inputChannels = inputChannels;
+    enc->duration_ms = duration_ms;
+    enc->outputSampleRate = outputSampleRate;
+    enc->outputChannels = outputChannels;
+    enc->rateMode = mode;
+
+    // 单声道的 48k/44.1k <-> 16k 使用固定比例的多相滤波器, 其他情况使用 Speex
+    if (enc->inputSampleRate != enc->outputSampleRate && enc->outputChannels == 1)
+        enc->fastResampler = create_fixed_resampler(enc->inputSampleRate, enc->outputSampleRate);
+
+    if (enc->inputSampleRate != enc->outputSampleRate && !enc->fastResampler) {
+        int resampleErr;
+        enc->resampler = speex_resampler_init(
+            enc->outputChannels,
+            enc->inputSampleRate,
+            enc->outputSampleRate,
+            SPEEX_RESAMPLER_QUALITY_DEFAULT,
+            &resampleErr
+        );
+
+        if (resampleErr != RESAMPLER_ERR_SUCCESS) {
+            std::cerr << "重采样器初始化失败 for encoder: " << resampleErr << std::endl;
+            delete enc;
+            return NULL;
+        }
+    }
+
     int opusError;
-    g_opus_encoder.encoder = opus_encoder_create(
-        g_opus_encoder.outputSampleRate,
-        g_opus_encoder.outputChannels,
+    enc->encoder = opus_encoder_create(
+        enc->outputSampleRate,
+        enc->outputChannels,
         OPUS_APPLICATION_AUDIO,
         &opusError
     );
     if (opusError != OPUS_OK) {
         std::cerr << "编码器初始化失败: " << opus_strerror(opusError) << std::endl;
-        speex_resampler_destroy(g_opus_encoder.resampler);
-        return -1;
+        if (enc->resampler)
+            speex_resampler_destroy(enc->resampler);
+        destroy_fixed_resampler(enc->fastResampler);
+        delete enc;
+        return NULL;
     }
-    opus_encoder_ctl(g_opus_encoder.encoder, OPUS_SET_BITRATE(64000));
+    enc->bitrate = 64000;
+    apply_encoder_preset(enc, OPUS_PROFILE_QUALITY);
+
+    // 一次性分配编码所需的缓冲区
+    const unsigned int originalFrameSize = inputSampleRate * duration_ms / 1000;
+    const unsigned int targetFrameSize = outputSampleRate * duration_ms / 1000;
+    const unsigned int maxChannels = std::max(inputChannels, outputChannels);
+    enc->rawFrame.resize(originalFrameSize * inputChannels);
+    enc->pcmFrame.resize(originalFrameSize * maxChannels);
+    enc->resampledFrame.resize(targetFrameSize * outputChannels);
+    enc->opusFrame.resize(4000);
+
+    bind_encode_profile(enc);
+    return enc;
+}
 
-    return 0;
+void destroy_opus_encoder(opus_encoder *enc) {
+    if (!enc)
+        return;
+    if (enc->encoder)
+        opus_encoder_destroy(enc->encoder);
+    if (enc->resampler)
+        speex_resampler_destroy(enc->resampler);
+    destroy_fixed_resampler(enc->fastResampler);
+    delete enc;
 }
 
-int init_opus_decoder(int inputSampleRate, int inputChannels, int duration_ms, 
-                       int outputSampleRate, int outputChannels) {
-    // 设置全局配置结构体
-    g_opus_decoder.inputSampleRate = inputSampleRate;
-    g_opus_decoder.inputChannels = inputChannels;
-    g_opus_decoder.duration_ms = duration_ms;
-    g_opus_decoder.outputSampleRate = outputSampleRate;
-    g_opus_decoder.outputChannels = outputChannels;
-
-    int resampleErr;
-    g_opus_decoder.resampler = speex_resampler_init(
-        g_opus_decoder.inputChannels,
-        g_opus_decoder.inputSampleRate,
-        g_opus_decoder.outputSampleRate,
-        SPEEX_RESAMPLER_QUALITY_DEFAULT,
-        &resampleErr
-    );
+opus_decoder *create_opus_decoder(int inputSampleRate, int inputChannels, int duration_ms, 
+                                  int outputSampleRate, int outputChannels, codec_rate_mode mode) {
+    opus_decoder *dec = new (std::nothrow) opus_decoder();
+    if (!dec) {
+        std::cerr << "解码器实例分配失败" << std::endl;
+        return NULL;
+    }
 
-    if (resampleErr != RESAMPLER_ERR_SUCCESS) {
-        std::cerr << "重采样器初始化失败 for decoder: " << resampleErr <<" inputSampleRate "<< g_opus_decoder.inputSampleRate << "  "<< g_opus_decoder.outputSampleRate << "inputChannels "<< g_opus_decoder.inputChannels<< std::endl;
-        return -1;
+    // Opus 可以直接解码出任意支持的采样率和 1/2 通道, 与码流本身的采样率无关
+    if (mode == CODEC_RATE_NATIVE && opus_rate_supported(outputSampleRate) && outputChannels <= 2) {
+        inputSampleRate = outputSampleRate;
+        inputChannels = outputChannels;
+    } else {
+        mode = CODEC_RATE_RESAMPLE;
+    }
+
+    // 设置实例配置
+    dec->inputSampleRate = inputSampleRate;
+    dec->inputChannels = inputChannels;
+    dec->duration_ms = duration_ms;
+    dec->outputSampleRate = outputSampleRate;
+    dec->outputChannels = outputChannels;
+    dec->rateMode = mode;
+
+    if (dec->inputSampleRate != dec->outputSampleRate && dec->inputChannels == 1)
+        dec->fastResampler = create_fixed_resampler(dec->inputSampleRate, dec->outputSampleRate);
+
+    if (dec->inputSampleRate != dec->outputSampleRate && !dec->fastResampler) {
+        int resampleErr;
+        dec->resampler = speex_resampler_init(
+            dec->inputChannels,
+            dec->inputSampleRate,
+            dec->outputSampleRate,
+            SPEEX_RESAMPLER_QUALITY_DEFAULT,
+            &resampleErr
+        );
+
+        if (resampleErr != RESAMPLER_ERR_SUCCESS) {
+            std::cerr << "重采样器初始化失败 for decoder: " << resampleErr <<" inputSampleRate "<< dec->inputSampleRate << "  "<< dec->outputSampleRate << "inputChannels "<< dec->inputChannels<< std::endl;
+            delete dec;
+            return NULL;
+        }
     }
 
     // 初始化 Opus 解码器
     int error;
-    OpusDecoder* decoder = opus_decoder_create(g_opus_decoder.inputSampleRate, g_opus_decoder.inputChannels, &error);
+    dec->decoder = opus_decoder_create(dec->inputSampleRate, dec->inputChannels, &error);
     if (error != OPUS_OK) {
         std::cerr << "解码器初始化失败: " << opus_strerror(error) << std::endl;
-        return -1;
+        if (dec->resampler)
+            speex_resampler_destroy(dec->resampler);
+        destroy_fixed_resampler(dec->fastResampler);
+        delete dec;
+        return NULL;
     }    
-    g_opus_decoder.decoder = decoder;
+
+    // 一次性分配解码所需的缓冲区, Opus 单个包最长 120 ms, 重采样输出多留一点余量
+    dec->maxFrameSize = inputSampleRate * 120 / 1000;
+    dec->maxOutFrameSize = outputSampleRate * 120 / 1000 + 16;
+    dec->pcmFrame.resize(dec->maxFrameSize * inputChannels);
+    dec->resampledFrame.resize(dec->maxOutFrameSize * inputChannels);
+    dec->finalPcmFrame.resize(dec->maxOutFrameSize * outputChannels);
+
+    bind_decode_profile(dec);
+    return dec;
+}
+
+void destroy_opus_decoder(opus_decoder *dec) {
+    if (!dec)
+        return;
+    if (dec->decoder)
+        opus_decoder_destroy(dec->decoder);
+    if (dec->resampler)
+        speex_resampler_destroy(dec->resampler);
+    destroy_fixed_resampler(dec->fastResampler);
+    delete dec;
+}
+
+int init_opus_encoder(unsigned int inputSampleRate, unsigned int inputChannels, unsigned int duration_ms, 
+                     unsigned int outputSampleRate, unsigned int outputChannels, codec_rate_mode mode) {
+    opus_encoder *enc = create_opus_encoder(inputSampleRate, inputChannels, duration_ms, outputSampleRate, outputChannels, mode);
+    if (!enc)
+        return -1;
+
+    // 替换默认实例
+    destroy_opus_encoder(g_opus_encoder);
+    g_opus_encoder = enc;
     return 0;
 }
 
-int pcm2opus(unsigned char* pcmdata, int pcmsize, unsigned char* opusdata, int* opussize) {
-    // 使用全局配置结构体中的参数
-    int sampleRate = g_opus_encoder.inputSampleRate;
-    int inputChannels = g_opus_encoder.inputChannels;
-    int outsampleRate = g_opus_encoder.outputSampleRate;
-    int outputChannels = g_opus_encoder.outputChannels;
+int init_opus_decoder(int inputSampleRate, int inputChannels, int duration_ms, 
+                       int outputSampleRate, int outputChannels, codec_rate_mode mode) {
+    opus_decoder *dec = create_opus_decoder(inputSampleRate, inputChannels, duration_ms, outputSampleRate, outputChannels, mode);
+    if (!dec)
+        return -1;
 
-    const int originalFrameSize = sampleRate * g_opus_encoder.duration_ms / 1000;  // 原始帧大小
-    const int targetFrameSize = outsampleRate * g_opus_encoder.duration_ms / 1000; // 目标帧大小
+    // 替换默认实例
+    destroy_opus_decoder(g_opus_decoder);
+    g_opus_decoder = dec;
+    return 0;
+}
 
-    // 输入缓冲区（多声道）
-    std::vector<opus_int16> rawFrame(originalFrameSize * inputChannels);
-    // 中间缓冲区（多声道原始采样率）
-    std::vector<opus_int16> pcmFrame(originalFrameSize * inputChannels);
-    // 输出缓冲区（多声道目标采样率）
-    std::vector<opus_int16> resampledFrame(targetFrameSize * outputChannels);
+void deinit_opus_encoder(void) {
+    destroy_opus_encoder(g_opus_encoder);
+    g_opus_encoder = NULL;
+}
+
+void deinit_opus_decoder(void) {
+    destroy_opus_decoder(g_opus_decoder);
+    g_opus_decoder = NULL;
+}
+
+// 通用编码流程, 支持任意的采样率和通道数组合
+static int pcm2opus_generic(opus_encoder *enc, unsigned char* pcmdata, int pcmsize, unsigned char* opusdata, int* opussize) {
+    // 使用实例中的参数
+    int sampleRate = enc->inputSampleRate;
+    int inputChannels = enc->inputChannels;
+    int outsampleRate = enc->outputSampleRate;
+    int outputChannels = enc->outputChannels;
 
-    // Opus 数据缓冲区
-    std::vector<unsigned char> opusFrame(4000);
+    const int originalFrameSize = sampleRate * enc->duration_ms / 1000;  // 原始帧大小
+    const int targetFrameSize = outsampleRate * enc->duration_ms / 1000; // 目标帧大小
+
+    // 使用实例中预先分配的缓冲区
+    std::vector<opus_int16>& rawFrame = enc->rawFrame;
+    std::vector<opus_int16>& pcmFrame = enc->pcmFrame;
+    std::vector<opus_int16>& resampledFrame = enc->resampledFrame;
+    std::vector<unsigned char>& opusFrame = enc->opusFrame;
 
     // 逐帧处理
     int frameCount = 0;
@@ -174,7 +583,10 @@ int pcm2opus(unsigned char* pcmdata, int pcmsize, unsigned char* opusdata, int*
         //printf("%s %d\n", __FUNCTION__, __LINE__);
 
         // 根据目标通道数处理音频数据
-        if (outputChannels == 1 && inputChannels > 1) {
+        if (outputChannels == 1 && inputChannels == 2) {
+            // 立体声转单声道, 使用 SIMD 实现
+            pcm_downmix_2to1(rawFrame.data(), pcmFrame.data(), originalFrameSize);
+        } else if (outputChannels == 1 && inputChannels > 1) {
             // 多声道转单声道
             for (int i = 0; i < originalFrameSize; ++i) {
                 opus_int32 sum = 0;
@@ -197,33 +609,45 @@ int pcm2opus(unsigned char* pcmdata, int pcmsize, unsigned char* opusdata, int*
             }
         }
         //printf("%s %d\n", __FUNCTION__, __LINE__);
-        // 执行重采样
-        spx_uint32_t in_len = originalFrameSize;
-        spx_uint32_t out_len = targetFrameSize;
-        int resampleErr = speex_resampler_process_int(
-            g_opus_encoder.resampler,
-            0,
-            pcmFrame.data(),
-            &in_len,
-            resampledFrame.data(),
-            &out_len
-        );
-        //printf("%s %d\n", __FUNCTION__, __LINE__);
-        if (resampleErr != RESAMPLER_ERR_SUCCESS) {
-            std::cerr << "重采样失败: " << resampleErr << std::endl;
-            continue;
-        }
-        //printf("%s %d\n", __FUNCTION__, __LINE__);
-        // 检查重采样结果
-        if (in_len != originalFrameSize || out_len != targetFrameSize) {
-            std::cerr << "重采样样本数不匹配" << std::endl;
-            continue;
+        // 执行重采样, 编码器直接工作在采集采样率时跳过
+        const opus_int16 *encodeFrame = pcmFrame.data();
+        if (enc->fastResampler) {
+            int out_len = fixed_resampler_process(enc->fastResampler, pcmFrame.data(), originalFrameSize,
+                                                  resampledFrame.data(), targetFrameSize);
+            if (out_len != targetFrameSize) {
+                std::cerr << "重采样样本数不匹配" << std::endl;
+                continue;
+            }
+            encodeFrame = resampledFrame.data();
+        } else if (enc->resampler) {
+            spx_uint32_t in_len = originalFrameSize;
+            spx_uint32_t out_len = targetFrameSize;
+            int resampleErr = speex_resampler_process_int(
+                enc->resampler,
+                0,
+                pcmFrame.data(),
+                &in_len,
+                resampledFrame.data(),
+                &out_len
+            );
+            //printf("%s %d\n", __FUNCTION__, __LINE__);
+            if (resampleErr != RESAMPLER_ERR_SUCCESS) {
+                std::cerr << "重采样失败: " << resampleErr << std::endl;
+                continue;
+            }
+            //printf("%s %d\n", __FUNCTION__, __LINE__);
+            // 检查重采样结果
+            if (in_len != originalFrameSize || out_len != targetFrameSize) {
+                std::cerr << "重采样样本数不匹配" << std::endl;
+                continue;
+            }
+            encodeFrame = resampledFrame.data();
         }
         //printf("%s %d\n", __FUNCTION__, __LINE__);
         // 编码 Opus 帧
         int encodedBytes = opus_encode(
-            g_opus_encoder.encoder,
-            resampledFrame.data(),
+            enc->encoder,
+            encodeFrame,
             targetFrameSize,
             opusFrame.data(),
             opusFrame.size()
@@ -254,39 +678,152 @@ int pcm2opus(unsigned char* pcmdata, int pcmsize, unsigned char* opusdata, int*
     return frameCount * targetFrameSize;
 }
 
-int opus2pcm(unsigned char* opusdata, int opussize, unsigned char* pcmdata, int *pcmsize) {
-    // 计算最大可能的 PCM 数据大小
-    int maxFrameSize = 480; // Opus 最大帧大小为 120 ms，假设 48 kHz 采样率
-    int maxPcmSize = maxFrameSize * g_opus_decoder.inputChannels * sizeof(opus_int16);
-    std::vector<opus_int16> pcmFrame(maxPcmSize);
-
-    // 计算目标 PCM 数据大小
-    int targetFrameSize = g_opus_decoder.outputSampleRate * g_opus_decoder.duration_ms / 1000;
-    int targetPcmSize = targetFrameSize * g_opus_decoder.outputChannels * sizeof(opus_int16);
-    std::vector<opus_int16> resampledFrame(targetPcmSize);
-
-    // 逐帧解码
-    int totalBytesRead = 0;
-    int totalPcmBytes = 0;
-    while (totalBytesRead < opussize) {
-        // 计算当前帧的大小
-        size_t frameSize = std::min(static_cast<size_t>(maxFrameSize * sizeof(opus_int16) * g_opus_decoder.inputChannels), static_cast<size_t>(opussize - totalBytesRead));
+int pcm2opus_ex(opus_encoder *enc, unsigned char* pcmdata, int pcmsize, unsigned char* opusdata, int* opussize) {
+    int samples = enc->encodeFrames(enc, pcmdata, pcmsize, opusdata, opussize);
+    if (samples > 0) {
+        enc->statFrames += samples / (enc->outputSampleRate * enc->duration_ms / 1000);
+        enc->statBytes += *opussize;
+    }
+    return samples;
+}
 
-        // 解码 Opus 帧
-        int decodedSamples = opus_decode(g_opus_decoder.decoder, opusdata + totalBytesRead, frameSize, pcmFrame.data(), maxPcmSize, 0);
-        if (decodedSamples < 0) {
-            std::cerr << "帧 " << totalBytesRead / frameSize + 1 << " 解码失败: " << opus_strerror(decodedSamples) << std::endl;
-            return -1;
-        }
+int opus_encoder_set_bitrate(opus_encoder *enc, int bitrate) {
+    if (!enc)
+        return -1;
+    if (bitrate == enc->bitrate)
+        return 0;
+    int err = opus_encoder_ctl(enc->encoder, OPUS_SET_BITRATE(bitrate));
+    if (err != OPUS_OK) {
+        std::cerr << "设置码率失败: " << bitrate << " " << opus_strerror(err) << std::endl;
+        return -1;
+    }
+    enc->bitrate = bitrate;
+    return 0;
+}
+
+int opus_encoder_set_complexity(opus_encoder *enc, int complexity) {
+    if (!enc)
+        return -1;
+    if (complexity == enc->complexity)
+        return 0;
+    int err = opus_encoder_ctl(enc->encoder, OPUS_SET_COMPLEXITY(complexity));
+    if (err != OPUS_OK) {
+        std::cerr << "设置复杂度失败: " << complexity << " " << opus_strerror(err) << std::endl;
+        return -1;
+    }
+    enc->complexity = complexity;
+    return 0;
+}
+
+int opus_encoder_set_dtx(opus_encoder *enc, int enable) {
+    if (!enc)
+        return -1;
+    int err = opus_encoder_ctl(enc->encoder, OPUS_SET_DTX(enable ? 1 : 0));
+    if (err != OPUS_OK) {
+        std::cerr << "设置 DTX 失败: " << opus_strerror(err) << std::endl;
+        return -1;
+    }
+    enc->dtx = enable ? 1 : 0;
+    return 0;
+}
+
+int opus_encoder_set_fec(opus_encoder *enc, int enable) {
+    if (!enc)
+        return -1;
+    int err = opus_encoder_ctl(enc->encoder, OPUS_SET_INBAND_FEC(enable ? 1 : 0));
+    if (err != OPUS_OK) {
+        std::cerr << "设置 FEC 失败: " << opus_strerror(err) << std::endl;
+        return -1;
+    }
+    enc->fec = enable ? 1 : 0;
+    return 0;
+}
+
+int opus_encoder_set_packet_loss(opus_encoder *enc, int percent) {
+    if (!enc)
+        return -1;
+    if (percent == enc->packetLoss)
+        return 0;
+    int err = opus_encoder_ctl(enc->encoder, OPUS_SET_PACKET_LOSS_PERC(percent));
+    if (err != OPUS_OK) {
+        std::cerr << "设置丢包率失败: " << percent << " " << opus_strerror(err) << std::endl;
+        return -1;
+    }
+    enc->packetLoss = percent;
+    return 0;
+}
 
-        // 计算解码后的 PCM 数据大小
-        int decodedBytes = decodedSamples * sizeof(opus_int16) * g_opus_decoder.inputChannels;
+int opus_encoder_set_profile(opus_encoder *enc, opus_encoder_profile profile) {
+    if (!enc || profile < OPUS_PROFILE_LOWDELAY || profile > OPUS_PROFILE_QUALITY)
+        return -1;
 
-        // 执行重采样
+    // application 只能在初始化时指定 (RESTRICTED_LOWDELAY 不能用 OPUS_SET_APPLICATION 切换), 在原有内存上重新初始化
+    int err = opus_encoder_init(enc->encoder, enc->outputSampleRate, enc->outputChannels, g_encoder_presets[profile].application);
+    if (err != OPUS_OK) {
+        std::cerr << "切换编码器预设失败: " << g_encoder_presets[profile].name << " " << opus_strerror(err) << std::endl;
+        return -1;
+    }
+    return apply_encoder_preset(enc, profile);
+}
+
+int opus_encoder_get_stats(opus_encoder *enc, opus_encoder_stats *stats) {
+    if (!enc || !stats)
+        return -1;
+    stats->bitrate = enc->bitrate;
+    stats->complexity = enc->complexity;
+    stats->profile = enc->profile;
+    stats->lookahead_us = (int)((long long)enc->lookahead * 1000000 / enc->outputSampleRate);
+    stats->fec = enc->fec;
+    stats->packet_loss_percent = enc->packetLoss;
+    stats->frames = enc->statFrames;
+    stats->bytes = enc->statBytes;
+    return 0;
+}
+
+/**
+ * 解码一个完整的 Opus 包, 重采样并转换通道后写入 pcmdata (通用流程)
+ * 
+ * @return 成功返回写入的字节数，失败返回-1
+ */
+static int decode_packet_generic(opus_decoder *dec, const unsigned char* packet, int packetsize, unsigned char* pcmdata) {
+    // 解码 Opus 帧
+    int decodedSamples = opus_decode(dec->decoder, packet, packetsize, dec->pcmFrame.data(), dec->maxFrameSize, 0);
+    if (decodedSamples < 0) {
+        std::cerr << "解码失败: " << opus_strerror(decodedSamples) << std::endl;
+        return -1;
+    }
+    return convert_decoded_frame(dec, decodedSamples, pcmdata);
+}
+
+/**
+ * 把 pcmFrame 中解码得到的 decodedSamples 个样本重采样并转换通道后写入 pcmdata
+ * 
+ * @return 成功返回写入的字节数，失败返回-1
+ */
+static int convert_decoded_frame(opus_decoder *dec, int decodedSamples, unsigned char* pcmdata) {
+    // 使用实例中预先分配的缓冲区
+    std::vector<opus_int16>& pcmFrame = dec->pcmFrame;
+    std::vector<opus_int16>& resampledFrame = dec->resampledFrame;
+    std::vector<opus_int16>& finalPcmFrame = dec->finalPcmFrame;
+
+    const opus_int16 *frame = pcmFrame.data();
+    int targetFrameSize = decodedSamples;
+
+    // 执行重采样, 解码器直接工作在目标采样率时跳过
+    if (dec->fastResampler) {
+        int out_len = fixed_resampler_process(dec->fastResampler, pcmFrame.data(), decodedSamples,
+                                              resampledFrame.data(), dec->maxOutFrameSize);
+        if (out_len < 0) {
+            std::cerr << "重采样输出缓冲区不足" << std::endl;
+            return -1;
+        }
+        frame = resampledFrame.data();
+        targetFrameSize = out_len;
+    } else if (dec->resampler) {
         spx_uint32_t in_len = decodedSamples;
-        spx_uint32_t out_len = targetFrameSize;
+        spx_uint32_t out_len = dec->maxOutFrameSize;
         int resampleErr = speex_resampler_process_int(
-            g_opus_decoder.resampler,
+            dec->resampler,
             0,
             pcmFrame.data(),
             &in_len,
@@ -300,58 +837,316 @@ int opus2pcm(unsigned char* opusdata, int opussize, unsigned char* pcmdata, int
         }
 
         // 检查重采样结果
-        if (in_len != decodedSamples || out_len != targetFrameSize) {
+        if (in_len != decodedSamples) {
             std::cerr << "重采样样本数不匹配" << std::endl;
             return -1;
         }
+        frame = resampledFrame.data();
+        targetFrameSize = out_len;
+    }
 
-        // 处理通道数不同的情况
-        std::vector<opus_int16> finalPcmFrame(targetFrameSize * g_opus_decoder.outputChannels);
-        if (g_opus_decoder.outputChannels == 1 && g_opus_decoder.inputChannels > 1) {
-            // 多声道转单声道
-            for (int i = 0; i < targetFrameSize; ++i) {
-                opus_int32 sum = 0;
-                for (int c = 0; c < g_opus_decoder.inputChannels; ++c) {
-                    sum += resampledFrame[i * g_opus_decoder.inputChannels + c];
-                }
-                finalPcmFrame[i] = static_cast<opus_int16>(sum / g_opus_decoder.inputChannels);
+    int finalPcmBytes = targetFrameSize * dec->outputChannels * sizeof(opus_int16);
+    if (dec->outputChannels == dec->inputChannels) {
+        // 通道数相同，直接复制到 pcmdata 缓冲区
+        memcpy(pcmdata, frame, finalPcmBytes);
+        return finalPcmBytes;
+    }
+
+    // 处理通道数不同的情况
+    if (dec->outputChannels == 1 && dec->inputChannels == 2) {
+        // 立体声转单声道, 使用 SIMD 实现
+        pcm_downmix_2to1(frame, finalPcmFrame.data(), targetFrameSize);
+    } else if (dec->outputChannels == 2 && dec->inputChannels == 1) {
+        // 单声道转立体声, 使用 SIMD 实现
+        pcm_upmix_1to2(frame, finalPcmFrame.data(), targetFrameSize);
+    } else if (dec->outputChannels == 1 && dec->inputChannels > 1) {
+        // 多声道转单声道
+        for (int i = 0; i < targetFrameSize; ++i) {
+            opus_int32 sum = 0;
+            for (int c = 0; c < dec->inputChannels; ++c) {
+                sum += frame[i * dec->inputChannels + c];
             }
-        } else if (g_opus_decoder.outputChannels == g_opus_decoder.inputChannels) {
-            // 通道数相同，直接使用重采样后的数据
-            memcpy(finalPcmFrame.data(), resampledFrame.data(), targetFrameSize * g_opus_decoder.outputChannels * sizeof(opus_int16));
-        } else {
-            // 通道数不同且不为单声道，需要进行通道数转换
-            // 这里简单地将每个通道的数据复制到目标通道
-            // 实际应用中可能需要更复杂的通道映射
-            for (int i = 0; i < targetFrameSize; ++i) {
-                for (int c = 0; c < g_opus_decoder.outputChannels; ++c) {
-                    finalPcmFrame[i * g_opus_decoder.outputChannels + c] = resampledFrame[i * g_opus_decoder.inputChannels + (c % g_opus_decoder.inputChannels)];
-                }
+            finalPcmFrame[i] = static_cast<opus_int16>(sum / dec->inputChannels);
+        }
+    } else {
+        // 通道数不同且不为单声道，需要进行通道数转换
+        // 这里简单地将每个通道的数据复制到目标通道
+        // 实际应用中可能需要更复杂的通道映射
+        for (int i = 0; i < targetFrameSize; ++i) {
+            for (int c = 0; c < dec->outputChannels; ++c) {
+                finalPcmFrame[i * dec->outputChannels + c] = frame[i * dec->inputChannels + (c % dec->inputChannels)];
             }
         }
+    }
 
-        // 计算最终 PCM 数据大小
-        int finalPcmBytes = targetFrameSize * g_opus_decoder.outputChannels * sizeof(opus_int16);
+    // 将处理后的 PCM 数据复制到 pcmdata 缓冲区
+    memcpy(pcmdata, finalPcmFrame.data(), finalPcmBytes);
+    return finalPcmBytes;
+}
 
-        // 检查 PCM 数据缓冲区是否足够
-        //if (totalPcmBytes + finalPcmBytes > *pcmsize) {
-        //    std::cerr << "PCM 数据缓冲区不足" << std::endl;
-        //    return -1;
-        //}
+/**
+ * 估算一个 Opus 包解码后最多输出的字节数, 用于在解码前检查输出缓冲区
+ */
+static int max_decoded_bytes(opus_decoder *dec, const unsigned char* packet, int packetsize) {
+    int samples = opus_decoder_get_nb_samples(dec->decoder, packet, packetsize);
+    if (samples < 0)
+        return samples;
+    int outSamples = (int)((long long)samples * dec->outputSampleRate / dec->inputSampleRate) + 1;
+    return outSamples * dec->outputChannels * sizeof(opus_int16);
+}
 
-        // 将处理后的 PCM 数据复制到 pcmdata 缓冲区
-        memcpy(pcmdata + totalPcmBytes, finalPcmFrame.data(), finalPcmBytes);
-        totalPcmBytes += finalPcmBytes;
-        totalBytesRead += frameSize;
-    }
+int opus2pcm_ex(opus_decoder *dec, unsigned char* opusdata, int opussize, unsigned char* pcmdata, int *pcmsize) {
+    // 一次调用的数据就是一个完整的 Opus 包 (对应一个 UDP 报文)
+    *pcmsize = 0;
+    if (opussize <= 0)
+        return 0;
+
+    int bytes = dec->decodePacket(dec, opusdata, opussize, pcmdata);
+    if (bytes < 0)
+        return -1;
 
     // 更新 pcmsize 为实际解码的数据大小
-    *pcmsize = totalPcmBytes;
+    *pcmsize = bytes;
+    return 0;
+}
+
+// 包里是否带有 FEC (SILK 的 LBRR) 数据, 与 libopus 1.5 的 opus_packet_has_lbrr 相同:
+// LBRR 标志紧跟在第一个 Opus 帧开头的各 SILK 帧 VAD 标志之后, 按 1/2 概率编码, 就是首字节中对应的位
+static int packet_has_fec(const unsigned char* packet, int size) {
+    if (size < 1 || (packet[0] >> 3) >= 16)     // CELT-only 没有 FEC
+        return 0;
+    const unsigned char *frames[48];
+    opus_int16 sizes[48];
+    if (opus_packet_parse(packet, size, NULL, frames, sizes, NULL) <= 0 || sizes[0] == 0)
+        return 0;
+    int silkFrames = opus_packet_get_samples_per_frame(packet, 48000) / 960;
+    if (silkFrames < 1)
+        silkFrames = 1;
+    int lbrr = (frames[0][0] >> (7 - silkFrames)) & 1;
+    if (opus_packet_get_nb_channels(packet) == 2)
+        lbrr |= (frames[0][0] >> (6 - 2 * silkFrames)) & 1;
+    return lbrr;
+}
 
+// 补出 lostSamples 个样本 (解码器采样率): 下一个包带有 FEC 数据时用它恢复, 否则用 PLC
+static int decode_lost_frame(opus_decoder *dec, const unsigned char* nextdata, int nextsize, int lostSamples,
+                             unsigned char* pcmdata) {
+    if (lostSamples > dec->maxFrameSize)
+        lostSamples = dec->maxFrameSize;
+
+    // frame_size 必须是 2.5ms 的整数倍; 用 FEC 时 libopus 对前面的部分做 PLC, 只有最后一帧来自 FEC 数据
+    int fec = nextdata && nextsize > 0 && packet_has_fec(nextdata, nextsize);
+    int samples = opus_decode(dec->decoder, fec ? nextdata : NULL, fec ? nextsize : 0,
+                              dec->pcmFrame.data(), lostSamples, fec);
+    if (samples < 0) {
+        std::cerr << (fec ? "FEC 解码失败: " : "PLC 失败: ") << opus_strerror(samples) << std::endl;
+        return -1;
+    }
+    if (fec)
+        dec->stats.recovered++;
+    else
+        dec->stats.concealed++;
+    return convert_decoded_frame(dec, samples, pcmdata);
+}
+
+// lostSamples 个解码器样本转换后最多占用的字节数
+static int lost_frame_bytes(opus_decoder *dec, int lostSamples) {
+    int outSamples = (int)((long long)lostSamples * dec->outputSampleRate / dec->inputSampleRate) + 1;
+    return outSamples * dec->outputChannels * sizeof(opus_int16);
+}
+
+int opus2pcm_lost(opus_decoder *dec, const unsigned char* nextdata, int nextsize, int lost_ms,
+                  unsigned char* pcmdata, int *pcmsize) {
+    *pcmsize = 0;
+    int bytes = decode_lost_frame(dec, nextdata, nextsize, dec->inputSampleRate * lost_ms / 1000, pcmdata);
+    if (bytes < 0)
+        return -1;
+    *pcmsize = bytes;
     return 0;
 }
 
+int opus2pcm_seq(opus_decoder *dec, uint32_t seq, const unsigned char* opusdata, int opussize,
+                 unsigned char* pcmdata, int pcmmax, int *pcmsize) {
+    *pcmsize = 0;
+    if (opussize <= 0)
+        return 0;
+
+    int need = max_decoded_bytes(dec, opusdata, opussize);
+    if (need < 0) {
+        std::cerr << "无效的包: " << opus_strerror(need) << std::endl;
+        return -1;
+    }
+
+    int total = 0;
+    if (dec->haveSeq) {
+        int gap = (int)(int32_t)(seq - dec->lastSeq) - 1;
+        if (gap < 0) {
+            dec->stats.late++;
+            return 0;
+        }
+        if (gap > 0) {
+            // 丢失的包按本包的时长计算, 先给本包留出空间; 放不下时跳过最早的几个, 保留紧挨着本包的那些
+            dec->stats.lost += gap;
+            int lostSamples = opus_decoder_get_nb_samples(dec->decoder, opusdata, opussize);
+            int lostBytes = lost_frame_bytes(dec, lostSamples);
+            int room = (pcmmax - need) / lostBytes;
+            int fill = gap < room ? gap : (room > 0 ? room : 0);
+            dec->stats.skipped += gap - fill;
+            for (int i = 0; i < fill; ++i) {
+                // 最后补出的就是紧挨着本包的那个丢失的包, 可以用本包的 FEC 恢复
+                int last = i == fill - 1;
+                int bytes = decode_lost_frame(dec, last ? opusdata : NULL, last ? opussize : 0, lostSamples, pcmdata + total);
+                if (bytes < 0)
+                    return -1;
+                total += bytes;
+            }
+        }
+    }
+    dec->haveSeq = 1;
+    dec->lastSeq = seq;
+
+    if (total + need > pcmmax)
+        return -1;
+    int bytes = dec->decodePacket(dec, opusdata, opussize, pcmdata + total);
+    if (bytes < 0)
+        return -1;
+    dec->stats.packets++;
+    *pcmsize = total + bytes;
+    return 0;
+}
+
+int opus_decoder_get_stats(opus_decoder *dec, opus_decoder_stats *stats) {
+    if (!dec || !stats)
+        return -1;
+    *stats = dec->stats;
+    return 0;
+}
+
+int opus2pcm_packets(opus_decoder *dec, const unsigned char* const* packets, const int* packetsizes, int count,
+                     unsigned char* pcmdata, int pcmmax, int *pcmsize) {
+    int totalPcmBytes = 0;
+    int decoded = 0;
+
+    *pcmsize = 0;
+    for (; decoded < count; ++decoded) {
+        int need = max_decoded_bytes(dec, packets[decoded], packetsizes[decoded]);
+        if (need < 0) {
+            std::cerr << "包 " << decoded << " 无效: " << opus_strerror(need) << std::endl;
+            return decoded ? decoded : -1;
+        }
+        if (totalPcmBytes + need > pcmmax)
+            break;  // 输出缓冲区放不下, 剩余的包留给下一次调用
+
+        int bytes = dec->decodePacket(dec, packets[decoded], packetsizes[decoded], pcmdata + totalPcmBytes);
+        if (bytes < 0)
+            return decoded ? decoded : -1;
+        totalPcmBytes += bytes;
+        *pcmsize = totalPcmBytes;
+    }
+
+    return decoded;
+}
+
+int opus2pcm_framed(opus_decoder *dec, const unsigned char* framed, int framedsize, int *consumed,
+                    unsigned char* pcmdata, int pcmmax, int *pcmsize) {
+    int offset = 0;
+    int totalPcmBytes = 0;
+    int decoded = 0;
+
+    *pcmsize = 0;
+    if (consumed)
+        *consumed = 0;
+
+    while (offset + 4 <= framedsize) {
+        // 读取帧长度（4字节，小端格式）
+        const unsigned char *p = framed + offset;
+        int32_t len = (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+        if (len <= 0 || len > OPUS_MAX_PACKET_SIZE) {
+            std::cerr << "无效的帧长度: " << len << "字节" << std::endl;
+            decoded = decoded ? decoded : -1;
+            break;
+        }
+        if (len > framedsize - offset - 4)
+            break;  // 不完整的帧留给下一次调用
+
+        int need = max_decoded_bytes(dec, p + 4, len);
+        if (need < 0) {
+            std::cerr << "包 " << decoded << " 无效: " << opus_strerror(need) << std::endl;
+            decoded = decoded ? decoded : -1;
+            break;
+        }
+        if (totalPcmBytes + need > pcmmax)
+            break;  // 输出缓冲区放不下
+
+        int bytes = dec->decodePacket(dec, p + 4, len, pcmdata + totalPcmBytes);
+        if (bytes < 0) {
+            decoded = decoded ? decoded : -1;
+            break;
+        }
+
+        totalPcmBytes += bytes;
+        offset += 4 + len;
+        decoded++;
+    }
+
+    *pcmsize = totalPcmBytes;
+    if (consumed)
+        *consumed = offset;
+    return decoded;
+}
+
+opus_encoder *get_default_opus_encoder(void) {
+    return g_opus_encoder;
+}
+
+opus_decoder *get_default_opus_decoder(void) {
+    return g_opus_decoder;
+}
+
+int pcm2opus(unsigned char* pcmdata, int pcmsize, unsigned char* opusdata, int* opussize) {
+    if (!g_opus_encoder) {
+        std::cerr << "编码器未初始化" << std::endl;
+        return -1;
+    }
+    return pcm2opus_ex(g_opus_encoder, pcmdata, pcmsize, opusdata, opussize);
+}
+
+int opus2pcm(unsigned char* opusdata, int opussize, unsigned char* pcmdata, int *pcmsize) {
+    if (!g_opus_decoder) {
+        std::cerr << "解码器未初始化" << std::endl;
+        return -1;
+    }
+    return opus2pcm_ex(g_opus_decoder, opusdata, opussize, pcmdata, pcmsize);
+}
+
 #ifdef TEST
+#include "opus_repack.h"
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+/* 统计堆内存申请次数: 替换 glibc 的 malloc 系列函数, operator new 也会经过这里 */
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t nmemb, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+static std::atomic<long> g_alloc_count(0);
+
+extern "C" void *malloc(size_t size) {
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t nmemb, size_t size) {
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(nmemb, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
 
 // WAV 文件头结构
 #pragma pack(push, 1)
@@ -508,8 +1303,7 @@ int pcm2opus_main(int argc, char* argv[]) {
     }
 
     // 清理资源
-    speex_resampler_destroy(g_opus_encoder.resampler);
-    opus_encoder_destroy(g_opus_encoder.encoder);
+    deinit_opus_encoder();
 
     std::cout << "转换完成，共生成 " << frameCount << " 个帧文件" << std::endl;
     return 0;
@@ -568,7 +1362,7 @@ int opus2pcm_main(int argc, char* argv[]) {
     int outputSampleRate = 16000; // 假设输出采样率为 16kHz
     int outputChannels = 1; // 假设输出通道数为 1
 
-    if (opus_decoder_init(inputSampleRate, inputChannels, duration_ms, outputSampleRate, outputChannels) != 0) {
+    if (init_opus_decoder(inputSampleRate, inputChannels, duration_ms, outputSampleRate, outputChannels) != 0) {
         std::cerr << "Opus 解码器初始化失败" << std::endl;
         return 1;
     }
@@ -613,8 +1407,7 @@ int opus2pcm_main(int argc, char* argv[]) {
     wavFile.write(reinterpret_cast<char*>(allPcmData.data()), totalPcmSize);
 
     // 清理资源
-    speex_resampler_destroy(g_opus_decoder.resampler);
-    opus_decoder_destroy(g_opus_decoder.decoder);
+    deinit_opus_decoder();
 
     wavFile.close();
 
@@ -622,10 +1415,885 @@ int opus2pcm_main(int argc, char* argv[]) {
     return 0;
 }
 
+// 生成确定性的测试 PCM 数据 (多个正弦波叠加少量伪随机噪声), 交错格式
+static std::vector<opus_int16> make_test_pcm(int sampleRate, int channels, int duration_ms, unsigned int seed) {
+    int samples = sampleRate * duration_ms / 1000;
+    std::vector<opus_int16> pcm(samples * channels);
+    unsigned int lcg = seed;
+    for (int i = 0; i < samples; ++i) {
+        double t = (double)i / sampleRate;
+        double v = 6000.0 * sin(2 * M_PI * 220.0 * t) + 3000.0 * sin(2 * M_PI * 1250.0 * t) + 1500.0 * sin(2 * M_PI * 3100.0 * t);
+        for (int c = 0; c < channels; ++c) {
+            lcg = lcg * 1103515245u + 12345u;
+            int noise = (int)((lcg >> 16) & 0x3FF) - 512;
+            pcm[i * channels + c] = static_cast<opus_int16>(v * (c ? 0.8 : 1.0) + noise);
+        }
+    }
+    return pcm;
+}
+
+// 用一个编码器/解码器实例处理整段 PCM, 返回逐包拼接的 Opus 码流和解码后的 PCM
+static int run_codec_instance(const std::vector<opus_int16>& pcm, int sampleRate, int channels, int duration_ms,
+                              std::vector<unsigned char>& opusOut, std::vector<unsigned char>& pcmOut) {
+    opus_encoder *enc = create_opus_encoder(sampleRate, channels, duration_ms, 16000, 1);
+    opus_decoder *dec = create_opus_decoder(16000, 1, duration_ms, sampleRate, channels);
+    if (!enc || !dec) {
+        destroy_opus_encoder(enc);
+        destroy_opus_decoder(dec);
+        return -1;
+    }
+
+    const int frameBytes = sampleRate * duration_ms / 1000 * channels * sizeof(opus_int16);
+    const unsigned char *src = reinterpret_cast<const unsigned char*>(pcm.data());
+    const int total = pcm.size() * sizeof(opus_int16);
+    unsigned char opusData[4000];
+    std::vector<unsigned char> pcmData(frameBytes * 2);
+
+    opusOut.clear();
+    pcmOut.clear();
+    for (int offset = 0; offset + frameBytes <= total; offset += frameBytes) {
+        int opusSize = 0;
+        if (pcm2opus_ex(enc, const_cast<unsigned char*>(src + offset), frameBytes, opusData, &opusSize) < 0)
+            break;
+        opusOut.insert(opusOut.end(), opusData, opusData + opusSize);
+
+        int pcmSize = 0;
+        if (opus2pcm_ex(dec, opusData, opusSize, pcmData.data(), &pcmSize) != 0)
+            break;
+        pcmOut.insert(pcmOut.end(), pcmData.begin(), pcmData.begin() + pcmSize);
+    }
+
+    destroy_opus_encoder(enc);
+    destroy_opus_decoder(dec);
+    return 0;
+}
+
+// 多实例并发测试: 多个线程各自持有编码器/解码器实例, 输出必须与单实例运行的结果逐字节一致
+int multi_instance_main(int argc, char* argv[]) {
+    const int threads = argc > 2 ? atoi(argv[2]) : 32;
+    const int sampleRate = 48000;
+    const int channels = 2;
+    const int duration_ms = 60;
+
+    std::vector<opus_int16> pcm = make_test_pcm(sampleRate, channels, 3000, 1);
+
+    std::vector<unsigned char> refOpus, refPcm;
+    if (run_codec_instance(pcm, sampleRate, channels, duration_ms, refOpus, refPcm) != 0 || refOpus.empty()) {
+        std::cerr << "单实例运行失败" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::vector<unsigned char> > opusOut(threads), pcmOut(threads);
+    std::vector<int> results(threads, -1);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i]() {
+            results[i] = run_codec_instance(pcm, sampleRate, channels, duration_ms, opusOut[i], pcmOut[i]);
+        });
+    }
+    for (auto& t : workers)
+        t.join();
+
+    int failed = 0;
+    for (int i = 0; i < threads; ++i) {
+        if (results[i] != 0 || opusOut[i] != refOpus || pcmOut[i] != refPcm) {
+            std::cerr << "实例 " << i << " 的输出与单实例不一致" << std::endl;
+            failed++;
+        }
+    }
+
+    std::cout << threads << " 个并发实例, Opus " << refOpus.size() << " 字节, PCM " << refPcm.size()
+              << " 字节, 不一致 " << failed << " 个" << std::endl;
+    return failed ? 1 : 0;
+}
+
+// 内存申请测试: 预热之后, 稳态的编码和解码不能再申请堆内存
+int alloc_main(int argc, char* argv[]) {
+    const int frames = 200;
+    const int duration_ms = 60;
+    const int rates[] = {16000, 44100, 48000};
+    const int channels[] = {1, 2};
+    int failed = 0;
+
+    for (int rate : rates) {
+        for (int ch : channels) {
+            std::vector<opus_int16> pcm = make_test_pcm(rate, ch, duration_ms * frames, 2);
+            const int frameBytes = rate * duration_ms / 1000 * ch * sizeof(opus_int16);
+            std::vector<unsigned char> opusData(4000);
+            std::vector<unsigned char> pcmData(frameBytes);
+
+            opus_encoder *enc = create_opus_encoder(rate, ch, duration_ms, 16000, 1);
+            opus_decoder *dec = create_opus_decoder(16000, 1, duration_ms, rate, ch);
+            if (!enc || !dec) {
+                std::cerr << "实例创建失败: " << rate << " Hz, " << ch << " 通道" << std::endl;
+                destroy_opus_encoder(enc);
+                destroy_opus_decoder(dec);
+                failed++;
+                continue;
+            }
+
+            long before = 0;
+            for (int i = 0; i < frames; ++i) {
+                if (i == 2)  // 前两帧作为预热
+                    before = g_alloc_count.load();
+
+                unsigned char *src = reinterpret_cast<unsigned char*>(pcm.data()) + i * frameBytes;
+                int opusSize = 0, pcmSize = 0;
+                pcm2opus_ex(enc, src, frameBytes, opusData.data(), &opusSize);
+                opus2pcm_ex(dec, opusData.data(), opusSize, pcmData.data(), &pcmSize);
+            }
+            long allocs = g_alloc_count.load() - before;
+
+            destroy_opus_encoder(enc);
+            destroy_opus_decoder(dec);
+
+            std::cout << rate << " Hz, " << ch << " 通道: " << frames - 2 << " 帧稳态编解码, 内存申请 " << allocs << " 次" << std::endl;
+            if (allocs)
+                failed++;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
+
+// 原有的通用声道转换循环, 作为性能对比的基准
+static void generic_downmix(const opus_int16 *in, opus_int16 *out, int frames, int inputChannels) {
+    for (int i = 0; i < frames; ++i) {
+        opus_int32 sum = 0;
+        for (int c = 0; c < inputChannels; ++c) {
+            sum += in[i * inputChannels + c];
+        }
+        out[i] = static_cast<opus_int16>(sum / inputChannels);
+    }
+}
+
+static void generic_upmix(const opus_int16 *in, opus_int16 *out, int frames, int inputChannels, int outputChannels) {
+    for (int i = 0; i < frames; ++i) {
+        for (int c = 0; c < outputChannels; ++c) {
+            out[i * outputChannels + c] = in[i * inputChannels + (c % inputChannels)];
+        }
+    }
+}
+
+static double now_us() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 声道转换性能测试: 对比原有循环和各个 SIMD 实现, 同时校验结果一致
+int mix_bench_main(int argc, char* argv[]) {
+    const int frames = 2880;  // 48 kHz 下 60 ms
+    const int loops = argc > 2 ? atoi(argv[2]) : 20000;
+    std::vector<opus_int16> stereo = make_test_pcm(48000, 2, 60, 3);
+    std::vector<opus_int16> mono(frames), ref(frames);
+    std::vector<opus_int16> stereoOut(frames * 2), stereoRef(frames * 2);
+    std::vector<opus_int16> left(frames), right(frames), leftRef(frames), rightRef(frames);
+    int failed = 0;
+    for (int i = 0; i < frames; ++i) {
+        leftRef[i] = stereo[2 * i];
+        rightRef[i] = stereo[2 * i + 1];
+    }
+
+    generic_downmix(stereo.data(), ref.data(), frames, 2);
+    generic_upmix(ref.data(), stereoRef.data(), frames, 1, 2);
+
+    double t0 = now_us();
+    for (int n = 0; n < loops; ++n)
+        generic_downmix(stereo.data(), mono.data(), frames, 2);
+    double downRef = (now_us() - t0) / loops;
+
+    t0 = now_us();
+    for (int n = 0; n < loops; ++n)
+        generic_upmix(ref.data(), stereoOut.data(), frames, 1, 2);
+    double upRef = (now_us() - t0) / loops;
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "每帧 " << frames << " 个样本, 循环 " << loops << " 次, 当前选用: " << pcm_mix_active_kernel()->name << std::endl;
+    std::cout << "  generic  2->1 " << downRef << " us  1->2 " << upRef << " us" << std::endl;
+
+    const pcm_mix_kernel *kernels;
+    int count = pcm_mix_list_kernels(&kernels);
+    for (int k = 0; k < count; ++k) {
+        t0 = now_us();
+        for (int n = 0; n < loops; ++n)
+            kernels[k].downmix_2to1(stereo.data(), mono.data(), frames);
+        double down = (now_us() - t0) / loops;
+
+        t0 = now_us();
+        for (int n = 0; n < loops; ++n)
+            kernels[k].upmix_1to2(ref.data(), stereoOut.data(), frames);
+        double up = (now_us() - t0) / loops;
+        bool ok = mono == ref && stereoOut == stereoRef;
+
+        // 拆分后再合并应该得到原来的数据
+        t0 = now_us();
+        for (int n = 0; n < loops; ++n)
+            kernels[k].deinterleave_2(stereo.data(), left.data(), right.data(), frames);
+        double split = (now_us() - t0) / loops;
+
+        t0 = now_us();
+        for (int n = 0; n < loops; ++n)
+            kernels[k].interleave_2(left.data(), right.data(), stereoOut.data(), frames);
+        double merge = (now_us() - t0) / loops;
+        ok = ok && left == leftRef && right == rightRef && stereoOut == stereo;
+        if (!ok)
+            failed++;
+        std::cout << "  " << std::left << std::setw(8) << kernels[k].name << std::right
+                  << " 2->1 " << down << " us (x" << downRef / down << ")"
+                  << "  1->2 " << up << " us (x" << upRef / up << ")"
+                  << "  split " << split << " us  merge " << merge << " us"
+                  << (ok ? "" : "  结果不一致!") << std::endl;
+    }
+
+    return failed ? 1 : 0;
+}
+
+// 多包解码测试: 逐包解码的结果作为基准, 批量接口和长度前缀接口在有限的输出缓冲区下必须得到相同的 PCM
+int packets_main(int argc, char* argv[]) {
+    const int frames = 50;
+    const int duration_ms = 60;
+    const int outRate = 48000, outChannels = 2;
+    std::vector<opus_int16> pcm = make_test_pcm(16000, 1, duration_ms * frames, 4);
+    const int frameBytes = 16000 * duration_ms / 1000 * sizeof(opus_int16);
+
+    // 编码出一组包, 同时生成与 opus_recorder.c 相同格式的长度前缀数据
+    opus_encoder *enc = create_opus_encoder(16000, 1, duration_ms, 16000, 1);
+    if (!enc)
+        return 1;
+    std::vector<std::vector<unsigned char> > packets;
+    std::vector<unsigned char> framed;
+    for (int i = 0; i < frames; ++i) {
+        unsigned char opusData[4000];
+        int opusSize = 0;
+        pcm2opus_ex(enc, reinterpret_cast<unsigned char*>(pcm.data()) + i * frameBytes, frameBytes, opusData, &opusSize);
+        packets.emplace_back(opusData, opusData + opusSize);
+        unsigned char len[4] = {(unsigned char)opusSize, (unsigned char)(opusSize >> 8), (unsigned char)(opusSize >> 16), (unsigned char)(opusSize >> 24)};
+        framed.insert(framed.end(), len, len + 4);
+        framed.insert(framed.end(), opusData, opusData + opusSize);
+    }
+    destroy_opus_encoder(enc);
+
+    const int outFrameBytes = outRate * duration_ms / 1000 * outChannels * sizeof(opus_int16);
+    std::vector<unsigned char> out(outFrameBytes * 4);  // 每次最多放得下 3 个包
+
+    // 基准: 逐包解码
+    std::vector<unsigned char> ref;
+    opus_decoder *dec = create_opus_decoder(16000, 1, duration_ms, outRate, outChannels);
+    for (auto& pkt : packets) {
+        int pcmSize = 0;
+        opus2pcm_ex(dec, pkt.data(), pkt.size(), out.data(), &pcmSize);
+        ref.insert(ref.end(), out.begin(), out.begin() + pcmSize);
+    }
+    destroy_opus_decoder(dec);
+
+    // 批量接口
+    std::vector<const unsigned char*> ptrs;
+    std::vector<int> sizes;
+    for (auto& pkt : packets) {
+        ptrs.push_back(pkt.data());
+        sizes.push_back(pkt.size());
+    }
+    std::vector<unsigned char> batched;
+    int calls = 0;
+    dec = create_opus_decoder(16000, 1, duration_ms, outRate, outChannels);
+    for (int i = 0; i < frames; ) {
+        int pcmSize = 0;
+        int n = opus2pcm_packets(dec, ptrs.data() + i, sizes.data() + i, frames - i, out.data(), out.size(), &pcmSize);
+        if (n <= 0)
+            break;
+        batched.insert(batched.end(), out.begin(), out.begin() + pcmSize);
+        i += n;
+        calls++;
+    }
+    destroy_opus_decoder(dec);
+
+    // 长度前缀接口, 数据按不规则的大小分段送入, 模拟网络分片
+    std::vector<unsigned char> framedOut;
+    std::vector<unsigned char> pending;
+    dec = create_opus_decoder(16000, 1, duration_ms, outRate, outChannels);
+    for (size_t offset = 0; offset < framed.size() || !pending.empty(); ) {
+        size_t chunk = std::min<size_t>(97, framed.size() - offset);
+        pending.insert(pending.end(), framed.begin() + offset, framed.begin() + offset + chunk);
+        offset += chunk;
+
+        int consumed = 0, pcmSize = 0;
+        int n = opus2pcm_framed(dec, pending.data(), pending.size(), &consumed, out.data(), out.size(), &pcmSize);
+        if (n < 0)
+            break;
+        framedOut.insert(framedOut.end(), out.begin(), out.begin() + pcmSize);
+        pending.erase(pending.begin(), pending.begin() + consumed);
+        if (chunk == 0 && n == 0)
+            break;
+    }
+    destroy_opus_decoder(dec);
+
+    bool okBatched = batched == ref;
+    bool okFramed = framedOut == ref;
+    std::cout << frames << " 个包, 逐包解码 " << ref.size() << " 字节" << std::endl;
+    std::cout << "  opus2pcm_packets: " << calls << " 次调用, " << batched.size() << " 字节, " << (okBatched ? "一致" : "不一致") << std::endl;
+    std::cout << "  opus2pcm_framed:  " << framedOut.size() << " 字节, " << (okFramed ? "一致" : "不一致") << std::endl;
+    return okBatched && okFramed ? 0 : 1;
+}
+
+// 下行解码性能测试: 对比 16kHz 解码 + Speex 重采样 与 直接按设备采样率解码 的 CPU 和延迟
+int rate_bench_main(int argc, char* argv[]) {
+    const int frames = argc > 2 ? atoi(argv[2]) : 500;
+    const int duration_ms = 60;
+    const int frameBytes = 16000 * duration_ms / 1000 * sizeof(opus_int16);
+    std::vector<opus_int16> pcm = make_test_pcm(16000, 1, duration_ms * frames, 5);
+
+    opus_encoder *enc = create_opus_encoder(16000, 1, duration_ms, 16000, 1);
+    if (!enc)
+        return 1;
+    std::vector<std::vector<unsigned char> > packets;
+    for (int i = 0; i < frames; ++i) {
+        unsigned char opusData[4000];
+        int opusSize = 0;
+        pcm2opus_ex(enc, reinterpret_cast<unsigned char*>(pcm.data()) + i * frameBytes, frameBytes, opusData, &opusSize);
+        packets.emplace_back(opusData, opusData + opusSize);
+    }
+    destroy_opus_encoder(enc);
+
+    struct { int rate; int channels; } devices[] = { {48000, 2}, {48000, 1}, {24000, 1}, {44100, 2} };
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << frames << " 个 " << duration_ms << "ms 的包, 每帧平均解码时间和重采样带来的延迟:" << std::endl;
+    for (auto& d : devices) {
+        for (codec_rate_mode mode : {CODEC_RATE_RESAMPLE, CODEC_RATE_NATIVE}) {
+            opus_decoder *dec = create_opus_decoder(16000, 1, duration_ms, d.rate, d.channels, mode);
+            if (!dec)
+                return 1;
+            std::vector<unsigned char> out(d.rate * 120 / 1000 * d.channels * sizeof(opus_int16) + 64);
+
+            double t0 = now_us();
+            for (auto& pkt : packets) {
+                int pcmSize = 0;
+                opus2pcm_ex(dec, pkt.data(), pkt.size(), out.data(), &pcmSize);
+            }
+            double perFrame = (now_us() - t0) / frames;
+            double latency_ms = 0;
+            if (dec->fastResampler)
+                latency_ms = fixed_resampler_latency(dec->fastResampler) * 1000.0 / d.rate;
+            else if (dec->resampler)
+                latency_ms = speex_resampler_get_output_latency(dec->resampler) * 1000.0 / d.rate;
+
+            std::cout << "  " << d.rate << " Hz " << d.channels << " 通道 "
+                      << (dec->rateMode == CODEC_RATE_NATIVE ? "native  " : "resample")
+                      << ": " << perFrame << " us/帧, 重采样延迟 " << latency_ms << " ms" << std::endl;
+            destroy_opus_decoder(dec);
+        }
+    }
+    return 0;
+}
+
+// 生成不含噪声的多音信号, 不同采样率下是同一个连续信号的采样, 用于比较不同采样率路径的音质
+static std::vector<opus_int16> make_tone_pcm(int sampleRate, int channels, int duration_ms) {
+    int samples = sampleRate * duration_ms / 1000;
+    std::vector<opus_int16> pcm(samples * channels);
+    for (int i = 0; i < samples; ++i) {
+        double t = (double)i / sampleRate;
+        double v = 5000.0 * sin(2 * M_PI * 300.0 * t) + 3000.0 * sin(2 * M_PI * 1700.0 * t) + 2000.0 * sin(2 * M_PI * 5200.0 * t);
+        for (int c = 0; c < channels; ++c)
+            pcm[i * channels + c] = static_cast<opus_int16>(v);
+    }
+    return pcm;
+}
+
+// 计算 x 相对 ref 的信噪比, 在 [0, maxLag] 内搜索编解码延迟并对齐
+static double snr_db(const std::vector<opus_int16>& ref, const std::vector<opus_int16>& x, int maxLag, int *lagOut) {
+    int n = (int)std::min(ref.size(), x.size()) - maxLag;
+    if (n <= 0)
+        return 0;
+    int bestLag = 0;
+    double best = -1e300;
+    for (int lag = 0; lag <= maxLag; ++lag) {
+        double corr = 0;
+        for (int i = 0; i < n; ++i)
+            corr += (double)ref[i] * x[i + lag];
+        if (corr > best) {
+            best = corr;
+            bestLag = lag;
+        }
+    }
+    double sig = 0, err = 0;
+    for (int i = 0; i < n; ++i) {
+        double d = (double)x[i + bestLag] - ref[i];
+        sig += (double)ref[i] * ref[i];
+        err += d * d;
+    }
+    if (lagOut)
+        *lagOut = bestLag;
+    return 10 * log10(sig / (err + 1e-9));
+}
+
+// 上行编码对比: 48kHz 立体声采集, 重采样到 16kHz 编码 与 直接按 48kHz 编码并限制为宽带
+int encode_bench_main(int argc, char* argv[]) {
+    const int duration_ms = 60;
+    const int frames = argc > 2 ? atoi(argv[2]) : 100;
+    const int inRate = 48000, inChannels = 2;
+    const int frameBytes = inRate * duration_ms / 1000 * inChannels * sizeof(opus_int16);
+    std::vector<opus_int16> input = make_tone_pcm(inRate, inChannels, duration_ms * frames);
+    std::vector<opus_int16> ref = make_tone_pcm(16000, 1, duration_ms * frames);
+    double snr[2] = {0, 0};
+
+    std::cout << std::fixed << std::setprecision(2);
+    for (codec_rate_mode mode : {CODEC_RATE_RESAMPLE, CODEC_RATE_NATIVE}) {
+        opus_encoder *enc = create_opus_encoder(inRate, inChannels, duration_ms, 16000, 1, mode);
+        opus_decoder *dec = create_opus_decoder(16000, 1, duration_ms, 16000, 1);
+        if (!enc || !dec)
+            return 1;
+
+        std::vector<opus_int16> decoded;
+        std::vector<opus_int16> pcmOut(16000 * 120 / 1000);
+        unsigned char opusData[4000];
+        int maxBandwidth = 0;
+        long totalBytes = 0;
+        double encodeUs = 0;
+        for (int i = 0; i < frames; ++i) {
+            int opusSize = 0, pcmSize = 0;
+            double t0 = now_us();
+            pcm2opus_ex(enc, reinterpret_cast<unsigned char*>(input.data()) + i * frameBytes, frameBytes, opusData, &opusSize);
+            encodeUs += now_us() - t0;
+            if (opusSize <= 0)
+                continue;
+            totalBytes += opusSize;
+            maxBandwidth = std::max(maxBandwidth, opus_packet_get_bandwidth(opusData));
+            opus2pcm_ex(dec, opusData, opusSize, reinterpret_cast<unsigned char*>(pcmOut.data()), &pcmSize);
+            decoded.insert(decoded.end(), pcmOut.begin(), pcmOut.begin() + pcmSize / sizeof(opus_int16));
+        }
+
+        int lag = 0;
+        snr[mode] = snr_db(ref, decoded, 16000 * 20 / 1000, &lag);
+        std::cout << (enc->rateMode == CODEC_RATE_NATIVE ? "native  " : "resample")
+                  << ": 编码 " << encodeUs / frames << " us/帧, " << totalBytes * 8 / (frames * duration_ms) << " kbps, "
+                  << "最大带宽 " << (maxBandwidth <= OPUS_BANDWIDTH_WIDEBAND ? "<=宽带" : "超过宽带")
+                  << ", SNR " << snr[mode] << " dB (延迟 " << lag * 1000.0 / 16000 << " ms)" << std::endl;
+
+        destroy_opus_encoder(enc);
+        destroy_opus_decoder(dec);
+        if (maxBandwidth > OPUS_BANDWIDTH_WIDEBAND)
+            return 1;
+    }
+
+    // 直接编码不应明显损失音质
+    return snr[CODEC_RATE_NATIVE] + 3.0 >= snr[CODEC_RATE_RESAMPLE] ? 0 : 1;
+}
+
+// 特化流程与通用流程对比: 输出必须逐字节一致, 同时给出每帧耗时
+int profile_main(int argc, char* argv[]) {
+    const int duration_ms = 60;
+    const int frames = argc > 2 ? atoi(argv[2]) : 200;
+    struct { int rate; int channels; codec_rate_mode mode; } configs[] = {
+        {16000, 1, CODEC_RATE_NATIVE}, {16000, 2, CODEC_RATE_NATIVE}, {48000, 2, CODEC_RATE_NATIVE},
+        {48000, 2, CODEC_RATE_RESAMPLE}, {44100, 2, CODEC_RATE_RESAMPLE},
+    };
+    int fail = 0;
+
+    std::cout << std::fixed << std::setprecision(2);
+    for (auto& c : configs) {
+        const int frameBytes = c.rate * duration_ms / 1000 * c.channels * sizeof(opus_int16);
+        std::vector<opus_int16> pcm = make_test_pcm(c.rate, c.channels, duration_ms * frames, 11);
+
+        opus_encoder *encs[2] = {
+            create_opus_encoder(c.rate, c.channels, duration_ms, 16000, 1, c.mode),
+            create_opus_encoder(c.rate, c.channels, duration_ms, 16000, 1, c.mode),
+        };
+        opus_decoder *decs[2] = {
+            create_opus_decoder(16000, 1, duration_ms, c.rate, c.channels, c.mode),
+            create_opus_decoder(16000, 1, duration_ms, c.rate, c.channels, c.mode),
+        };
+        if (!encs[0] || !encs[1] || !decs[0] || !decs[1])
+            return 1;
+        encs[1]->encodeFrames = pcm2opus_generic;
+        decs[1]->decodePacket = decode_packet_generic;
+
+        std::vector<unsigned char> out[2];
+        double encUs[2] = {0, 0}, decUs[2] = {0, 0};
+        std::vector<unsigned char> pcmOut(c.rate * 120 / 1000 * c.channels * sizeof(opus_int16));
+        for (int i = 0; i < frames; ++i) {
+            for (int k = 0; k < 2; ++k) {
+                unsigned char opusData[4000];
+                int opusSize = 0, pcmSize = 0;
+                double t0 = now_us();
+                pcm2opus_ex(encs[k], reinterpret_cast<unsigned char*>(pcm.data()) + i * frameBytes, frameBytes, opusData, &opusSize);
+                double t1 = now_us();
+                opus2pcm_ex(decs[k], opusData, opusSize, pcmOut.data(), &pcmSize);
+                double t2 = now_us();
+                encUs[k] += t1 - t0;
+                decUs[k] += t2 - t1;
+                out[k].insert(out[k].end(), opusData, opusData + opusSize);
+                out[k].insert(out[k].end(), pcmOut.begin(), pcmOut.begin() + pcmSize);
+            }
+        }
+
+        bool same = out[0] == out[1];
+        bool specialized = encs[0]->encodeFrames != pcm2opus_generic || decs[0]->decodePacket != decode_packet_generic;
+        std::cout << "  " << c.rate << " Hz " << c.channels << " 通道 " << (c.mode == CODEC_RATE_NATIVE ? "native  " : "resample")
+                  << ": 编码 " << encUs[0] / frames << "/" << encUs[1] / frames << " us/帧, "
+                  << "解码 " << decUs[0] / frames << "/" << decUs[1] / frames << " us/帧 (特化/通用), "
+                  << (specialized ? "" : "未特化, ") << (same ? "一致" : "不一致") << std::endl;
+        if (!same || !specialized)
+            fail = 1;
+
+        for (int k = 0; k < 2; ++k) {
+            destroy_opus_encoder(encs[k]);
+            destroy_opus_decoder(decs[k]);
+        }
+    }
+    return fail;
+}
+
+// 帧时长对比: 每帧的编码开销、每秒的包头开销和从采集到发出的延迟
+int duration_bench_main(int argc, char* argv[]) {
+    const int seconds = argc > 2 ? atoi(argv[2]) : 30;
+    const int bitrate = 24000;
+    // 上行每个包额外的头部: WebSocket 帧头(最多 14 字节, 客户端带掩码) + TCP/IP 头(40 字节)
+    const int headerBytes = 14 + 40;
+    const int durations[] = { 20, 40, 60, 120 };
+    std::vector<opus_int16> pcm = make_test_pcm(16000, 1, seconds * 1000, 7);
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << seconds << "s 16kHz 单声道, 码率 " << bitrate << " bps, 包头按 " << headerBytes << " 字节/包计算" << std::endl;
+    for (int duration_ms : durations) {
+        opus_encoder *enc = create_opus_encoder(16000, 1, duration_ms, 16000, 1);
+        if (!enc)
+            return 1;
+        opus_encoder_set_bitrate(enc, bitrate);
+        opus_int32 lookahead = 0;
+        opus_encoder_ctl(enc->encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+
+        const int frameBytes = 16000 * duration_ms / 1000 * sizeof(opus_int16);
+        const int frames = (int)(pcm.size() * sizeof(opus_int16) / frameBytes);
+        unsigned char opusData[4000];
+        long payload = 0;
+        double encodeUs = 0, maxUs = 0;
+        for (int i = 0; i < frames; ++i) {
+            int opusSize = 0;
+            double t0 = now_us();
+            pcm2opus_ex(enc, reinterpret_cast<unsigned char*>(pcm.data()) + i * frameBytes, frameBytes, opusData, &opusSize);
+            double us = now_us() - t0;
+            encodeUs += us;
+            maxUs = std::max(maxUs, us);
+            payload += opusSize;
+        }
+
+        double perSecond = 1000.0 / duration_ms;
+        double headerBps = perSecond * headerBytes * 8;
+        double payloadBps = payload * 8.0 / (frames * duration_ms / 1000.0);
+        // 采集到发出: 攒满一帧 + 编码器的前瞻 + 编码耗时
+        double latencyMs = duration_ms + lookahead * 1000.0 / 16000 + encodeUs / frames / 1000;
+        std::cout << "  " << std::setw(3) << duration_ms << " ms: 编码 " << encodeUs / frames << " us/帧 (最长 " << maxUs << "), "
+                  << "CPU " << encodeUs / (frames * duration_ms / 1000.0) / 1000 << " ms/s, "
+                  << "负载 " << payloadBps / 1000 << " kbps + 包头 " << headerBps / 1000 << " kbps ("
+                  << perSecond << " 包/s), 采集到发出 " << latencyMs << " ms" << std::endl;
+        destroy_opus_encoder(enc);
+    }
+    return 0;
+}
+
+// 合包: 20ms 编码帧合并成长包后解码结果必须与逐帧解码一致, 同时给出每秒少发的消息数
+int repack_main(int argc, char* argv[]) {
+    const int frame_ms = 20;
+    const int seconds = argc > 2 ? atoi(argv[2]) : 10;
+    const int frameBytes = 16000 * frame_ms / 1000 * sizeof(opus_int16);
+    const int frames = seconds * 1000 / frame_ms;
+    std::vector<opus_int16> pcm = make_test_pcm(16000, 1, seconds * 1000, 5);
+
+    // 编码一次, 每 1s 中后 200ms 视为静音不发送
+    opus_encoder *enc = create_opus_encoder(16000, 1, frame_ms, 16000, 1);
+    if (!enc)
+        return 1;
+    std::vector<std::vector<unsigned char>> packets(frames);
+    for (int i = 0; i < frames; ++i) {
+        unsigned char opusData[4000];
+        int opusSize = 0;
+        pcm2opus_ex(enc, reinterpret_cast<unsigned char*>(pcm.data()) + i * frameBytes, frameBytes, opusData, &opusSize);
+        packets[i].assign(opusData, opusData + opusSize);
+    }
+    destroy_opus_encoder(enc);
+
+    int fail = 0;
+    std::vector<opus_int16> pcmOut(5760);
+    std::cout << std::fixed << std::setprecision(2);
+    for (int perPacket : { 1, 2, 3, 6 }) {
+        for (int flush = 0; flush < 2; ++flush) {
+            opus_repack_config cfg = { perPacket, flush };
+            opus_repack *rp = create_opus_repack(&cfg);
+            int err;
+            OpusDecoder *ref = opus_decoder_create(16000, 1, &err);
+            OpusDecoder *dec = opus_decoder_create(16000, 1, &err);
+            if (!rp || !ref || !dec)
+                return 1;
+
+            std::vector<opus_int16> a, b;
+            unsigned char out[OPUS_MAX_PACKET_SIZE];
+            auto decode = [&](OpusDecoder *d, const unsigned char *data, int len, std::vector<opus_int16> &dst) {
+                int n = opus_decode(d, data, len, pcmOut.data(), (int)pcmOut.size(), 0);
+                if (n > 0)
+                    dst.insert(dst.end(), pcmOut.begin(), pcmOut.begin() + n);
+            };
+            for (int i = 0; i < frames; ++i) {
+                int len;
+                if (i % 50 >= 40) {
+                    len = opus_repack_end_of_speech(rp, out, sizeof(out));
+                } else {
+                    decode(ref, packets[i].data(), (int)packets[i].size(), a);
+                    len = opus_repack_push(rp, packets[i].data(), (int)packets[i].size(), out, sizeof(out));
+                }
+                if (len < 0)
+                    fail = 1;
+                if (len > 0)
+                    decode(dec, out, len, b);
+            }
+            int len = opus_repack_flush(rp, out, sizeof(out));
+            if (len > 0)
+                decode(dec, out, len, b);
+
+            opus_repack_stats stats;
+            opus_repack_get_stats(rp, &stats);
+            bool same = a == b;
+            std::cout << "  " << perPacket << " 帧/包" << (flush ? ", 人声结束立即发送" : ", 固定帧数    ")
+                      << ": 帧 " << stats.frames_in << ", 包 " << stats.packets_out
+                      << ", 少发 " << stats.messages_saved * 1000.0 / stats.audio_ms << " 条/s, "
+                      << (same ? "一致" : "不一致") << std::endl;
+            if (!same)
+                fail = 1;
+
+            destroy_opus_repack(rp);
+            opus_decoder_destroy(ref);
+            opus_decoder_destroy(dec);
+        }
+    }
+    return fail;
+}
+
+// 编码器预设对比: 前瞻 (OPUS_GET_LOOKAHEAD)、实测的编解码延迟、音质和每帧编码耗时
+int preset_main(int argc, char* argv[]) {
+    const int duration_ms = 20;
+    const int seconds = argc > 2 ? atoi(argv[2]) : 10;
+    const int bitrate = 24000;
+    const int frameBytes = 16000 * duration_ms / 1000 * sizeof(opus_int16);
+    const int frames = seconds * 1000 / duration_ms;
+    std::vector<opus_int16> ref = make_test_pcm(16000, 1, seconds * 1000, 9);
+    int lookahead[3] = {0, 0, 0}, lags[3] = {0, 0, 0};
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << seconds << "s 16kHz 单声道, " << duration_ms << "ms 帧, 码率 " << bitrate << " bps" << std::endl;
+    for (int p = OPUS_PROFILE_LOWDELAY; p <= OPUS_PROFILE_QUALITY; ++p) {
+        opus_encoder *enc = create_opus_encoder(16000, 1, duration_ms, 16000, 1);
+        opus_decoder *dec = create_opus_decoder(16000, 1, duration_ms, 16000, 1);
+        if (!enc || !dec || opus_encoder_set_profile(enc, (opus_encoder_profile)p) != 0)
+            return 1;
+        opus_encoder_set_bitrate(enc, bitrate);
+
+        std::vector<opus_int16> decoded;
+        std::vector<opus_int16> pcmOut(16000 * 120 / 1000);
+        unsigned char opusData[4000];
+        double encodeUs = 0;
+        for (int i = 0; i < frames; ++i) {
+            int opusSize = 0, pcmSize = 0;
+            double t0 = now_us();
+            pcm2opus_ex(enc, reinterpret_cast<unsigned char*>(ref.data()) + i * frameBytes, frameBytes, opusData, &opusSize);
+            encodeUs += now_us() - t0;
+            if (opusSize <= 0)
+                continue;
+            opus2pcm_ex(dec, opusData, opusSize, reinterpret_cast<unsigned char*>(pcmOut.data()), &pcmSize);
+            decoded.insert(decoded.end(), pcmOut.begin(), pcmOut.begin() + pcmSize / sizeof(opus_int16));
+        }
+
+        opus_encoder_stats stats;
+        opus_encoder_get_stats(enc, &stats);
+        double snr = snr_db(ref, decoded, 16000 * 20 / 1000, &lags[p]);
+        lookahead[p] = stats.lookahead_us;
+        std::cout << "  " << std::setw(8) << opus_encoder_profile_name(stats.profile)
+                  << ": 前瞻 " << stats.lookahead_us / 1000.0 << " ms, 实测编解码延迟 " << lags[p] * 1000.0 / 16000 << " ms, "
+                  << "复杂度 " << stats.complexity << ", 编码 " << encodeUs / frames << " us/帧, "
+                  << stats.bytes * 8.0 / (frames * duration_ms) << " kbps, SNR " << snr << " dB" << std::endl;
+
+        destroy_opus_encoder(enc);
+        destroy_opus_decoder(dec);
+    }
+
+    // lowdelay 的前瞻和实测延迟都应短于另外两个预设
+    return lookahead[OPUS_PROFILE_LOWDELAY] < lookahead[OPUS_PROFILE_VOIP] && lags[OPUS_PROFILE_LOWDELAY] <= lags[OPUS_PROFILE_VOIP] ? 0 : 1;
+}
+
+// 丢包模拟: 按不同的丢包率随机丢包, 比较只用 PLC 与用 FEC 恢复的音质, 以及 FEC 的码率和 CPU 开销
+// 另外检查编码端没有 FEC 数据 (关闭 FEC, 或打开 FEC 但丢包率设为0) 时丢失的包全部计为 PLC, 不算 FEC 恢复
+int fec_main(int argc, char* argv[]) {
+    const int duration_ms = 20;
+    const int seconds = argc > 2 ? atoi(argv[2]) : 20;
+    const int bitrate = 24000;
+    const int frameBytes = 16000 * duration_ms / 1000 * sizeof(opus_int16);
+    const int frames = seconds * 1000 / duration_ms;
+    std::vector<opus_int16> ref = make_test_pcm(16000, 1, seconds * 1000, 13);
+    int fail = 0;
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << seconds << "s 16kHz 单声道, " << duration_ms << "ms 帧, voip 预设, 码率 " << bitrate << " bps" << std::endl;
+    // { 是否打开 FEC, 告诉编码器的丢包率, 实际的丢包率 }
+    const int cases[][3] = { { 1, 0, 0 }, { 1, 5, 5 }, { 1, 10, 10 }, { 1, 20, 20 }, { 0, 0, 10 }, { 1, 0, 10 } };
+    for (const int *c : cases) {
+        const int fecOn = c[0], encLoss = c[1], loss = c[2];
+        // 编码器只有打开 FEC 且丢包率不为0时才在包里带 LBRR 数据
+        const bool hasFec = fecOn && encLoss > 0;
+        opus_encoder *enc = create_opus_encoder(16000, 1, duration_ms, 16000, 1);
+        if (!enc || opus_encoder_set_profile(enc, OPUS_PROFILE_VOIP) != 0)
+            return 1;
+        opus_encoder_set_bitrate(enc, bitrate);
+        opus_encoder_set_fec(enc, fecOn);
+        opus_encoder_set_packet_loss(enc, encLoss);
+
+        std::vector<std::vector<unsigned char>> packets(frames);
+        double encodeUs = 0;
+        for (int i = 0; i < frames; ++i) {
+            unsigned char opusData[4000];
+            int opusSize = 0;
+            double t0 = now_us();
+            pcm2opus_ex(enc, reinterpret_cast<unsigned char*>(ref.data()) + i * frameBytes, frameBytes, opusData, &opusSize);
+            encodeUs += now_us() - t0;
+            packets[i].assign(opusData, opusData + opusSize);
+        }
+        opus_encoder_stats encStats;
+        opus_encoder_get_stats(enc, &encStats);
+        destroy_opus_encoder(enc);
+
+        // 同样的丢包序列分别用 PLC 和 FEC 处理, 与无丢包的解码结果比较
+        opus_decoder *decs[3] = {
+            create_opus_decoder(16000, 1, duration_ms, 16000, 1),
+            create_opus_decoder(16000, 1, duration_ms, 16000, 1),
+            create_opus_decoder(16000, 1, duration_ms, 16000, 1),
+        };
+        if (!decs[0] || !decs[1] || !decs[2])
+            return 1;
+        std::vector<opus_int16> out[3];
+        std::vector<unsigned char> pcm(frameBytes * 16);
+        double decodeUs[3] = {0, 0, 0};
+        unsigned int seed = 1234;
+        int lost = 0, pending = 0;
+        for (int i = 0; i < frames; ++i) {
+            seed = seed * 1103515245 + 12345;
+            bool drop = loss > 0 && (int)((seed >> 16) % 100) < loss && i > 0 && i < frames - 1;
+            int pcmSize = 0;
+            unsigned char *data = packets[i].data();
+            int size = (int)packets[i].size();
+
+            double t0 = now_us();
+            opus2pcm_ex(decs[0], data, size, pcm.data(), &pcmSize);
+            decodeUs[0] += now_us() - t0;
+            out[0].insert(out[0].end(), (opus_int16*)pcm.data(), (opus_int16*)(pcm.data() + pcmSize));
+            if (drop) {
+                lost++;
+                pending++;
+                continue;
+            }
+
+            // PLC: 前面丢了几个包就先补出几帧
+            t0 = now_us();
+            for (; pending > 0; --pending) {
+                int n = 0;
+                opus2pcm_lost(decs[1], NULL, 0, duration_ms, pcm.data(), &n);
+                out[1].insert(out[1].end(), (opus_int16*)pcm.data(), (opus_int16*)(pcm.data() + n));
+            }
+            opus2pcm_ex(decs[1], data, size, pcm.data(), &pcmSize);
+            decodeUs[1] += now_us() - t0;
+            out[1].insert(out[1].end(), (opus_int16*)pcm.data(), (opus_int16*)(pcm.data() + pcmSize));
+
+            // FEC: 按序号解码, 丢失的包由 opus2pcm_seq 补出
+            t0 = now_us();
+            opus2pcm_seq(decs[2], i, data, size, pcm.data(), (int)pcm.size(), &pcmSize);
+            decodeUs[2] += now_us() - t0;
+            out[2].insert(out[2].end(), (opus_int16*)pcm.data(), (opus_int16*)(pcm.data() + pcmSize));
+        }
+
+        opus_decoder_stats decStats;
+        opus_decoder_get_stats(decs[2], &decStats);
+        double snrPlc = snr_db(out[0], out[1], 0, NULL);
+        double snrFec = snr_db(out[0], out[2], 0, NULL);
+        std::cout << "  FEC " << (fecOn ? "开" : "关") << " 编码丢包率 " << std::setw(2) << encLoss << "%, 丢包 "
+                  << std::setw(2) << loss << "%: " << encStats.bytes * 8.0 / (frames * duration_ms) << " kbps, "
+                  << "编码 " << encodeUs / frames << " us/帧, 丢失 " << lost << " 包, FEC 恢复 " << decStats.recovered
+                  << ", PLC " << decStats.concealed << "; 解码 " << decodeUs[1] / frames << "/" << decodeUs[2] / frames
+                  << " us/帧 (PLC/FEC), SNR " << (lost ? snrPlc : 0) << "/" << (lost ? snrFec : 0) << " dB (PLC/FEC)" << std::endl;
+        if (decStats.lost != (unsigned long)lost || decStats.skipped != 0 ||
+            decStats.recovered + decStats.concealed != (unsigned long)lost)
+            fail = 1;
+        if (!hasFec && decStats.recovered != 0)
+            fail = 1;
+        if (hasFec && loss >= 10 && (snrFec <= snrPlc || decStats.recovered == 0))
+            fail = 1;
+
+        for (int k = 0; k < 3; ++k)
+            destroy_opus_decoder(decs[k]);
+    }
+
+    // 输出缓冲区只够补出 2 个丢失的包: 跳过最早的 2 个, 用 FEC 恢复的是紧挨着本包的那个
+    opus_encoder *enc = create_opus_encoder(16000, 1, duration_ms, 16000, 1);
+    opus_decoder *dec = create_opus_decoder(16000, 1, duration_ms, 16000, 1);
+    if (!enc || !dec)
+        return 1;
+    opus_encoder_set_profile(enc, OPUS_PROFILE_VOIP);
+    opus_encoder_set_bitrate(enc, bitrate);
+    opus_encoder_set_fec(enc, 1);
+    opus_encoder_set_packet_loss(enc, 20);
+    std::vector<unsigned char> pcm(frameBytes * 8);
+    unsigned char opusData[6][4000];
+    int opusSize[6];
+    for (int i = 0; i < 6; ++i)
+        pcm2opus_ex(enc, reinterpret_cast<unsigned char*>(ref.data()) + i * frameBytes, frameBytes, opusData[i], &opusSize[i]);
+    int pcmSize = 0;
+    opus2pcm_seq(dec, 0, opusData[0], opusSize[0], pcm.data(), (int)pcm.size(), &pcmSize);
+    int pcmmax = max_decoded_bytes(dec, opusData[5], opusSize[5]) + 2 * lost_frame_bytes(dec, 16000 * duration_ms / 1000);
+    opus2pcm_seq(dec, 5, opusData[5], opusSize[5], pcm.data(), pcmmax, &pcmSize);
+    opus_decoder_stats decStats;
+    opus_decoder_get_stats(dec, &decStats);
+    int expectRecovered = packet_has_fec(opusData[5], opusSize[5]);
+    std::cout << "  缓冲区只够补 2 包: 丢失 " << decStats.lost << ", 跳过 " << decStats.skipped << ", FEC 恢复 "
+              << decStats.recovered << ", PLC " << decStats.concealed << ", 输出 " << pcmSize / frameBytes << " 帧" << std::endl;
+    if (decStats.lost != 4 || decStats.skipped != 2 || decStats.recovered != (unsigned long)expectRecovered ||
+        decStats.concealed != 2 - (unsigned long)expectRecovered || pcmSize != 3 * frameBytes)
+        fail = 1;
+    destroy_opus_encoder(enc);
+    destroy_opus_decoder(dec);
+    return fail;
+}
+
 int main(int argc, char **argv)
 {
+    if (argc >= 2 && strcmp(argv[1], "mt") == 0)
+        return multi_instance_main(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "alloc") == 0)
+        return alloc_main(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "mixbench") == 0)
+        return mix_bench_main(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "packets") == 0)
+        return packets_main(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "ratebench") == 0)
+        return rate_bench_main(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "encbench") == 0)
+        return encode_bench_main(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "profile") == 0)
+        return profile_main(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "durbench") == 0)
+        return duration_bench_main(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "repack") == 0)
+        return repack_main(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "presets") == 0)
+        return preset_main(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "fec") == 0)
+        return fec_main(argc, argv);
+
     if (argc != 3) {
         std::cerr << "Usage: " << argv[0] << " <opus2wav | wav2opus> <wavfile>" << std::endl;
+        std::cerr << "       " << argv[0] << " mt [threads]" << std::endl;
+        std::cerr << "       " << argv[0] << " alloc" << std::endl;
+        std::cerr << "       " << argv[0] << " mixbench [loops]" << std::endl;
+        std::cerr << "       " << argv[0] << " packets" << std::endl;
+        std::cerr << "       " << argv[0] << " ratebench [frames]" << std::endl;
+        std::cerr << "       " << argv[0] << " encbench [frames]" << std::endl;
+        std::cerr << "       " << argv[0] << " profile [frames]" << std::endl;
+        std::cerr << "       " << argv[0] << " durbench [seconds]" << std::endl;
+        std::cerr << "       " << argv[0] << " repack [seconds]" << std::endl;
+        std::cerr << "       " << argv[0] << " presets [seconds]" << std::endl;
+        std::cerr << "       " << argv[0] << " fec [seconds]" << std::endl;
         return 1;
     }
 
@@ -3,7 +3,280 @@
 
 #include <stdint.h>
 
+/* 编解码器与设备之间的采样率处理方式 */
+typedef enum codec_rate_mode {
+    CODEC_RATE_RESAMPLE = 0,  /* 编解码器工作在码流的采样率(如16kHz), 用 Speex 重采样到设备的采样率 */
+    CODEC_RATE_NATIVE   = 1,  /* 编解码器直接工作在设备的采样率, 省去重采样; 设备采样率不被 Opus 支持时退回 RESAMPLE
+                               * 编码时用 OPUS_SET_MAX_BANDWIDTH 把带宽限制到码流的采样率 */
+} codec_rate_mode;
+
+/* 编解码器实例, 每个实例拥有独立的 Opus 状态和重采样器, 可在不同线程中并行使用 */
+typedef struct opus_encoder opus_encoder;
+typedef struct opus_decoder opus_decoder;
+
 // 函数声明
+/**
+ * 判断 Opus 编解码器能否直接工作在该采样率 (8/12/16/24/48 kHz)
+ * 
+ * @param sampleRate 采样率
+ * @return 支持返回1，否则返回0
+ */
+int opus_rate_supported(int sampleRate);
+
+/**
+ * 创建一个独立的 Opus 编码器实例
+ * 
+ * @param inputSampleRate 输入采样率
+ * @param inputChannels 输入通道数
+ * @param duration_ms 帧持续时间（毫秒）
+ * @param outputSampleRate 输出采样率
+ * @param outputChannels 输出通道数
+ * @param mode CODEC_RATE_NATIVE 时以输入采样率编码并把带宽限制到输出采样率, 不经过重采样
+ * @return 成功返回编码器实例，失败返回NULL
+ */
+opus_encoder *create_opus_encoder(unsigned int inputSampleRate, unsigned int inputChannels, unsigned int duration_ms, 
+        unsigned int outputSampleRate, unsigned int outputChannels, codec_rate_mode mode = CODEC_RATE_RESAMPLE);
+
+/**
+ * 销毁编码器实例，释放 Opus 编码器和重采样器
+ * 
+ * @param enc 编码器实例，可以为NULL
+ */
+void destroy_opus_encoder(opus_encoder *enc);
+
+/**
+ * 创建一个独立的 Opus 解码器实例
+ * 
+ * @param inputSampleRate 输入采样率
+ * @param inputChannels 输入通道数
+ * @param duration_ms 帧持续时间（毫秒）
+ * @param outputSampleRate 输出采样率
+ * @param outputChannels 输出通道数
+ * @param mode CODEC_RATE_NATIVE 时直接以输出采样率和通道数解码, 不经过重采样
+ * @return 成功返回解码器实例，失败返回NULL
+ */
+opus_decoder *create_opus_decoder(int inputSampleRate, int inputChannels, int duration_ms, 
+        int outputSampleRate, int outputChannels, codec_rate_mode mode = CODEC_RATE_RESAMPLE);
+
+/**
+ * 销毁解码器实例，释放 Opus 解码器和重采样器
+ * 
+ * @param dec 解码器实例，可以为NULL
+ */
+void destroy_opus_decoder(opus_decoder *dec);
+
+/**
+ * 使用指定的编码器实例将 PCM 数据编码为 Opus 数据
+ * 同一个实例不能同时在多个线程中使用, 不同实例之间互不影响
+ * 
+ * @param enc 编码器实例
+ * @param pcmdata 指向 PCM 数据的指针
+ * @param pcmsize PCM 数据的大小（字节）
+ * @param opusdata 指向 Opus 数据的指针
+ * @param opussize 指向 Opus 数据大小的指针
+ * @return 成功返回编码的帧数，失败返回-1
+ */
+int pcm2opus_ex(opus_encoder *enc, unsigned char* pcmdata, int pcmsize, unsigned char* opusdata, int* opussize);
+
+/**
+ * 使用指定的解码器实例将 Opus 数据解码为 PCM 数据
+ * opusdata 必须是一个完整的 Opus 包, 多个包请使用 opus2pcm_packets/opus2pcm_framed
+ * 同一个实例不能同时在多个线程中使用, 不同实例之间互不影响
+ * 
+ * @param dec 解码器实例
+ * @param opusdata 指向 Opus 数据的指针
+ * @param opussize Opus 数据的大小（字节）
+ * @param pcmdata 指向 PCM 数据的指针
+ * @param pcmsize 指向 PCM 数据大小的指针
+ * @return 成功返回0，失败返回-1
+ */
+int opus2pcm_ex(opus_decoder *dec, unsigned char* opusdata, int opussize, unsigned char* pcmdata, int *pcmsize);
+
+/* 编码器预设: 同时决定 application、复杂度、VBR 和信号类型 */
+typedef enum opus_encoder_profile {
+    OPUS_PROFILE_LOWDELAY = 0,   /* RESTRICTED_LOWDELAY (只用 CELT), 前瞻最短, 低码率下音质稍差 */
+    OPUS_PROFILE_VOIP     = 1,   /* VOIP, 针对语音优化, 与 opus_recorder.c 的设置相同 */
+    OPUS_PROFILE_QUALITY  = 2,   /* AUDIO, 最高复杂度, 创建编码器时的默认设置 */
+} opus_encoder_profile;
+
+/* 编码器运行状态 */
+typedef struct opus_encoder_stats {
+    int bitrate;                 /* 当前目标码率 (bps) */
+    int complexity;              /* 当前复杂度 0~10 */
+    opus_encoder_profile profile;/* 当前预设 */
+    int lookahead_us;            /* 编码器的算法延迟 (前瞻), 不含帧时长和重采样延迟 */
+    int fec;                     /* 是否打开了带内 FEC */
+    int packet_loss_percent;     /* 告诉编码器的预期丢包率 (%) */
+    unsigned long frames;        /* 已编码的帧数 */
+    unsigned long bytes;         /* 已输出的 Opus 数据字节数 */
+} opus_encoder_stats;
+
+/**
+ * 运行时修改编码器的目标码率, 从下一帧开始生效
+ * 
+ * @param enc 编码器实例
+ * @param bitrate 码率 (bps), 范围 500~512000
+ * @return 成功返回0，失败返回-1
+ */
+int opus_encoder_set_bitrate(opus_encoder *enc, int bitrate);
+
+/**
+ * 运行时修改编码器的复杂度, 从下一帧开始生效
+ * 
+ * @param enc 编码器实例
+ * @param complexity 复杂度 0~10, 越高音质越好、CPU 占用越高
+ * @return 成功返回0，失败返回-1
+ */
+int opus_encoder_set_complexity(opus_encoder *enc, int complexity);
+
+/**
+ * 打开或关闭编码器的 DTX: 打开后静音帧只输出 1~2 字节, 调用者可以不发送这些帧
+ * 
+ * @param enc 编码器实例
+ * @param enable 1 打开，0 关闭
+ * @return 成功返回0，失败返回-1
+ */
+int opus_encoder_set_dtx(opus_encoder *enc, int enable);
+
+/**
+ * 打开或关闭带内 FEC: 每个包附带前一帧的低码率副本, 接收端丢包时可用下一个包恢复
+ * 只有 SILK/混合模式有 FEC, lowdelay 预设 (只用 CELT) 下不起作用;
+ * 预期丢包率为 0 时编码器不会附带副本, 需要配合 opus_encoder_set_packet_loss 使用
+ * 
+ * @param enc 编码器实例
+ * @param enable 1 打开，0 关闭
+ * @return 成功返回0，失败返回-1
+ */
+int opus_encoder_set_fec(opus_encoder *enc, int enable);
+
+/**
+ * 设置预期丢包率, 编码器据此决定 FEC 副本占用的码率, 应随实测的丢包率更新
+ * 
+ * @param enc 编码器实例
+ * @param percent 丢包率 0~100 (%)
+ * @return 成功返回0，失败返回-1
+ */
+int opus_encoder_set_packet_loss(opus_encoder *enc, int percent);
+
+/**
+ * 切换编码器预设, 会重新初始化 Opus 编码器状态, 应在开始编码前调用
+ * 码率、带宽限制和 DTX 保持不变, 复杂度改为预设的值
+ * 
+ * @param enc 编码器实例
+ * @param profile 预设
+ * @return 成功返回0，失败返回-1
+ */
+int opus_encoder_set_profile(opus_encoder *enc, opus_encoder_profile profile);
+
+/**
+ * 预设的名字: "lowdelay", "voip", "quality"
+ */
+const char *opus_encoder_profile_name(opus_encoder_profile profile);
+
+/**
+ * 按名字查找预设
+ * 
+ * @param name 预设的名字
+ * @return 成功返回预设，找不到返回-1
+ */
+int opus_encoder_profile_from_name(const char *name);
+
+/**
+ * 获取编码器当前的码率、复杂度和累计统计
+ * 
+ * @param enc 编码器实例
+ * @param stats 返回统计信息
+ * @return 成功返回0，失败返回-1
+ */
+int opus_encoder_get_stats(opus_encoder *enc, opus_encoder_stats *stats);
+
+/* 单个 Opus 包的最大长度 (3 帧 * 1275 字节 + 包头) */
+#define OPUS_MAX_PACKET_SIZE (1275 * 3 + 7)
+
+/**
+ * 一次解码多个 Opus 包, 结果按顺序写入 pcmdata
+ * 如果输出缓冲区放不下下一个包的解码结果, 会提前停止, 剩余的包由调用者下次再传入
+ * 
+ * @param dec 解码器实例
+ * @param packets 各个 Opus 包的指针
+ * @param packetsizes 各个 Opus 包的大小（字节）
+ * @param count 包的个数
+ * @param pcmdata 指向 PCM 数据的指针
+ * @param pcmmax PCM 缓冲区的大小（字节）
+ * @param pcmsize 返回实际写入的 PCM 数据大小（字节）
+ * @return 成功返回已解码的包数，第一个包就失败时返回-1
+ */
+int opus2pcm_packets(opus_decoder *dec, const unsigned char* const* packets, const int* packetsizes, int count,
+                     unsigned char* pcmdata, int pcmmax, int *pcmsize);
+
+/**
+ * 解码带长度前缀的 Opus 数据: 每个包前面是 4 字节小端格式的长度, 与 opus_recorder.c 写入的格式相同
+ * 末尾不完整的包以及输出缓冲区放不下的包不会被解码, 通过 consumed 告诉调用者已处理的字节数
+ * 
+ * @param dec 解码器实例
+ * @param framed 带长度前缀的 Opus 数据
+ * @param framedsize 数据大小（字节）
+ * @param consumed 返回已处理的字节数，可以为NULL
+ * @param pcmdata 指向 PCM 数据的指针
+ * @param pcmmax PCM 缓冲区的大小（字节）
+ * @param pcmsize 返回实际写入的 PCM 数据大小（字节）
+ * @return 成功返回已解码的包数，第一个包就失败时返回-1
+ */
+int opus2pcm_framed(opus_decoder *dec, const unsigned char* framed, int framedsize, int *consumed,
+                    unsigned char* pcmdata, int pcmmax, int *pcmsize);
+
+/* 解码器的丢包统计 */
+typedef struct opus_decoder_stats {
+    unsigned long packets;       /* 收到并解码的包数 */
+    unsigned long lost;          /* 根据序号判断丢失的包数 */
+    unsigned long recovered;     /* 用下一个包的 FEC 恢复的包数 */
+    unsigned long concealed;     /* 只能用 PLC 补出的包数, 包括下一个包没有 FEC 数据的情况 */
+    unsigned long skipped;       /* 输出缓冲区放不下而没有补出的包数, lost = recovered + concealed + skipped */
+    unsigned long late;          /* 迟到或重复而丢弃的包数 */
+} opus_decoder_stats;
+
+/**
+ * 为丢失的包生成 PCM 数据: 传入下一个包时用其中的 FEC 恢复, nextdata 为NULL时用 PLC 补出
+ * 下一个包没有 FEC 数据 (编码端没有打开 FEC 或设置的丢包率为0) 时用 PLC, 计入 concealed
+ * 
+ * @param dec 解码器实例
+ * @param nextdata 丢失的包之后收到的第一个包，可以为NULL
+ * @param nextsize nextdata 的大小（字节）
+ * @param lost_ms 丢失的时长（毫秒）, 最长 120ms
+ * @param pcmdata 指向 PCM 数据的指针, 至少能放下 lost_ms 的数据
+ * @param pcmsize 返回实际写入的 PCM 数据大小（字节）
+ * @return 成功返回0，失败返回-1
+ */
+int opus2pcm_lost(opus_decoder *dec, const unsigned char* nextdata, int nextsize, int lost_ms,
+                  unsigned char* pcmdata, int *pcmsize);
+
+/**
+ * 按序号解码一个包: 发现序号不连续时先补出丢失的包 (最后一个用本包的 FEC 恢复, 更早的用 PLC), 再解码本包
+ * 迟到或重复的包直接丢弃; 丢失的包按本包的时长计算, 输出缓冲区放不下时跳过最早的几个, 计入 skipped
+ * 
+ * @param dec 解码器实例
+ * @param seq 包的序号, 每个包加1, 允许回绕
+ * @param opusdata 指向 Opus 数据的指针
+ * @param opussize Opus 数据的大小（字节）
+ * @param pcmdata 指向 PCM 数据的指针
+ * @param pcmmax PCM 缓冲区的大小（字节）
+ * @param pcmsize 返回实际写入的 PCM 数据大小（字节）
+ * @return 成功返回0，失败返回-1
+ */
+int opus2pcm_seq(opus_decoder *dec, uint32_t seq, const unsigned char* opusdata, int opussize,
+                 unsigned char* pcmdata, int pcmmax, int *pcmsize);
+
+/**
+ * 获取解码器的丢包统计
+ * 
+ * @param dec 解码器实例
+ * @param stats 返回统计信息
+ * @return 成功返回0，失败返回-1
+ */
+int opus_decoder_get_stats(opus_decoder *dec, opus_decoder_stats *stats);
+
+/* 以下接口操作进程内的默认实例, 保持与旧代码兼容 */
+
 /**
  * 初始化 Opus 编码器
  * 
@@ -12,10 +285,11 @@
  * @param duration_ms 帧持续时间（毫秒）
  * @param outputSampleRate 输出采样率
  * @param outputChannels 输出通道数
+ * @param mode CODEC_RATE_NATIVE 时以输入采样率编码并把带宽限制到输出采样率, 不经过重采样
  * @return 成功返回0，失败返回-1
  */
 int init_opus_encoder(unsigned int inputSampleRate, unsigned int inputChannels, unsigned int duration_ms, 
-        unsigned int outputSampleRate, unsigned int outputChannels);
+        unsigned int outputSampleRate, unsigned int outputChannels, codec_rate_mode mode = CODEC_RATE_RESAMPLE);
 
 /**
  * 初始化 Opus 解码器
@@ -25,10 +299,25 @@ int init_opus_encoder(unsigned int inputSampleRate, unsigned int inputChannels,
  * @param duration_ms 帧持续时间（毫秒）
  * @param outputSampleRate 输出采样率
  * @param outputChannels 输出通道数
+ * @param mode CODEC_RATE_NATIVE 时直接以输出采样率和通道数解码, 不经过重采样
  * @return 成功返回0，失败返回-1
  */
 int init_opus_decoder(int inputSampleRate, int inputChannels, int duration_ms, 
-                       int outputSampleRate, int outputChannels);
+                       int outputSampleRate, int outputChannels, codec_rate_mode mode = CODEC_RATE_RESAMPLE);
+
+/**
+ * 获取默认编码器实例, 用于调整码率或读取统计
+ * 
+ * @return 默认实例，尚未初始化时返回NULL
+ */
+opus_encoder *get_default_opus_encoder(void);
+
+/**
+ * 获取默认解码器实例, 用于补出丢失的包或读取统计
+ * 
+ * @return 默认实例，尚未初始化时返回NULL
+ */
+opus_decoder *get_default_opus_decoder(void);
 
 /**
  * 将 PCM 数据编码为 Opus 数据
@@ -52,4 +341,14 @@ int pcm2opus(unsigned char* pcmdata, int pcmsize, unsigned char* opusdata, int*
  */
 int opus2pcm(unsigned char* opusdata, int opussize, unsigned char* pcmdata, int *pcmsize);
 
+/**
+ * 销毁默认编码器实例
+ */
+void deinit_opus_encoder(void);
+
+/**
+ * 销毁默认解码器实例
+ */
+void deinit_opus_decoder(void);
+
 #endif // __OPUS_H
\ No newline at end of file
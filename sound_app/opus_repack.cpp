@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * 上行合包: 基于 libopus 的 opus_repacketizer, 合并是无损的, 解码结果与逐帧解码完全相同
+ */
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <new>
+#include <opus/opus.h>
+
+#include "opus.h"
+#include "opus_repack.h"
+
+#define REPACK_MAX_SAMPLES_48K  5760   // 一个 Opus 包最长 120ms
+
+struct opus_repack {
+    opus_repack_config cfg;
+    opus_repack_stats stats;
+    OpusRepacketizer *rp;
+    int frames;                        // 已缓存的帧数
+    int samples;                       // 已缓存的时长 (48kHz 样本数)
+    int used;                          // buf 中已用的字节数
+    std::vector<unsigned char> buf;    // opus_repacketizer_cat 要求帧数据在输出前一直有效
+};
+
+opus_repack *create_opus_repack(const opus_repack_config *cfg) {
+    if (!cfg || cfg->frames_per_packet < 1 || cfg->frames_per_packet > 48)
+        return NULL;
+
+    opus_repack *rp = new (std::nothrow) opus_repack();
+    if (!rp)
+        return NULL;
+    rp->cfg = *cfg;
+    try {
+        rp->buf.resize(cfg->frames_per_packet * OPUS_MAX_PACKET_SIZE);
+    } catch (const std::bad_alloc &) {
+        delete rp;
+        return NULL;
+    }
+    rp->rp = opus_repacketizer_create();
+    if (!rp->rp) {
+        std::cerr << "opus_repacketizer 创建失败" << std::endl;
+        delete rp;
+        return NULL;
+    }
+    return rp;
+}
+
+void destroy_opus_repack(opus_repack *rp) {
+    if (!rp)
+        return;
+    if (rp->rp)
+        opus_repacketizer_destroy(rp->rp);
+    delete rp;
+}
+
+int opus_repack_flush(opus_repack *rp, unsigned char *out, int outmax) {
+    if (rp->frames == 0)
+        return 0;
+
+    int len = opus_repacketizer_out(rp->rp, out, outmax);
+    opus_repacketizer_init(rp->rp);
+    rp->frames = 0;
+    rp->samples = 0;
+    rp->used = 0;
+    if (len < 0) {
+        std::cerr << "合包失败: " << opus_strerror(len) << std::endl;
+        return -1;
+    }
+    rp->stats.packets_out++;
+    return len;
+}
+
+// 把一帧加入缓存, 无法与已缓存的帧合并时返回 OPUS_INVALID_PACKET
+static int repack_append(opus_repack *rp, const unsigned char *frame, int size, int samples) {
+    if (rp->samples + samples > REPACK_MAX_SAMPLES_48K)
+        return OPUS_INVALID_PACKET;
+    unsigned char *p = rp->buf.data() + rp->used;
+    memcpy(p, frame, size);
+    int err = opus_repacketizer_cat(rp->rp, p, size);
+    if (err != OPUS_OK)
+        return err;
+    rp->used += size;
+    rp->frames++;
+    rp->samples += samples;
+    return OPUS_OK;
+}
+
+int opus_repack_push(opus_repack *rp, const unsigned char *frame, int size, unsigned char *out, int outmax) {
+    int samples = opus_packet_get_nb_samples(frame, size, 48000);
+    if (samples <= 0 || size > OPUS_MAX_PACKET_SIZE) {
+        std::cerr << "无效的 Opus 帧: " << size << " 字节" << std::endl;
+        return -1;
+    }
+    rp->stats.frames_in++;
+    rp->stats.audio_ms += samples / 48;
+
+    // 不合并: 原样输出
+    if (rp->cfg.frames_per_packet == 1) {
+        if (size > outmax)
+            return -1;
+        memcpy(out, frame, size);
+        rp->stats.packets_out++;
+        return size;
+    }
+
+    int len = 0;
+    if (repack_append(rp, frame, size, samples) != OPUS_OK) {
+        // 编码模式变化 (比如带宽切换) 或超长: 先发出已缓存的帧, 这一帧作为新包的开始
+        len = opus_repack_flush(rp, out, outmax);
+        if (len < 0)
+            return -1;
+        int err = repack_append(rp, frame, size, samples);
+        if (err != OPUS_OK)
+            std::cerr << "合包失败: " << opus_strerror(err) << std::endl;
+        return len;
+    }
+
+    if (rp->frames >= rp->cfg.frames_per_packet)
+        len = opus_repack_flush(rp, out, outmax);
+    return len;
+}
+
+int opus_repack_end_of_speech(opus_repack *rp, unsigned char *out, int outmax) {
+    if (!rp->cfg.flush_on_silence || rp->frames == 0)
+        return 0;
+    int len = opus_repack_flush(rp, out, outmax);
+    if (len > 0)
+        rp->stats.silence_flushes++;
+    return len;
+}
+
+void opus_repack_get_stats(opus_repack *rp, opus_repack_stats *stats) {
+    *stats = rp->stats;
+    stats->messages_saved = rp->stats.frames_in - rp->stats.packets_out - rp->frames;
+}
@@ -0,0 +1,70 @@
+#ifndef OPUS_REPACK_H
+#define OPUS_REPACK_H
+
+/* 上行合包: 把若干个短的 Opus 帧 (如 20ms) 用 opus_repacketizer 合并成一个长包 (40/60/120ms) 再发送
+ * 采集和编码保持短帧的响应速度, 网络上的消息数按合并的帧数减少
+ */
+
+typedef struct opus_repack_config {
+    int frames_per_packet;    /* 每个包合并的帧数, 1 表示不合并; 合并后总时长不超过 120ms */
+    int flush_on_silence;     /* 1: 人声结束 (不再有帧要发送) 时立即发出未凑满的包 */
+} opus_repack_config;
+
+typedef struct opus_repack_stats {
+    unsigned long frames_in;        /* 输入的帧数 */
+    unsigned long packets_out;      /* 输出的包数 */
+    unsigned long messages_saved;   /* 少发送的消息数 = frames_in - packets_out */
+    unsigned long silence_flushes;  /* 因人声结束提前发出的包数 */
+    unsigned long audio_ms;         /* 输入的音频总时长 (ms), 用于换算每秒少发的消息数 */
+} opus_repack_stats;
+
+typedef struct opus_repack opus_repack;
+
+/**
+ * 创建合包器
+ * 
+ * @param cfg 配置, 会被复制
+ * @return 成功返回实例，失败返回NULL
+ */
+opus_repack *create_opus_repack(const opus_repack_config *cfg);
+
+/**
+ * 销毁合包器
+ * 
+ * @param rp 实例，可以为NULL
+ */
+void destroy_opus_repack(opus_repack *rp);
+
+/**
+ * 输入一个编码好的 Opus 帧, 凑满 frames_per_packet 帧时输出合并后的包
+ * 与已缓存的帧编码模式不同 (无法合并) 或总时长超过 120ms 时, 先输出已缓存的帧
+ * 
+ * @param rp 实例
+ * @param frame Opus 帧
+ * @param size 帧长度（字节）
+ * @param out 输出缓冲区
+ * @param outmax 输出缓冲区大小, 至少 OPUS_MAX_PACKET_SIZE
+ * @return 输出的包长度, 没有包输出时返回0, 失败返回-1
+ */
+int opus_repack_push(opus_repack *rp, const unsigned char *frame, int size, unsigned char *out, int outmax);
+
+/**
+ * 人声结束时调用: flush_on_silence 打开时输出已缓存的帧
+ * 
+ * @return 输出的包长度, 没有缓存的帧或策略不需要时返回0, 失败返回-1
+ */
+int opus_repack_end_of_speech(opus_repack *rp, unsigned char *out, int outmax);
+
+/**
+ * 无条件输出已缓存的帧
+ * 
+ * @return 输出的包长度, 没有缓存的帧时返回0, 失败返回-1
+ */
+int opus_repack_flush(opus_repack *rp, unsigned char *out, int outmax);
+
+/**
+ * 获取统计信息
+ */
+void opus_repack_get_stats(opus_repack *rp, opus_repack_stats *stats);
+
+#endif // OPUS_REPACK_H
@@ -0,0 +1,507 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * 回声消除: 播放线程保存放出的 PCM 和放出时刻, 录音线程按采集时刻取对齐的参考交给 Speex 回声消除器
+ */
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <atomic>
+#include <new>
+#include <vector>
+#include <speex/speex_echo.h>
+
+#include "pcm_mix.h"
+#include "pcm_aec.h"
+
+#define DOWNMIX_CHUNK     1024      // 双声道参考每次转单声道的帧数
+#define ERLE_MIN_LEVEL    (32768.0 * 32768.0 * 1e-5)   // 参考的均方值高于 -50 dBFS 才算远端在放音
+#define ERLE_SMOOTH       0.98      // ERLE 能量平滑系数, 10ms 一帧时大约平滑 0.5s
+
+struct echo_ref {
+    unsigned int historyMs;
+    std::atomic<unsigned int> sampleRate;   // 0 表示还没有设置格式, 录音线程看到非0后才读历史
+    unsigned int channels;
+    std::vector<int16_t> history;           // 单声道, 长度是 2 的幂
+    size_t mask;
+    std::atomic<uint64_t> written;          // 累计写入的采样数
+    int16_t mono[DOWNMIX_CHUNK];
+
+    // 最近一次 mark: 第 markIndex 个采样之前的数据在 markTime 放完; seq 为奇数时正在更新
+    std::atomic<uint32_t> seq;
+    std::atomic<uint64_t> markIndex;
+    std::atomic<int64_t> markTime;
+};
+
+struct pcm_aec {
+    pcm_aec_config cfg;
+    pcm_aec_stats stats;
+    echo_ref *ref;
+    int sampleRate;
+    int channels;
+    int frameSize;
+    int fill;                       // mic 中已经攒下的帧数
+    int64_t frameTime;              // mic 中第一个采样的采集时刻
+    int64_t readIndex;              // 下一帧参考的起点, -1 表示还没有对齐
+    SpeexEchoState *state;
+    std::vector<int16_t> mic;       // 一帧交错的录音
+    std::vector<int16_t> far;       // 一帧单声道参考
+    double inEnergy, outEnergy;     // 远端放音时输入、输出能量的平滑值
+};
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* ---- 远端参考 ---- */
+
+echo_ref *create_echo_ref(unsigned int history_ms) {
+    if (!history_ms)
+        return NULL;
+    echo_ref *ref = new (std::nothrow) echo_ref();
+    if (!ref)
+        return NULL;
+    ref->historyMs = history_ms;
+    return ref;
+}
+
+void destroy_echo_ref(echo_ref *ref) {
+    delete ref;
+}
+
+int echo_ref_set_format(echo_ref *ref, unsigned int sample_rate, unsigned int channels) {
+    if (ref->sampleRate.load(std::memory_order_relaxed) || !sample_rate || channels < 1 || channels > 2)
+        return -1;
+    size_t size = 1;
+    while (size < (size_t)sample_rate * ref->historyMs / 1000)
+        size <<= 1;
+    ref->history.assign(size, 0);
+    ref->mask = size - 1;
+    ref->channels = channels;
+    ref->sampleRate.store(sample_rate, std::memory_order_release);
+    return 0;
+}
+
+static void history_write(echo_ref *ref, const int16_t *mono, int n) {
+    uint64_t w = ref->written.load(std::memory_order_relaxed);
+    size_t pos = w & ref->mask;
+    size_t first = ref->history.size() - pos;
+    if (first > (size_t)n)
+        first = n;
+    if (mono) {
+        memcpy(&ref->history[pos], mono, first * sizeof(int16_t));
+        memcpy(&ref->history[0], mono + first, (n - first) * sizeof(int16_t));
+    } else {
+        memset(&ref->history[pos], 0, first * sizeof(int16_t));
+        memset(&ref->history[0], 0, (n - first) * sizeof(int16_t));
+    }
+    ref->written.store(w + n, std::memory_order_release);
+}
+
+void echo_ref_write(echo_ref *ref, const int16_t *pcm, int frames) {
+    if (!ref->sampleRate.load(std::memory_order_relaxed))
+        return;
+    if (!pcm || ref->channels == 1) {
+        history_write(ref, pcm, frames);
+        return;
+    }
+    while (frames > 0) {
+        int n = frames < DOWNMIX_CHUNK ? frames : DOWNMIX_CHUNK;
+        pcm_downmix_2to1(pcm, ref->mono, n);
+        history_write(ref, ref->mono, n);
+        pcm += n * 2;
+        frames -= n;
+    }
+}
+
+void echo_ref_mark(echo_ref *ref, int64_t play_time_us) {
+    uint32_t s = ref->seq.load(std::memory_order_relaxed);
+    ref->seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    ref->markIndex.store(ref->written.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    ref->markTime.store(play_time_us, std::memory_order_relaxed);
+    ref->seq.store(s + 2, std::memory_order_release);
+}
+
+static void read_mark(echo_ref *ref, uint64_t *index, int64_t *time) {
+    uint32_t s;
+    do {
+        s = ref->seq.load(std::memory_order_acquire);
+        *index = ref->markIndex.load(std::memory_order_relaxed);
+        *time = ref->markTime.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((s & 1) || ref->seq.load(std::memory_order_relaxed) != s);
+}
+
+// 从历史中取 [start, start + n) 的参考, 还没写入或已经被覆盖的部分填0, 返回有效的采样数
+static int history_read(echo_ref *ref, int64_t start, int16_t *out, int n) {
+    int valid = 0;
+    int64_t written = (int64_t)ref->written.load(std::memory_order_acquire);
+    int64_t oldest = written - (int64_t)ref->history.size();
+    for (int i = 0; i < n; i++) {
+        int64_t k = start + i;
+        if (k >= oldest && k < written) {
+            out[i] = ref->history[k & ref->mask];
+            valid++;
+        } else {
+            out[i] = 0;
+        }
+    }
+    // 读的过程中播放线程可能已经覆盖了最旧的部分
+    int64_t now_oldest = (int64_t)ref->written.load(std::memory_order_acquire) - (int64_t)ref->history.size();
+    if (now_oldest > start)
+        return 0;
+    return valid;
+}
+
+/* ---- 回声消除器 ---- */
+
+pcm_aec *create_pcm_aec(const pcm_aec_config *cfg, echo_ref *ref, int sample_rate, int channels) {
+    if (!cfg || !ref || sample_rate <= 0 || channels < 1 || (cfg->frame_ms != 10 && cfg->frame_ms != 20) ||
+        !cfg->filter_ms)
+        return NULL;
+    pcm_aec *aec = new (std::nothrow) pcm_aec();
+    if (!aec)
+        return NULL;
+    aec->cfg = *cfg;
+    aec->ref = ref;
+    aec->sampleRate = sample_rate;
+    aec->channels = channels;
+    aec->frameSize = sample_rate * (int)cfg->frame_ms / 1000;
+    aec->readIndex = -1;
+    aec->stats.frame_us = cfg->frame_ms * 1000;
+    aec->mic.assign(aec->frameSize * channels, 0);
+    aec->far.assign(aec->frameSize, 0);
+    aec->state = speex_echo_state_init_mc(aec->frameSize, sample_rate * (int)cfg->filter_ms / 1000, channels, 1);
+    if (!aec->state) {
+        delete aec;
+        return NULL;
+    }
+    spx_int32_t rate = sample_rate;
+    speex_echo_ctl(aec->state, SPEEX_ECHO_SET_SAMPLING_RATE, &rate);
+    return aec;
+}
+
+void destroy_pcm_aec(pcm_aec *aec) {
+    if (!aec)
+        return;
+    speex_echo_state_destroy(aec->state);
+    delete aec;
+}
+
+int pcm_aec_frame_size(pcm_aec *aec) {
+    return aec->frameSize;
+}
+
+// 取与 mic 这一帧同时放出的参考, 返回0表示没有可用的参考
+static int align_reference(pcm_aec *aec) {
+    echo_ref *ref = aec->ref;
+    if (ref->sampleRate.load(std::memory_order_acquire) != (unsigned int)aec->sampleRate)
+        return 0;
+    uint64_t markIndex;
+    int64_t markTime;
+    read_mark(ref, &markIndex, &markTime);
+    if (!markIndex)
+        return 0;
+
+    // 参考中第 k 个采样在 markTime - (markIndex - k) / rate 放出
+    int64_t target = (int64_t)markIndex - (markTime - aec->frameTime) * aec->sampleRate / 1000000
+                     - (int64_t)aec->cfg.lead_ms * aec->sampleRate / 1000;
+    int64_t resync = (int64_t)aec->cfg.resync_ms * aec->sampleRate / 1000;
+    if (aec->readIndex < 0 || target - aec->readIndex > resync || aec->readIndex - target > resync) {
+        aec->readIndex = target;
+        aec->stats.resyncs++;
+        aec->stats.ref_age_us = (long)(((int64_t)markIndex - target) * 1000000 / aec->sampleRate);
+    }
+    int valid = history_read(ref, aec->readIndex, aec->far.data(), aec->frameSize);
+    aec->readIndex += aec->frameSize;
+    return valid > 0;
+}
+
+static void update_erle(pcm_aec *aec, const int16_t *in, const int16_t *out) {
+    double farEnergy = 0, inEnergy = 0, outEnergy = 0;
+    for (int i = 0; i < aec->frameSize; i++)
+        farEnergy += (double)aec->far[i] * aec->far[i];
+    if (farEnergy / aec->frameSize < ERLE_MIN_LEVEL)
+        return;
+    for (int i = 0; i < aec->frameSize * aec->channels; i++) {
+        inEnergy += (double)in[i] * in[i];
+        outEnergy += (double)out[i] * out[i];
+    }
+    aec->inEnergy = aec->inEnergy * ERLE_SMOOTH + inEnergy;
+    aec->outEnergy = aec->outEnergy * ERLE_SMOOTH + outEnergy;
+    aec->stats.erle_db = (float)(10 * log10((aec->inEnergy + 1) / (aec->outEnergy + 1)));
+}
+
+int pcm_aec_process(pcm_aec *aec, const int16_t *in, int frames, int64_t capture_time_us, int16_t *out) {
+    int produced = 0;
+    while (frames > 0) {
+        uint64_t start = thread_cpu_ns();
+        if (aec->fill == 0)
+            aec->frameTime = capture_time_us;
+        int n = aec->frameSize - aec->fill;
+        if (n > frames)
+            n = frames;
+        memcpy(&aec->mic[aec->fill * aec->channels], in, n * aec->channels * sizeof(int16_t));
+        aec->fill += n;
+        in += n * aec->channels;
+        frames -= n;
+        capture_time_us += (int64_t)n * 1000000 / aec->sampleRate;
+        if (aec->fill < aec->frameSize) {
+            aec->stats.cpu_ns += thread_cpu_ns() - start;
+            break;
+        }
+
+        int16_t *dst = out + produced * aec->channels;
+        if (align_reference(aec)) {
+            speex_echo_cancellation(aec->state, aec->mic.data(), aec->far.data(), dst);
+            update_erle(aec, aec->mic.data(), dst);
+        } else {
+            memcpy(dst, aec->mic.data(), aec->mic.size() * sizeof(int16_t));
+            aec->stats.no_ref_frames++;
+        }
+        produced += aec->frameSize;
+        aec->fill = 0;
+
+        uint64_t cost = thread_cpu_ns() - start;
+        aec->stats.frames++;
+        aec->stats.cpu_ns += cost;
+        if (cost > aec->stats.max_cpu_ns)
+            aec->stats.max_cpu_ns = (uint32_t)cost;
+    }
+    return produced;
+}
+
+void pcm_aec_get_stats(pcm_aec *aec, pcm_aec_stats *stats) {
+    *stats = aec->stats;
+}
+
+#ifdef TEST
+/* 测试: make pcm_aec_test, 不需要声卡, 在目标板上运行可以得到实际的每帧 CPU 占用
+ * 用法: ./pcm_aec_test                      合成远端语音和回声, 经 WAV 文件设备写出再读回, 测量 ERLE 和每帧耗时
+ *       ./pcm_aec_test far.wav mic.wav [out.wav]  用实际录下的参考和麦克风文件 (两者已经对齐) 测量 ERLE
+ * 合成的回声: 远端延迟 40ms 后经过 100ms 长的衰减冲激响应, 再加上 -60dB 的噪声; 前 10s 只有远端, 后 5s 近端同时说话
+ * 参考的放出时刻带有 +-2ms 的随机抖动, 模拟 snd_pcm_delay 的测量误差
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "audio_dev.h"
+
+#define TEST_RATE 16000
+
+static std::vector<int16_t> g_test_src;
+static size_t g_test_pos;
+static std::vector<int16_t> g_test_dst;
+
+static size_t fill_from_vector(unsigned char *data, size_t size, void *arg) {
+    size_t n = g_test_src.size() - g_test_pos;
+    if (n > size / 2)
+        n = size / 2;
+    memcpy(data, &g_test_src[g_test_pos], n * 2);
+    g_test_pos += n;
+    return n * 2;
+}
+
+static void append_to_vector(unsigned char *data, size_t size, void *arg) {
+    g_test_dst.insert(g_test_dst.end(), (int16_t *)data, (int16_t *)(data + size));
+}
+
+// 经 WAV 文件设备写出
+static int write_wav(const char *path, const std::vector<int16_t> &pcm, unsigned int rate, unsigned int channels) {
+    audio_dev_config config = { rate, channels, PCM_LATENCY_DEFAULT, 10, 0 };
+    audio_dev_info info;
+    p_audio_dev_t dev = audio_dev_create_wav(path, 0);
+    if (!dev || dev->open(dev, 1, &config, &info)) {
+        audio_dev_destroy(dev);
+        return -1;
+    }
+    g_test_src = pcm;
+    g_test_pos = 0;
+    while (g_test_pos < g_test_src.size())
+        dev->play(dev, fill_from_vector, NULL);
+    audio_dev_destroy(dev);
+    return 0;
+}
+
+// 经 WAV 文件设备读入
+static int read_wav(const char *path, std::vector<int16_t> *pcm, audio_dev_info *info) {
+    audio_dev_config config = { TEST_RATE, 1, PCM_LATENCY_DEFAULT, 10, 0 };
+    p_audio_dev_t dev = audio_dev_create_wav(path, 0);
+    if (!dev || dev->open(dev, 0, &config, info)) {
+        audio_dev_destroy(dev);
+        return -1;
+    }
+    g_test_dst.clear();
+    while (dev->capture(dev, append_to_vector, NULL) > 0)
+        ;
+    audio_dev_destroy(dev);
+    *pcm = g_test_dst;
+    return 0;
+}
+
+// 类似语音的远端信号: 几个谐波组成的元音, 基频和音量按音节变化, 每隔一段停顿
+static std::vector<int16_t> make_speech(int seconds, unsigned int seed) {
+    std::vector<int16_t> pcm(TEST_RATE * seconds);
+    double phase = 0;
+    for (size_t i = 0; i < pcm.size(); i++) {
+        double t = (double)i / TEST_RATE;
+        int syllable = (int)(t * 4);
+        double f0 = 110 + (syllable * 37 + seed) % 90;
+        double env = (syllable % 7 == 6) ? 0 : sin(M_PI * fmod(t * 4, 1.0));
+        phase += 2 * M_PI * f0 / TEST_RATE;
+        double v = 0;
+        for (int h = 1; h <= 8; h++)
+            v += sin(h * phase) / h;
+        v += ((int)(rand_r(&seed) % 2001) - 1000) / 1000.0 * 0.1;
+        pcm[i] = (int16_t)(4000 * env * v);
+    }
+    return pcm;
+}
+
+// 麦克风 = 远端经过回声路径 + 近端 + 噪声, 写成双声道, 与录音线程拿到的数据相同
+static std::vector<int16_t> make_mic(const std::vector<int16_t> &far, const std::vector<int16_t> &near) {
+    const int delay = TEST_RATE * 40 / 1000, taps = TEST_RATE * 100 / 1000;
+    std::vector<double> ir(taps);
+    unsigned int seed = 7;
+    for (int i = 0; i < taps; i++)
+        ir[i] = ((int)(rand_r(&seed) % 2001) - 1000) / 1000.0 * 0.05 * exp(-i / (TEST_RATE * 0.02));
+    ir[0] = 0.5;
+    std::vector<int16_t> mic(far.size() * 2);
+    for (size_t i = 0; i < far.size(); i++) {
+        double v = near[i] + ((int)(rand_r(&seed) % 2001) - 1000) / 1000.0 * 30;
+        for (int k = 0; k < taps; k++) {
+            long j = (long)i - delay - k;
+            if (j >= 0)
+                v += ir[k] * far[j];
+        }
+        if (v > 32767) v = 32767;
+        if (v < -32768) v = -32768;
+        mic[2 * i] = mic[2 * i + 1] = (int16_t)v;
+    }
+    return mic;
+}
+
+// 按 10ms 的 period 把参考和录音交给回声消除器, 放出时刻和采集时刻用采样数换算
+static std::vector<int16_t> run_aec(const pcm_aec_config *cfg, const std::vector<int16_t> &far, int far_channels,
+                                    const std::vector<int16_t> &mic, int mic_channels, int rate, pcm_aec_stats *st) {
+    echo_ref *ref = create_echo_ref(1000);
+    echo_ref_set_format(ref, rate, far_channels);
+    pcm_aec *aec = create_pcm_aec(cfg, ref, rate, mic_channels);
+    std::vector<int16_t> out(mic.size());
+    if (!aec) {
+        printf("failed to create aec\n");
+        destroy_echo_ref(ref);
+        return out;
+    }
+    const int period = rate / 100;
+    const int64_t base = 1000000;
+    unsigned int seed = 3;
+    size_t frames = mic.size() / mic_channels, produced = 0;
+    if (frames > far.size() / far_channels)
+        frames = far.size() / far_channels;
+    for (size_t pos = 0; pos + period <= frames; pos += period) {
+        echo_ref_write(ref, &far[pos * far_channels], period);
+        int64_t jitter = (int)(rand_r(&seed) % 4001) - 2000;
+        echo_ref_mark(ref, base + (int64_t)(pos + period) * 1000000 / rate + jitter);
+        produced += pcm_aec_process(aec, &mic[pos * mic_channels], period, base + (int64_t)pos * 1000000 / rate,
+                                    &out[produced * mic_channels]);
+    }
+    out.resize(produced * mic_channels);
+    pcm_aec_get_stats(aec, st);
+    destroy_pcm_aec(aec);
+    destroy_echo_ref(ref);
+    return out;
+}
+
+// [from, to) 秒内 录音能量 / 输出能量
+static double erle_db(const std::vector<int16_t> &mic, const std::vector<int16_t> &out, int channels, int rate,
+                      double from, double to) {
+    double in = 0, res = 0;
+    size_t a = (size_t)(from * rate) * channels, b = (size_t)(to * rate) * channels;
+    if (b > out.size())
+        b = out.size();
+    for (size_t i = a; i < b; i++) {
+        in += (double)mic[i] * mic[i];
+        res += (double)out[i] * out[i];
+    }
+    return 10 * log10((in + 1) / (res + 1));
+}
+
+static void print_cost(const char *name, const pcm_aec_stats *st) {
+    double avg_us = st->frames ? st->cpu_ns / 1000.0 / st->frames : 0;
+    printf("%-26s frames %5lu, no ref %4lu, resyncs %lu, cpu avg %7.1f us, max %7.1f us per %u ms frame (%.2f%%)\n",
+           name, st->frames, st->no_ref_frames, st->resyncs, avg_us, st->max_cpu_ns / 1000.0, st->frame_us / 1000,
+           avg_us * 100 / st->frame_us);
+}
+
+static int run_files(int argc, char **argv) {
+    std::vector<int16_t> far, mic;
+    audio_dev_info far_info, mic_info;
+    if (read_wav(argv[1], &far, &far_info) || read_wav(argv[2], &mic, &mic_info))
+        return 1;
+    if (far_info.sample_rate != mic_info.sample_rate) {
+        printf("sample rates differ: %u / %u\n", far_info.sample_rate, mic_info.sample_rate);
+        return 1;
+    }
+    pcm_aec_config cfg = { 10, 128, 10, 8 };
+    pcm_aec_stats st;
+    std::vector<int16_t> out = run_aec(&cfg, far, far_info.channels, mic, mic_info.channels, mic_info.sample_rate, &st);
+    print_cost("files", &st);
+    double seconds = (double)out.size() / mic_info.channels / mic_info.sample_rate;
+    printf("ERLE over %.1f s: %.1f dB (whole file, includes near-end speech), running estimate %.1f dB\n", seconds,
+           erle_db(mic, out, mic_info.channels, mic_info.sample_rate, 0, seconds), st.erle_db);
+    if (argc > 3)
+        write_wav(argv[3], out, mic_info.sample_rate, mic_info.channels);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 2)
+        return run_files(argc, argv);
+
+    // 前 10s 只有远端, 后 5s 近端同时说话
+    std::vector<int16_t> far = make_speech(15, 1);
+    std::vector<int16_t> near(far.size(), 0);
+    std::vector<int16_t> talk = make_speech(5, 2);
+    for (size_t i = 0; i < talk.size(); i++)
+        near[10 * TEST_RATE + i] = talk[i] / 2;
+    std::vector<int16_t> mic = make_mic(far, near);
+
+    const char *far_path = "/tmp/pcm_aec_far.wav", *mic_path = "/tmp/pcm_aec_mic.wav";
+    std::vector<int16_t> far_in, mic_in;
+    audio_dev_info info;
+    if (write_wav(far_path, far, TEST_RATE, 1) || write_wav(mic_path, mic, TEST_RATE, 2) ||
+        read_wav(far_path, &far_in, &info) || read_wav(mic_path, &mic_in, &info)) {
+        printf("failed to write/read wav files\n");
+        return 1;
+    }
+    unlink(far_path);
+    unlink(mic_path);
+
+    int failed = 0;
+    const unsigned int filters[] = { 64, 128, 256 };
+    for (int i = 0; i < 3; i++) {
+        pcm_aec_config cfg = { 10, filters[i], 10, 8 };
+        pcm_aec_stats st;
+        std::vector<int16_t> out = run_aec(&cfg, far_in, 1, mic_in, 2, TEST_RATE, &st);
+        char name[64];
+        snprintf(name, sizeof(name), "stereo mic, %u ms tail", filters[i]);
+        print_cost(name, &st);
+        // 前 3s 用于收敛; 双讲时近端保留下来, ERLE 自然较低
+        double erle = erle_db(mic_in, out, 2, TEST_RATE, 3, 10);
+        printf("%-26s ERLE far-end only %.1f dB, double talk %.1f dB, running estimate %.1f dB, ref age %.1f ms\n", "",
+               erle, erle_db(mic_in, out, 2, TEST_RATE, 10, 15), st.erle_db, st.ref_age_us / 1000.0);
+        // 64ms 的尾长短于 40ms + 100ms 的回声路径, 只要求更长的两个达到 10dB
+        if (filters[i] >= 128 && erle < 10)
+            failed++;
+        if (st.resyncs != 1)
+            failed++;
+    }
+    printf("%s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
+#endif
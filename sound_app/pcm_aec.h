@@ -0,0 +1,116 @@
+#ifndef PCM_AEC_H
+#define PCM_AEC_H
+
+#include <stdint.h>
+
+/* 回声消除: 以播放线程写入设备的 PCM 作为远端参考, 用 Speex 从录音中减去喇叭传回麦克风的声音
+ *
+ * 参考和录音按时间对齐: 播放线程每次写入后根据设备的延迟 (snd_pcm_delay) 记下刚写入的最后一个采样
+ * 什么时候从喇叭放出; 录音线程根据采集延迟算出这一帧什么时候被采集, 再从参考的历史里取同一时刻放出的采样
+ * 估计的时刻有抖动, 只有偏差超过 resync 门限时才重新对齐, 否则参考保持连续, 不影响滤波器收敛
+ */
+
+/* 远端参考: 播放线程写, 录音线程读, 保存最近一段时间放出的单声道 PCM */
+typedef struct echo_ref echo_ref;
+
+typedef struct pcm_aec_config {
+    unsigned int frame_ms;    /* 每次处理的时长 (ms), 10 或 20 */
+    unsigned int filter_ms;   /* 回声尾长 (ms): 能消除的最长回声路径, 越长越耗 CPU */
+    unsigned int lead_ms;     /* 参考比估计的时刻提前取多少, 延迟估计偏小时也不会让回声早于参考 */
+    unsigned int resync_ms;   /* 估计的对齐位置与当前位置相差超过这个值时重新对齐 */
+} pcm_aec_config;
+
+typedef struct pcm_aec_stats {
+    unsigned long frames;     /* 处理的帧数 */
+    unsigned long no_ref_frames; /* 没有参考 (还没有开始播放或参考已经过期), 直接输出录音的帧数 */
+    unsigned long resyncs;    /* 重新对齐的次数 */
+    long ref_age_us;          /* 最近一次对齐时取的参考比最新写入的参考早多少, 大约是播放延迟 + 采集延迟 + lead */
+    float erle_db;            /* 回声返回损耗增强: 远端在放音时 输入能量/输出能量, 平滑后的值 */
+    unsigned int frame_us;    /* 一帧的时长 (us) */
+    uint64_t cpu_ns;          /* 累计占用的 CPU 时间 (ns) */
+    uint32_t max_cpu_ns;      /* 处理一帧占用 CPU 时间的最大值 (ns) */
+} pcm_aec_stats;
+
+typedef struct pcm_aec pcm_aec;
+
+/**
+ * 创建远端参考
+ *
+ * @param history_ms 保存的时长 (ms), 要大于播放延迟 + 采集延迟 + 回声尾长
+ * @return 成功返回实例，失败返回NULL
+ */
+echo_ref *create_echo_ref(unsigned int history_ms);
+
+/**
+ * 销毁远端参考
+ */
+void destroy_echo_ref(echo_ref *ref);
+
+/**
+ * 设置参考的格式, 播放线程打开设备后、写入数据之前调用
+ *
+ * @param ref 远端参考
+ * @param sample_rate 播放的采样率
+ * @param channels 播放的声道数, 双声道时先转成单声道再保存
+ * @return 成功返回0, 失败返回-1
+ */
+int echo_ref_set_format(echo_ref *ref, unsigned int sample_rate, unsigned int channels);
+
+/**
+ * 保存写入设备的一段 PCM, 只能在播放线程中调用
+ *
+ * @param ref 远端参考
+ * @param pcm 交错的 S16 数据, NULL 表示静音 (设备补的静音也是放出的声音)
+ * @param frames 帧数
+ */
+void echo_ref_write(echo_ref *ref, const int16_t *pcm, int frames);
+
+/**
+ * 记录已经写入的最后一个采样从喇叭放出的时刻, 每次写入设备之后在播放线程中调用
+ *
+ * @param ref 远端参考
+ * @param play_time_us 放出的时刻 (pipeline_now_us 的时钟)
+ */
+void echo_ref_mark(echo_ref *ref, int64_t play_time_us);
+
+/**
+ * 创建回声消除器
+ *
+ * @param cfg 配置, 会被复制
+ * @param ref 远端参考, 采样率要与录音相同
+ * @param sample_rate 录音的采样率
+ * @param channels 录音的声道数, 每个声道都会消除回声
+ * @return 成功返回实例，失败返回NULL
+ */
+pcm_aec *create_pcm_aec(const pcm_aec_config *cfg, echo_ref *ref, int sample_rate, int channels);
+
+/**
+ * 销毁回声消除器
+ *
+ * @param aec 实例，可以为NULL
+ */
+void destroy_pcm_aec(pcm_aec *aec);
+
+/**
+ * 获取每帧的样本数 (每个声道)
+ */
+int pcm_aec_frame_size(pcm_aec *aec);
+
+/**
+ * 处理一段交错的 S16 录音, 输出凑满的整帧; 只能在录音线程中调用
+ *
+ * @param aec 实例
+ * @param in 录音数据
+ * @param frames 帧数
+ * @param capture_time_us 第一个采样被采集的时刻 (pipeline_now_us 的时钟)
+ * @param out 输出数据, 至少能容纳 frames + pcm_aec_frame_size() 帧, 不能与 in 重叠
+ * @return 输出的帧数, 是帧长的整数倍
+ */
+int pcm_aec_process(pcm_aec *aec, const int16_t *in, int frames, int64_t capture_time_us, int16_t *out);
+
+/**
+ * 获取统计信息
+ */
+void pcm_aec_get_stats(pcm_aec *aec, pcm_aec_stats *stats);
+
+#endif // PCM_AEC_H
@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * 声卡延迟档位: 让 period/buffer 与 Opus 帧长对齐, 并设置尽快开始播放的软件参数
+ */
+#include <stdio.h>
+#include <alsa/asoundlib.h>
+
+#include "pcm_latency.h"
+
+typedef struct pcm_latency_preset {
+    const char *name;
+    unsigned int period_divisor;    /* period = 帧长 / period_divisor */
+    unsigned int buffer_periods;    /* buffer = buffer_periods 个 period */
+} pcm_latency_preset;
+
+static const pcm_latency_preset g_presets[] = {
+    { "default",  0, 0 },
+    { "low",      4, 3 },
+    { "balanced", 2, 4 },
+    { "safe",     1, 4 },
+};
+
+#define PRESET_COUNT (sizeof(g_presets) / sizeof(g_presets[0]))
+
+/**
+ * 获取延迟档位的名字
+ */
+const char *pcm_latency_profile_name(pcm_latency_profile profile) {
+    if ((unsigned)profile >= PRESET_COUNT)
+        return "unknown";
+    return g_presets[profile].name;
+}
+
+/**
+ * 按延迟档位设置 period 和 buffer 大小
+ */
+int pcm_latency_set_hw_params(snd_pcm_t *pcm_handle, snd_pcm_hw_params_t *hw_params, unsigned int sample_rate,
+                              pcm_latency_profile profile, unsigned int frame_ms) {
+    if (profile == PCM_LATENCY_DEFAULT)
+        return 0;
+    if ((unsigned)profile >= PRESET_COUNT || !frame_ms || !sample_rate)
+        return -EINVAL;
+
+    // 一帧的采样数要能被分母整除, 否则减小分母
+    unsigned long frame_frames = (unsigned long)sample_rate * frame_ms / 1000;
+    unsigned int divisor = g_presets[profile].period_divisor;
+    while (divisor > 1 && frame_frames % divisor)
+        divisor--;
+
+    snd_pcm_uframes_t period = frame_frames / divisor;
+    snd_pcm_uframes_t buffer = period * g_presets[profile].buffer_periods;
+    int dir = 0;
+
+    // 先在一个副本上试, 失败时不影响调用者继续使用默认值
+    snd_pcm_hw_params_t *trial;
+    snd_pcm_hw_params_alloca(&trial);
+    snd_pcm_hw_params_copy(trial, hw_params);
+
+    int rc = snd_pcm_hw_params_set_period_size_near(pcm_handle, trial, &period, &dir);
+    if (rc < 0)
+        return rc;
+    rc = snd_pcm_hw_params_set_buffer_size_near(pcm_handle, trial, &buffer);
+    if (rc < 0)
+        return rc;
+
+    snd_pcm_hw_params_copy(hw_params, trial);
+    return 0;
+}
+
+/**
+ * 设置软件参数
+ */
+int pcm_latency_set_sw_params(snd_pcm_t *pcm_handle, int playback) {
+    snd_pcm_hw_params_t *hw_params;
+    snd_pcm_sw_params_t *sw_params;
+    snd_pcm_uframes_t period;
+
+    snd_pcm_hw_params_alloca(&hw_params);
+    snd_pcm_sw_params_alloca(&sw_params);
+
+    int rc = snd_pcm_hw_params_current(pcm_handle, hw_params);
+    if (rc < 0)
+        return rc;
+    snd_pcm_hw_params_get_period_size(hw_params, &period, 0);
+
+    rc = snd_pcm_sw_params_current(pcm_handle, sw_params);
+    if (rc < 0)
+        return rc;
+    rc = snd_pcm_sw_params_set_avail_min(pcm_handle, sw_params, period);
+    if (rc >= 0 && playback)
+        rc = snd_pcm_sw_params_set_start_threshold(pcm_handle, sw_params, period);
+    if (rc >= 0)
+        rc = snd_pcm_sw_params(pcm_handle, sw_params);
+    return rc;
+}
+
+/**
+ * 打印实际的 period/buffer 时长
+ */
+void pcm_latency_report(snd_pcm_t *pcm_handle, const char *name, unsigned int frame_ms) {
+    snd_pcm_hw_params_t *hw_params;
+    snd_pcm_uframes_t period, buffer;
+    unsigned int rate;
+
+    snd_pcm_hw_params_alloca(&hw_params);
+    if (snd_pcm_hw_params_current(pcm_handle, hw_params) < 0)
+        return;
+    snd_pcm_hw_params_get_period_size(hw_params, &period, 0);
+    snd_pcm_hw_params_get_buffer_size(hw_params, &buffer);
+    snd_pcm_hw_params_get_rate(hw_params, &rate, 0);
+    if (!rate || !period)
+        return;
+
+    unsigned long frame_frames = (unsigned long)rate * frame_ms / 1000;
+    printf("%s: period %lu frames (%.2f ms), buffer %lu frames (%.2f ms), %s the %u ms frame\n",
+           name, (unsigned long)period, period * 1000.0 / rate, (unsigned long)buffer, buffer * 1000.0 / rate,
+           frame_frames % period == 0 ? "divides" : "does NOT divide", frame_ms);
+}
+
+/**
+ * 用 snd_pcm_delay 获取当前的延迟 (us)
+ */
+long pcm_latency_delay_us(snd_pcm_t *pcm_handle, unsigned int sample_rate) {
+    snd_pcm_sframes_t delay;
+    if (!sample_rate || snd_pcm_delay(pcm_handle, &delay) < 0)
+        return -1;
+    if (delay < 0)
+        delay = 0;
+    return (long)((long long)delay * 1000000 / sample_rate);
+}
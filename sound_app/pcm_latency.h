@@ -0,0 +1,67 @@
+#ifndef PCM_LATENCY_H
+#define PCM_LATENCY_H
+
+#include <alsa/asoundlib.h>
+
+/* 声卡延迟档位: period 取 Opus 帧长的整数分之一, buffer 取 period 的整数倍,
+ * 这样每次读写的数据正好拼成整帧, 帧边界和 period 边界对齐 */
+typedef enum pcm_latency_profile {
+    PCM_LATENCY_DEFAULT = 0,    /* 使用驱动默认的 period/buffer */
+    PCM_LATENCY_LOW,            /* period = 帧长/4, buffer = 3 个 period */
+    PCM_LATENCY_BALANCED,       /* period = 帧长/2, buffer = 4 个 period */
+    PCM_LATENCY_SAFE,           /* period = 帧长, buffer = 4 个 period, 适合调度不及时的系统 */
+} pcm_latency_profile;
+
+/**
+ * 获取延迟档位的名字
+ *
+ * @param profile 延迟档位
+ * @return 名字, 无效时返回 "unknown"
+ */
+const char *pcm_latency_profile_name(pcm_latency_profile profile);
+
+/**
+ * 按延迟档位设置 period 和 buffer 大小, 在设置了采样率之后、snd_pcm_hw_params 之前调用
+ * 采样率下帧长不能被整除时减小分母, 最差退到 period = 帧长
+ *
+ * @param pcm_handle PCM 设备
+ * @param hw_params 正在配置的硬件参数
+ * @param sample_rate 已经设置的采样率
+ * @param profile 延迟档位, PCM_LATENCY_DEFAULT 时什么也不做
+ * @param frame_ms Opus 帧长 (ms)
+ * @return 成功返回0，失败返回ALSA错误码 (硬件参数保持不变, 调用者可以继续使用驱动默认值)
+ */
+int pcm_latency_set_hw_params(snd_pcm_t *pcm_handle, snd_pcm_hw_params_t *hw_params, unsigned int sample_rate,
+                              pcm_latency_profile profile, unsigned int frame_ms);
+
+/**
+ * 设置软件参数, 在 snd_pcm_hw_params 之后调用
+ * avail_min 设为一个 period, 每个 period 唤醒一次; 播放时 start_threshold 也设为一个 period,
+ * 写入第一个 period 就开始播放, 不用等 buffer 写满
+ *
+ * @param pcm_handle PCM 设备
+ * @param playback 1: 播放, 0: 录音
+ * @return 成功返回0，失败返回ALSA错误码
+ */
+int pcm_latency_set_sw_params(snd_pcm_t *pcm_handle, int playback);
+
+/**
+ * 打印实际的 period/buffer 时长, 以及 period 是否整除帧长
+ *
+ * @param pcm_handle PCM 设备, 已经完成配置
+ * @param name 用于打印的名字
+ * @param frame_ms Opus 帧长 (ms)
+ */
+void pcm_latency_report(snd_pcm_t *pcm_handle, const char *name, unsigned int frame_ms);
+
+/**
+ * 用 snd_pcm_delay 获取当前的延迟
+ * 录音: 已经采集、还没有读走的数据时长; 播放: 已经写入、还没有从喇叭放出的数据时长
+ *
+ * @param pcm_handle PCM 设备
+ * @param sample_rate 采样率
+ * @return 延迟 (us), 出错时返回-1
+ */
+long pcm_latency_delay_us(snd_pcm_t *pcm_handle, unsigned int sample_rate);
+
+#endif // PCM_LATENCY_H
@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * 交错 S16 PCM 的声道转换: 立体声转单声道 / 单声道转立体声 / 立体声拆分与合并
+ * x86 上提供 SSE2/AVX2 实现并在运行时按 CPU 选择, ARM 上使用 NEON, 其他平台使用标量实现
+ */
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PCM_MIX_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PCM_MIX_NEON 1
+#endif
+
+#include "pcm_mix.h"
+
+// 标量实现, 同时作为 SIMD 实现处理尾部样本
+static void downmix_2to1_scalar(const int16_t *in, int16_t *out, int frames) {
+    for (int i = 0; i < frames; ++i) {
+        int32_t sum = in[2 * i] + in[2 * i + 1];
+        out[i] = (int16_t)(sum / 2);
+    }
+}
+
+static void upmix_1to2_scalar(const int16_t *in, int16_t *out, int frames) {
+    for (int i = 0; i < frames; ++i) {
+        out[2 * i] = in[i];
+        out[2 * i + 1] = in[i];
+    }
+}
+
+static void deinterleave_2_scalar(const int16_t *in, int16_t *left, int16_t *right, int frames) {
+    for (int i = 0; i < frames; ++i) {
+        left[i] = in[2 * i];
+        right[i] = in[2 * i + 1];
+    }
+}
+
+static void interleave_2_scalar(const int16_t *left, const int16_t *right, int16_t *out, int frames) {
+    for (int i = 0; i < frames; ++i) {
+        out[2 * i] = left[i];
+        out[2 * i + 1] = right[i];
+    }
+}
+
+#ifdef PCM_MIX_X86
+// (L + R) / 2 向零取整: 负数的和先加 1 再算术右移
+static inline __m128i avg_pairs_sse2(__m128i v) {
+    __m128i sum = _mm_madd_epi16(v, _mm_set1_epi16(1));
+    sum = _mm_add_epi32(sum, _mm_srli_epi32(sum, 31));
+    return _mm_srai_epi32(sum, 1);
+}
+
+static void downmix_2to1_sse2(const int16_t *in, int16_t *out, int frames) {
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(in + 2 * i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + 2 * i + 8));
+        __m128i r = _mm_packs_epi32(avg_pairs_sse2(a), avg_pairs_sse2(b));
+        _mm_storeu_si128((__m128i *)(out + i), r);
+    }
+    downmix_2to1_scalar(in + 2 * i, out + i, frames - i);
+}
+
+static void upmix_1to2_sse2(const int16_t *in, int16_t *out, int frames) {
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi16(v, v));
+        _mm_storeu_si128((__m128i *)(out + 2 * i + 8), _mm_unpackhi_epi16(v, v));
+    }
+    upmix_1to2_scalar(in + i, out + 2 * i, frames - i);
+}
+
+// 每个 32 位是一帧 (L 在低 16 位): 左移再算术右移取出 L, 直接算术右移取出 R, 都在 int16 范围内, packs 不会饱和
+static void deinterleave_2_sse2(const int16_t *in, int16_t *left, int16_t *right, int frames) {
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(in + 2 * i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + 2 * i + 8));
+        __m128i l = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+        __m128i r = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+        _mm_storeu_si128((__m128i *)(left + i), l);
+        _mm_storeu_si128((__m128i *)(right + i), r);
+    }
+    deinterleave_2_scalar(in + 2 * i, left + i, right + i, frames - i);
+}
+
+static void interleave_2_sse2(const int16_t *left, const int16_t *right, int16_t *out, int frames) {
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i l = _mm_loadu_si128((const __m128i *)(left + i));
+        __m128i r = _mm_loadu_si128((const __m128i *)(right + i));
+        _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128((__m128i *)(out + 2 * i + 8), _mm_unpackhi_epi16(l, r));
+    }
+    interleave_2_scalar(left + i, right + i, out + 2 * i, frames - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avg_pairs_avx2(__m256i v) {
+    __m256i sum = _mm256_madd_epi16(v, _mm256_set1_epi16(1));
+    sum = _mm256_add_epi32(sum, _mm256_srli_epi32(sum, 31));
+    return _mm256_srai_epi32(sum, 1);
+}
+
+__attribute__((target("avx2")))
+static void downmix_2to1_avx2(const int16_t *in, int16_t *out, int frames) {
+    int i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(in + 2 * i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(in + 2 * i + 16));
+        // packs 按 128 位通道交错, 需要再调整 64 位块的顺序
+        __m256i r = _mm256_packs_epi32(avg_pairs_avx2(a), avg_pairs_avx2(b));
+        r = _mm256_permute4x64_epi64(r, 0xD8);
+        _mm256_storeu_si256((__m256i *)(out + i), r);
+    }
+    downmix_2to1_sse2(in + 2 * i, out + i, frames - i);
+}
+
+__attribute__((target("avx2")))
+static void upmix_1to2_avx2(const int16_t *in, int16_t *out, int frames) {
+    int i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i lo = _mm256_unpacklo_epi16(v, v);
+        __m256i hi = _mm256_unpackhi_epi16(v, v);
+        _mm256_storeu_si256((__m256i *)(out + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + 2 * i + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    upmix_1to2_sse2(in + i, out + 2 * i, frames - i);
+}
+
+__attribute__((target("avx2")))
+static void deinterleave_2_avx2(const int16_t *in, int16_t *left, int16_t *right, int frames) {
+    int i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(in + 2 * i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(in + 2 * i + 16));
+        __m256i l = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16),
+                                       _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16));
+        __m256i r = _mm256_packs_epi32(_mm256_srai_epi32(a, 16), _mm256_srai_epi32(b, 16));
+        _mm256_storeu_si256((__m256i *)(left + i), _mm256_permute4x64_epi64(l, 0xD8));
+        _mm256_storeu_si256((__m256i *)(right + i), _mm256_permute4x64_epi64(r, 0xD8));
+    }
+    deinterleave_2_sse2(in + 2 * i, left + i, right + i, frames - i);
+}
+
+__attribute__((target("avx2")))
+static void interleave_2_avx2(const int16_t *left, const int16_t *right, int16_t *out, int frames) {
+    int i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        __m256i l = _mm256_loadu_si256((const __m256i *)(left + i));
+        __m256i r = _mm256_loadu_si256((const __m256i *)(right + i));
+        __m256i lo = _mm256_unpacklo_epi16(l, r);
+        __m256i hi = _mm256_unpackhi_epi16(l, r);
+        _mm256_storeu_si256((__m256i *)(out + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + 2 * i + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    interleave_2_sse2(left + i, right + i, out + 2 * i, frames - i);
+}
+#endif // PCM_MIX_X86
+
+#ifdef PCM_MIX_NEON
+static inline int32x4_t avg_neon(int32x4_t sum) {
+    int32x4_t sign = vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(sum), 31));
+    return vshrq_n_s32(vaddq_s32(sum, sign), 1);
+}
+
+static void downmix_2to1_neon(const int16_t *in, int16_t *out, int frames) {
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        int16x8x2_t lr = vld2q_s16(in + 2 * i);
+        int32x4_t lo = avg_neon(vaddl_s16(vget_low_s16(lr.val[0]), vget_low_s16(lr.val[1])));
+        int32x4_t hi = avg_neon(vaddl_s16(vget_high_s16(lr.val[0]), vget_high_s16(lr.val[1])));
+        vst1q_s16(out + i, vcombine_s16(vmovn_s32(lo), vmovn_s32(hi)));
+    }
+    downmix_2to1_scalar(in + 2 * i, out + i, frames - i);
+}
+
+static void upmix_1to2_neon(const int16_t *in, int16_t *out, int frames) {
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        int16x8x2_t lr;
+        lr.val[0] = vld1q_s16(in + i);
+        lr.val[1] = lr.val[0];
+        vst2q_s16(out + 2 * i, lr);
+    }
+    upmix_1to2_scalar(in + i, out + 2 * i, frames - i);
+}
+
+static void deinterleave_2_neon(const int16_t *in, int16_t *left, int16_t *right, int frames) {
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        int16x8x2_t lr = vld2q_s16(in + 2 * i);
+        vst1q_s16(left + i, lr.val[0]);
+        vst1q_s16(right + i, lr.val[1]);
+    }
+    deinterleave_2_scalar(in + 2 * i, left + i, right + i, frames - i);
+}
+
+static void interleave_2_neon(const int16_t *left, const int16_t *right, int16_t *out, int frames) {
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        int16x8x2_t lr;
+        lr.val[0] = vld1q_s16(left + i);
+        lr.val[1] = vld1q_s16(right + i);
+        vst2q_s16(out + 2 * i, lr);
+    }
+    interleave_2_scalar(left + i, right + i, out + 2 * i, frames - i);
+}
+#endif // PCM_MIX_NEON
+
+static const pcm_mix_kernel g_kernels[] = {
+    { "scalar", downmix_2to1_scalar, upmix_1to2_scalar, deinterleave_2_scalar, interleave_2_scalar },
+#ifdef PCM_MIX_X86
+    { "sse2",   downmix_2to1_sse2,   upmix_1to2_sse2,   deinterleave_2_sse2,   interleave_2_sse2 },
+    { "avx2",   downmix_2to1_avx2,   upmix_1to2_avx2,   deinterleave_2_avx2,   interleave_2_avx2 },
+#endif
+#ifdef PCM_MIX_NEON
+    { "neon",   downmix_2to1_neon,   upmix_1to2_neon,   deinterleave_2_neon,   interleave_2_neon },
+#endif
+};
+
+#define KERNEL_COUNT (sizeof(g_kernels) / sizeof(g_kernels[0]))
+
+static pcm_mix_kernel g_usable[KERNEL_COUNT];  // 按 CPU 能力筛选后的实现, 最后一个是最优实现
+
+static int detect_kernels(void) {
+    int n = 0;
+    for (unsigned int i = 0; i < KERNEL_COUNT; ++i) {
+#ifdef PCM_MIX_X86
+        if (g_kernels[i].downmix_2to1 == downmix_2to1_sse2 && !__builtin_cpu_supports("sse2"))
+            continue;
+        if (g_kernels[i].downmix_2to1 == downmix_2to1_avx2 && !__builtin_cpu_supports("avx2"))
+            continue;
+#endif
+        g_usable[n++] = g_kernels[i];
+    }
+    return n;
+}
+
+int pcm_mix_list_kernels(const pcm_mix_kernel **list) {
+    static int count = detect_kernels();  // 只检测一次, 线程安全
+    if (list)
+        *list = g_usable;
+    return count;
+}
+
+const pcm_mix_kernel *pcm_mix_active_kernel(void) {
+    const pcm_mix_kernel *list;
+    int n = pcm_mix_list_kernels(&list);
+    return &list[n - 1];
+}
+
+void pcm_downmix_2to1(const int16_t *in, int16_t *out, int frames) {
+    static pcm_downmix_2to1_t fn = pcm_mix_active_kernel()->downmix_2to1;
+    fn(in, out, frames);
+}
+
+void pcm_upmix_1to2(const int16_t *in, int16_t *out, int frames) {
+    static pcm_upmix_1to2_t fn = pcm_mix_active_kernel()->upmix_1to2;
+    fn(in, out, frames);
+}
+
+void pcm_deinterleave_2(const int16_t *in, int16_t *left, int16_t *right, int frames) {
+    static pcm_deinterleave_2_t fn = pcm_mix_active_kernel()->deinterleave_2;
+    fn(in, left, right, frames);
+}
+
+void pcm_interleave_2(const int16_t *left, const int16_t *right, int16_t *out, int frames) {
+    static pcm_interleave_2_t fn = pcm_mix_active_kernel()->interleave_2;
+    fn(left, right, out, frames);
+}
@@ -0,0 +1,76 @@
+#ifndef PCM_MIX_H
+#define PCM_MIX_H
+
+#include <stdint.h>
+
+/* 交错格式 S16 PCM 的声道转换函数 */
+typedef void (*pcm_downmix_2to1_t)(const int16_t *in, int16_t *out, int frames);
+typedef void (*pcm_upmix_1to2_t)(const int16_t *in, int16_t *out, int frames);
+typedef void (*pcm_deinterleave_2_t)(const int16_t *in, int16_t *left, int16_t *right, int frames);
+typedef void (*pcm_interleave_2_t)(const int16_t *left, const int16_t *right, int16_t *out, int frames);
+
+/**
+ * 一组声道转换实现 (scalar/sse2/avx2/neon)
+ */
+typedef struct pcm_mix_kernel {
+    const char *name;
+    pcm_downmix_2to1_t downmix_2to1;
+    pcm_upmix_1to2_t upmix_1to2;
+    pcm_deinterleave_2_t deinterleave_2;
+    pcm_interleave_2_t interleave_2;
+} pcm_mix_kernel;
+
+/**
+ * 立体声转单声道: out[i] = (L + R) / 2, 结果与逐样本整数除法完全一致
+ * 
+ * @param in 交错的立体声数据, frames * 2 个样本
+ * @param out 单声道输出, frames 个样本
+ * @param frames 帧数
+ */
+void pcm_downmix_2to1(const int16_t *in, int16_t *out, int frames);
+
+/**
+ * 单声道转立体声: 每个样本复制到左右声道
+ * 
+ * @param in 单声道数据, frames 个样本
+ * @param out 交错的立体声输出, frames * 2 个样本
+ * @param frames 帧数
+ */
+void pcm_upmix_1to2(const int16_t *in, int16_t *out, int frames);
+
+/**
+ * 立体声拆成左右两个单声道: left[i] = L, right[i] = R
+ * 
+ * @param in 交错的立体声数据, frames * 2 个样本
+ * @param left 左声道输出, frames 个样本
+ * @param right 右声道输出, frames 个样本
+ * @param frames 帧数
+ */
+void pcm_deinterleave_2(const int16_t *in, int16_t *left, int16_t *right, int frames);
+
+/**
+ * 左右两个单声道合成交错的立体声, pcm_deinterleave_2 的逆操作
+ * 
+ * @param left 左声道, frames 个样本
+ * @param right 右声道, frames 个样本
+ * @param out 交错的立体声输出, frames * 2 个样本
+ * @param frames 帧数
+ */
+void pcm_interleave_2(const int16_t *left, const int16_t *right, int16_t *out, int frames);
+
+/**
+ * 获取当前 CPU 上选中的实现
+ * 
+ * @return 实现描述, 在进程生命周期内有效
+ */
+const pcm_mix_kernel *pcm_mix_active_kernel(void);
+
+/**
+ * 列出当前 CPU 支持的所有实现, 供测试和性能对比使用
+ * 
+ * @param list 返回实现数组
+ * @return 数组中的实现个数, 第一个总是 scalar
+ */
+int pcm_mix_list_kernels(const pcm_mix_kernel **list);
+
+#endif // PCM_MIX_H
@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * 采集预处理: Speex 降噪 / 自动增益 / 语音检测, 立体声先用 pcm_mix 的 SIMD 实现拆成两个单声道分别处理
+ */
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <new>
+#include <vector>
+#include <speex/speex_preprocess.h>
+
+#include "pcm_mix.h"
+#include "pcm_preprocess.h"
+
+#define MAX_CHANNELS 2
+
+struct pcm_preprocess {
+    pcm_preprocess_config cfg;
+    pcm_preprocess_stats stats;
+    int channels;
+    int frameSize;                                   // 每帧每个声道的样本数
+    int fill;                                        // planes 中已经攒下的样本数
+    SpeexPreprocessState *states[MAX_CHANNELS];
+    std::vector<spx_int16_t> planes[MAX_CHANNELS];   // 每个声道一帧, Speex 在这里原地处理
+};
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static SpeexPreprocessState *create_state(const pcm_preprocess_config *cfg, int frameSize, int sampleRate) {
+    SpeexPreprocessState *st = speex_preprocess_state_init(frameSize, sampleRate);
+    if (!st)
+        return NULL;
+    spx_int32_t denoise = cfg->denoise;
+    spx_int32_t noiseSuppress = cfg->noise_suppress_db;
+    spx_int32_t agc = cfg->agc;
+    spx_int32_t agcTarget = cfg->agc_target;
+    spx_int32_t agcMaxGain = cfg->agc_max_gain_db;
+    spx_int32_t vad = cfg->vad;
+    spx_int32_t probStart = cfg->vad_prob_start;
+    spx_int32_t probContinue = cfg->vad_prob_continue;
+    speex_preprocess_ctl(st, SPEEX_PREPROCESS_SET_DENOISE, &denoise);
+    speex_preprocess_ctl(st, SPEEX_PREPROCESS_SET_NOISE_SUPPRESS, &noiseSuppress);
+    speex_preprocess_ctl(st, SPEEX_PREPROCESS_SET_AGC, &agc);
+    if (cfg->agc) {
+        speex_preprocess_ctl(st, SPEEX_PREPROCESS_SET_AGC_TARGET, &agcTarget);
+        speex_preprocess_ctl(st, SPEEX_PREPROCESS_SET_AGC_MAX_GAIN, &agcMaxGain);
+    }
+    speex_preprocess_ctl(st, SPEEX_PREPROCESS_SET_VAD, &vad);
+    if (cfg->vad) {
+        speex_preprocess_ctl(st, SPEEX_PREPROCESS_SET_PROB_START, &probStart);
+        speex_preprocess_ctl(st, SPEEX_PREPROCESS_SET_PROB_CONTINUE, &probContinue);
+    }
+    return st;
+}
+
+pcm_preprocess *create_pcm_preprocess(const pcm_preprocess_config *cfg, int sample_rate, int channels) {
+    if (!cfg || channels < 1 || channels > MAX_CHANNELS || sample_rate <= 0 ||
+        (cfg->frame_ms != 10 && cfg->frame_ms != 20))
+        return NULL;
+    pcm_preprocess *pp = new (std::nothrow) pcm_preprocess();
+    if (!pp)
+        return NULL;
+    pp->cfg = *cfg;
+    pp->channels = channels;
+    pp->frameSize = sample_rate * (int)cfg->frame_ms / 1000;
+    pp->stats.frame_us = cfg->frame_ms * 1000;
+    for (int c = 0; c < channels; c++) {
+        pp->planes[c].assign(pp->frameSize, 0);
+        pp->states[c] = create_state(cfg, pp->frameSize, sample_rate);
+        if (!pp->states[c]) {
+            destroy_pcm_preprocess(pp);
+            return NULL;
+        }
+    }
+    return pp;
+}
+
+void destroy_pcm_preprocess(pcm_preprocess *pp) {
+    if (!pp)
+        return;
+    for (int c = 0; c < pp->channels; c++) {
+        if (pp->states[c])
+            speex_preprocess_state_destroy(pp->states[c]);
+    }
+    delete pp;
+}
+
+int pcm_preprocess_frame_size(pcm_preprocess *pp) {
+    return pp->frameSize;
+}
+
+// 把 n 帧交错数据拆到各声道的 planes 末尾
+static void split(pcm_preprocess *pp, const int16_t *in, int n) {
+    if (pp->channels == 2)
+        pcm_deinterleave_2(in, &pp->planes[0][pp->fill], &pp->planes[1][pp->fill], n);
+    else
+        memcpy(&pp->planes[0][pp->fill], in, n * sizeof(int16_t));
+    pp->fill += n;
+}
+
+static void merge(pcm_preprocess *pp, int16_t *out) {
+    if (pp->channels == 2)
+        pcm_interleave_2(pp->planes[0].data(), pp->planes[1].data(), out, pp->frameSize);
+    else
+        memcpy(out, pp->planes[0].data(), pp->frameSize * sizeof(int16_t));
+}
+
+int pcm_preprocess_process(pcm_preprocess *pp, const int16_t *in, int frames, int16_t *out) {
+    int produced = 0;
+    while (frames > 0) {
+        uint64_t start = thread_cpu_ns();
+        int n = pp->frameSize - pp->fill;
+        if (n > frames)
+            n = frames;
+        split(pp, in, n);
+        in += n * pp->channels;
+        frames -= n;
+        if (pp->fill < pp->frameSize) {
+            pp->stats.cpu_ns += thread_cpu_ns() - start;
+            break;
+        }
+
+        // 没有打开 VAD 时 speex_preprocess_run 总是返回1
+        int voiced = 0;
+        for (int c = 0; c < pp->channels; c++)
+            voiced |= speex_preprocess_run(pp->states[c], pp->planes[c].data());
+        merge(pp, out + produced * pp->channels);
+        produced += pp->frameSize;
+        pp->fill = 0;
+
+        uint64_t cost = thread_cpu_ns() - start;
+        pp->stats.frames++;
+        pp->stats.voiced = pp->cfg.vad && voiced;
+        if (pp->stats.voiced)
+            pp->stats.voiced_frames++;
+        pp->stats.cpu_ns += cost;
+        if (cost > pp->stats.max_cpu_ns)
+            pp->stats.max_cpu_ns = (uint32_t)cost;
+    }
+    return produced;
+}
+
+void pcm_preprocess_get_stats(pcm_preprocess *pp, pcm_preprocess_stats *stats) {
+    *stats = pp->stats;
+}
+
+#ifdef TEST
+/* 测试: make pcm_preprocess_test, 在目标板上运行, 确认每帧的 CPU 占用在预算之内
+ * 用法: ./pcm_preprocess_test [秒数]
+ * 输入为交替的 1s 噪声和 1s 噪声加语音频段的音调, 录音 period 取 10ms, 依次测试各种组合:
+ * 采样率 16k/48k, 单/双声道, 只降噪 / 降噪+AGC / 降噪+AGC+VAD; 另外用 7ms 的 period 检查输出帧数和数据不丢
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+static std::vector<int16_t> make_input(int rate, int channels, int seconds) {
+    std::vector<int16_t> pcm((size_t)rate * channels * seconds);
+    unsigned seed = 1;
+    for (size_t i = 0; i < pcm.size() / channels; i++) {
+        double t = (double)i / rate;
+        double noise = ((int)(rand_r(&seed) % 2001) - 1000) * 0.3;
+        double tone = ((int)t % 2) ? 4000 * sin(2 * M_PI * 300 * t) * (0.6 + 0.4 * sin(2 * M_PI * 4 * t)) : 0;
+        for (int c = 0; c < channels; c++)
+            pcm[i * channels + c] = (int16_t)(noise + tone);
+    }
+    return pcm;
+}
+
+static int run(int rate, int channels, int agc, int vad, int seconds) {
+    pcm_preprocess_config cfg = { 1, -15, agc, 8000, 20, vad, 85, 65, 10 };
+    pcm_preprocess *pp = create_pcm_preprocess(&cfg, rate, channels);
+    if (!pp) {
+        printf("failed to create preprocess for %d Hz %d ch\n", rate, channels);
+        return 1;
+    }
+    std::vector<int16_t> in = make_input(rate, channels, seconds);
+    int period = rate / 100;
+    std::vector<int16_t> out((period + pcm_preprocess_frame_size(pp)) * channels);
+    long total = 0;
+    for (size_t pos = 0; pos + period * channels <= in.size(); pos += period * channels)
+        total += pcm_preprocess_process(pp, &in[pos], period, out.data());
+
+    pcm_preprocess_stats st;
+    pcm_preprocess_get_stats(pp, &st);
+    double avg_us = st.frames ? st.cpu_ns / 1000.0 / st.frames : 0;
+    printf("%5d Hz %d ch %-16s frames %5lu, voiced %5lu, cpu avg %7.1f us, max %7.1f us per %u ms frame (%.2f%%)\n",
+           rate, channels, vad ? "denoise+agc+vad" : agc ? "denoise+agc" : "denoise", st.frames, st.voiced_frames,
+           avg_us, st.max_cpu_ns / 1000.0, st.frame_us / 1000, avg_us * 100 / st.frame_us);
+    destroy_pcm_preprocess(pp);
+    return total == (long)in.size() / channels ? 0 : 1;
+}
+
+// period 不是帧长的整数倍时剩下的样本留到下一次, 总的输出帧数只少最后不满一帧的部分
+static int run_unaligned(void) {
+    pcm_preprocess_config cfg = { 0, -15, 0, 8000, 20, 0, 85, 65, 10 };
+    const int rate = 16000, channels = 2, period = 112;    // 7ms
+    pcm_preprocess *pp = create_pcm_preprocess(&cfg, rate, channels);
+    if (!pp)
+        return 1;
+    std::vector<int16_t> in = make_input(rate, channels, 1);
+    std::vector<int16_t> out((period + pcm_preprocess_frame_size(pp)) * channels);
+    long total = 0, expect = 0;
+    for (size_t pos = 0; pos + period * channels <= in.size(); pos += period * channels) {
+        total += pcm_preprocess_process(pp, &in[pos], period, out.data());
+        expect += period;
+    }
+    expect -= expect % pcm_preprocess_frame_size(pp);
+    printf("unaligned 7 ms period: output %ld frames, expect %ld\n", total, expect);
+    destroy_pcm_preprocess(pp);
+    return total == expect ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 10;
+    int failed = 0;
+    printf("pcm_mix kernel: %s\n", pcm_mix_active_kernel()->name);
+    const int rates[] = { 16000, 48000 };
+    for (int r = 0; r < 2; r++) {
+        for (int channels = 1; channels <= 2; channels++) {
+            failed += run(rates[r], channels, 0, 0, seconds);
+            failed += run(rates[r], channels, 1, 0, seconds);
+            failed += run(rates[r], channels, 1, 1, seconds);
+        }
+    }
+    failed += run_unaligned();
+    printf("%s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
+#endif
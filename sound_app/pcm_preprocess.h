@@ -0,0 +1,72 @@
+#ifndef PCM_PREPROCESS_H
+#define PCM_PREPROCESS_H
+
+#include <stdint.h>
+
+/* 采集预处理: 用 Speex 对每个声道做降噪、自动增益 (AGC) 和语音检测 (VAD)
+ * Speex 每次处理固定长度的一帧, 输入不是整帧时剩下的样本留到下一次, 输出总是整帧;
+ * 录音的 period 是帧长的整数倍时不会增加延迟
+ */
+
+typedef struct pcm_preprocess_config {
+    int denoise;              /* 1: 降噪 */
+    int noise_suppress_db;    /* 噪声的最大衰减 (dB), 负数 */
+    int agc;                  /* 1: 自动增益; 定点编译的 speexdsp 不支持, 打开也没有效果 */
+    int agc_target;           /* AGC 目标电平 (样本幅度) */
+    int agc_max_gain_db;      /* AGC 最大增益 (dB) */
+    int vad;                  /* 1: 语音检测 */
+    int vad_prob_start;       /* 从静音进入人声的概率阈值 (%) */
+    int vad_prob_continue;    /* 保持人声的概率阈值 (%) */
+    unsigned int frame_ms;    /* Speex 帧长 (ms), 10 或 20 */
+} pcm_preprocess_config;
+
+typedef struct pcm_preprocess_stats {
+    unsigned long frames;     /* 处理的帧数, 各声道一起算一帧 */
+    unsigned long voiced_frames; /* VAD 判断为人声的帧数, 任一声道有人声即算 */
+    int voiced;               /* 最近一帧是否有人声 */
+    unsigned int frame_us;    /* 一帧的时长 (us), 每帧的处理时间要远小于它 */
+    uint64_t cpu_ns;          /* 累计占用的 CPU 时间 (ns), 包括拆分/合并声道 */
+    uint32_t max_cpu_ns;      /* 处理一帧占用 CPU 时间的最大值 (ns) */
+} pcm_preprocess_stats;
+
+typedef struct pcm_preprocess pcm_preprocess;
+
+/**
+ * 创建预处理器
+ *
+ * @param cfg 配置, 会被复制
+ * @param sample_rate 采样率
+ * @param channels 声道数, 1 或 2
+ * @return 成功返回实例，失败返回NULL
+ */
+pcm_preprocess *create_pcm_preprocess(const pcm_preprocess_config *cfg, int sample_rate, int channels);
+
+/**
+ * 销毁预处理器
+ *
+ * @param pp 实例，可以为NULL
+ */
+void destroy_pcm_preprocess(pcm_preprocess *pp);
+
+/**
+ * 获取每帧的样本数 (每个声道)
+ */
+int pcm_preprocess_frame_size(pcm_preprocess *pp);
+
+/**
+ * 处理一段交错的 S16 数据, 输出凑满的整帧
+ *
+ * @param pp 实例
+ * @param in 输入数据
+ * @param frames 输入的帧数 (每个声道的样本数)
+ * @param out 输出数据, 至少能容纳 frames + pcm_preprocess_frame_size() 帧, 不能与 in 重叠
+ * @return 输出的帧数, 是帧长的整数倍
+ */
+int pcm_preprocess_process(pcm_preprocess *pp, const int16_t *in, int frames, int16_t *out);
+
+/**
+ * 获取统计信息
+ */
+void pcm_preprocess_get_stats(pcm_preprocess *pp, pcm_preprocess_stats *stats);
+
+#endif // PCM_PREPROCESS_H
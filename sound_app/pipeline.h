@@ -0,0 +1,80 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* 流水线各级线程的公共部分: 创建线程 (实时调度、预分配栈、绑定 CPU)、锁定内存, 以及每一级的延迟统计
+ * 各级之间用 spsc_ring 连接, 每一级只有一个线程写自己的统计, 其他线程读到的值可能稍旧 */
+
+/* 音频线程的调度策略, 各项都可以不用 */
+typedef struct pipeline_thread_policy {
+    int cpu;                      /* 绑定的 CPU, -1 表示不绑定 */
+    int rt_priority;              /* SCHED_FIFO 优先级 (1~99), 0 表示普通调度; 没有权限时退回普通调度 */
+    size_t stack_size;            /* 线程栈大小, 创建前分配好并逐页写入, 运行中不会因为缺页而停顿; 0 表示系统默认 */
+} pipeline_thread_policy;
+
+typedef struct pipeline_stage_stats {
+    unsigned long items;          /* 处理的数据块数 */
+    unsigned long drops;          /* 下一级队列满而丢弃的数据块数 */
+    uint64_t wait_us;             /* 累计在队列中等待的时间 (us) */
+    uint64_t busy_us;             /* 累计处理时间 (us) */
+    uint32_t max_wait_us;         /* 最长的一次等待 (us) */
+    uint32_t max_busy_us;         /* 最长的一次处理 (us) */
+} pipeline_stage_stats;
+
+/**
+ * 获取单调时钟 (us)
+ */
+int64_t pipeline_now_us(void);
+
+/**
+ * 按调度策略创建线程
+ *
+ * @param tid 返回线程ID
+ * @param name 线程名, 便于用 top -H 查看各级的 CPU 占用, 最长15个字符
+ * @param policy 调度策略, NULL 表示使用系统默认
+ * @param fn 线程函数
+ * @param arg 传给线程函数的参数
+ * @return 成功返回0，失败返回-1
+ */
+int pipeline_start_thread(pthread_t *tid, const char *name, const pipeline_thread_policy *policy,
+                          void *(*fn)(void *), void *arg);
+
+/**
+ * 锁定进程的内存, 避免音频线程因为换页而停顿, 需要在创建音频线程之前调用
+ * 同时关闭 malloc 的内存归还, 并预先分配、写入一块堆内存, 之后的 malloc 直接使用这些已经在内存中的页
+ *
+ * @param heap_reserve 预先写入的堆内存大小 (字节), 0 表示不预分配
+ * @return 成功返回0，没有权限或超出 RLIMIT_MEMLOCK 时返回-1 (程序照常运行)
+ */
+int pipeline_lock_memory(size_t heap_reserve);
+
+/**
+ * 把已经存在的线程绑定到 CPU 上, 用于不是由 pipeline_start_thread 创建的线程
+ *
+ * @param tid 线程ID
+ * @param cpu 绑定的 CPU, -1 表示不绑定
+ * @return 成功返回0，失败返回-1
+ */
+int pipeline_set_thread_cpu(pthread_t tid, int cpu);
+
+/**
+ * 记录一个数据块的等待时间和处理时间
+ *
+ * @param st 这一级的统计
+ * @param wait_us 在队列中等待的时间 (us)
+ * @param busy_us 处理时间 (us)
+ */
+void pipeline_stage_record(pipeline_stage_stats *st, int64_t wait_us, int64_t busy_us);
+
+/**
+ * 打印一级的统计: 数据块数、丢弃数、平均/最长等待和处理时间
+ *
+ * @param name 这一级的名字
+ * @param st 这一级的统计
+ */
+void pipeline_stage_print(const char *name, const pipeline_stage_stats *st);
+
+#endif // PIPELINE_H
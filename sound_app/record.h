@@ -3,9 +3,27 @@
 
 #include <stddef.h> // For size_t
 
+#include "audio_dev.h"
+#include "pcm_aec.h"
+#include "pcm_latency.h"
+#include "pcm_preprocess.h"
+#include "pipeline.h"
+
 // Define the callback function type
+// mmap 方式下 buffer 直接指向声卡的 DMA 区, 回调返回后就会交还给驱动, 回调里要把数据取走
 typedef void (*audio_record_callback_t)(unsigned char *buffer, size_t size, void *user_data);
 
+/* 录音线程的运行统计 */
+typedef struct record_stats {
+    int mmap;                       /* 1: 声卡使用 mmap 方式, 0: readi 方式或不是声卡 */
+    unsigned long periods;          /* 交给回调的数据块数 */
+    unsigned long overruns;         /* 录音溢出 (来不及读取, 驱动丢弃了数据) 的次数 */
+    unsigned long copied_bytes;     /* 交给回调之前拷贝的字节数, readi 方式下就是从 DMA 区拷到缓冲区的数据量, WAV 文件是读文件的数据量 */
+    long delay_us;                  /* 最近一次的采集到回调延迟: 交给回调的这块数据中最早的采样到现在的时长 */
+    long max_delay_us;              /* 采集到回调延迟的最大值 */
+    long cpu_us;                    /* 录音线程 (包括回调) 累计占用的 CPU 时间 */
+} record_stats;
+
 /**
  * 创建一个用于录音的线程
  * 
@@ -18,6 +36,38 @@ typedef void (*audio_record_callback_t)(unsigned char *buffer, size_t size, void
  */
 pthread_t create_record_thread(audio_record_callback_t cb, void *user_data);
 
+/**
+ * 设置录音的延迟档位, 需要在 create_record_thread 之前调用
+ * period 取编码帧长的整数分之一, 每次回调的数据正好拼成整帧, 采集到编码之间没有额外的等待
+ * 
+ * @param profile 延迟档位, PCM_LATENCY_DEFAULT 表示使用驱动默认值
+ * @param frame_ms 编码帧长（毫秒）
+ */
+void set_record_latency(pcm_latency_profile profile, unsigned int frame_ms);
+
+/**
+ * 设置录音线程的调度策略 (实时优先级、CPU 绑定、预分配的栈), 需要在 create_record_thread 之前调用
+ * 
+ * @param policy 调度策略, 会被复制; NULL 表示使用系统默认
+ */
+void set_record_thread_policy(const pipeline_thread_policy *policy);
+
+/**
+ * 设置录音设备, 需要在 create_record_thread 之前调用
+ * 设备可以是声卡, 也可以是 WAV 文件、null 或 loopback, 用于在没有声卡的机器上运行
+ * 
+ * @param dev 录音设备, 由调用者创建和销毁; NULL 表示使用 ALSA "default"
+ */
+void set_record_device(p_audio_dev_t dev);
+
+/**
+ * 设置是否使用 mmap 方式录音, 需要在 create_record_thread 之前调用
+ * mmap 方式下回调直接拿到声卡 DMA 区的数据, 省去 readi 的一次拷贝; 声卡不支持时自动改用 readi
+ * 
+ * @param enable 1: 优先使用 mmap, 0: 使用 readi
+ */
+void set_record_mmap(int enable);
+
 /**
  * 获取实际录音设置
  * 
@@ -30,5 +80,45 @@ pthread_t create_record_thread(audio_record_callback_t cb, void *user_data);
  */
 void get_actual_record_settings(unsigned int *sample_rate, unsigned int *channels, snd_pcm_format_t *format);
 
+/**
+ * 设置采集预处理 (Speex 降噪、AGC、VAD), 需要在 create_record_thread 之前调用
+ * 在录音线程中按 Speex 帧处理后再交给回调; 录音的 period 是 Speex 帧长的整数倍时不增加延迟
+ * 
+ * @param cfg 预处理配置, 会被复制; NULL 表示不做预处理
+ */
+void set_record_preprocess(const pcm_preprocess_config *cfg);
+
+/**
+ * 获取采集预处理的统计, 包括每帧占用的 CPU 时间
+ * 
+ * @param stats 用于存储统计信息
+ * @return 成功返回0, 没有做预处理时返回-1
+ */
+int get_record_preprocess_stats(pcm_preprocess_stats *stats);
+
+/**
+ * 设置回声消除, 需要在 create_record_thread 之前调用
+ * 以播放线程保存的 PCM 为参考, 在预处理之前消除回声; 录音与播放的采样率不同时不做回声消除
+ * 
+ * @param cfg 回声消除配置, 会被复制; NULL 表示不做回声消除
+ * @param ref 远端参考, 同一个实例要交给 set_play_echo_ref
+ */
+void set_record_aec(const pcm_aec_config *cfg, echo_ref *ref);
+
+/**
+ * 获取回声消除的统计, 包括 ERLE 和每帧占用的 CPU 时间
+ * 
+ * @param stats 用于存储统计信息
+ * @return 成功返回0, 没有做回声消除时返回-1
+ */
+int get_record_aec_stats(pcm_aec_stats *stats);
+
+/**
+ * 获取录音线程的运行统计
+ * 
+ * @param stats 用于存储统计信息
+ */
+void get_record_stats(record_stats *stats);
+
 
 #endif // RECORD_H
\ No newline at end of file
@@ -0,0 +1,566 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * 固定比例多相 FIR 重采样: 48k<->16k (3:1), 44.1k<->16k (441:160), 单声道 S16
+ * 原型滤波器为 Kaiser 窗 sinc, 系数表在编译期用 constexpr 生成, 内积在 x86 上用 SSE2/AVX2, ARM 上用 NEON
+ */
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <new>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLER_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RESAMPLER_NEON 1
+#endif
+
+#include "resampler.h"
+
+// 通带截止频率为低采样率奈奎斯特频率的 0.9 倍, Kaiser beta 对应约 80dB 阻带衰减
+#define RESAMPLER_ROLLOFF  0.90
+#define RESAMPLER_BETA     7.857
+// 按低采样率计算每个输出点约 96 个有效抽头, 过渡带约 800Hz; 抽头数取 16 的倍数方便 SIMD
+#define TAPS_UP_3          96
+#define TAPS_DOWN_3        288
+#define TAPS_UP_441        96
+#define TAPS_DOWN_441      272
+
+#define RESAMPLER_BLOCK    1024   // 每次搬入内部缓冲区的最大输入样本数
+
+/* ---------------- 编译期生成滤波器系数 ---------------- */
+
+static constexpr double CX_PI = 3.14159265358979323846;
+
+static constexpr double cx_sin(double x) {
+    // 先规约到 [-pi, pi], 再用泰勒级数
+    double k = x / (2 * CX_PI);
+    long long n = (long long)(k >= 0 ? k + 0.5 : k - 0.5);
+    x -= n * 2 * CX_PI;
+    double x2 = x * x, term = x, sum = x;
+    for (int i = 1; i < 14; ++i) {
+        term *= -x2 / ((2 * i) * (2 * i + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+// 第一类零阶修正贝塞尔函数, 参数直接给 x*x, 省掉 Kaiser 窗里的开方
+static constexpr double cx_bessel_i0_sq(double x2) {
+    double sum = 1, term = 1, q = x2 / 4;
+    for (int k = 1; k < 60; ++k) {
+        term *= q / ((double)k * k);
+        sum += term;
+        if (term < sum * 1e-10)
+            break;
+    }
+    return sum;
+}
+
+/* 多相系数表: coef[p] 是第 p 个相位的子滤波器, 已按时间倒序排列,
+ * 和输入窗口 x[base - TAPS + 1 .. base] 直接做内积
+ */
+template <int L, int M, int TAPS>
+struct poly_table {
+    int16_t coef[L][TAPS];
+};
+
+template <int L, int M, int TAPS>
+static constexpr poly_table<L, M, TAPS> make_poly_table() {
+    poly_table<L, M, TAPS> t{};
+    const int N = L * TAPS;
+    const double fc = 0.5 / (L > M ? L : M) * RESAMPLER_ROLLOFF;  // 相对上采样后的采样率
+    const double c = (N - 1) / 2.0;
+    const double beta2 = RESAMPLER_BETA * RESAMPLER_BETA;
+    const double i0beta = cx_bessel_i0_sq(beta2);
+
+    // 原型滤波器对称, 只算前一半; sin(w*(n-c)) 用旋转递推, 避免每个点都展开级数
+    double proto[N] = {};
+    const double w = 2 * CX_PI * fc;
+    const double sw = cx_sin(w), cw = cx_sin(w + CX_PI / 2);
+    double sn = cx_sin(-w * c), cn = cx_sin(-w * c + CX_PI / 2);
+    for (int n = 0; n < (N + 1) / 2; ++n) {
+        double x = n - c;
+        double r = x / (c + 1);
+        double win = cx_bessel_i0_sq(beta2 * (1 - r * r)) / i0beta;
+        double s = (x == 0) ? 2 * fc : sn / (CX_PI * x);
+        proto[n] = proto[N - 1 - n] = s * win;
+        double next = sn * cw + cn * sw;
+        cn = cn * cw - sn * sw;
+        sn = next;
+    }
+
+    for (int p = 0; p < L; ++p) {
+        double sum = 0;
+        for (int k = 0; k < TAPS; ++k)
+            sum += proto[p + k * L];
+        // 每个相位单独归一化, 保证直流增益为 1; 系数按时间倒序存放
+        for (int k = 0; k < TAPS; ++k) {
+            double v = proto[p + (TAPS - 1 - k) * L] / sum * 32768.0;
+            long q = (long)(v >= 0 ? v + 0.5 : v - 0.5);
+            if (q > 32767) q = 32767;
+            if (q < -32768) q = -32768;
+            t.coef[p][k] = (int16_t)q;
+        }
+    }
+    return t;
+}
+
+static constexpr poly_table<1, 3, TAPS_DOWN_3>       g_48k_to_16k   = make_poly_table<1, 3, TAPS_DOWN_3>();
+static constexpr poly_table<3, 1, TAPS_UP_3>         g_16k_to_48k   = make_poly_table<3, 1, TAPS_UP_3>();
+static constexpr poly_table<160, 441, TAPS_DOWN_441> g_44k1_to_16k  = make_poly_table<160, 441, TAPS_DOWN_441>();
+static constexpr poly_table<441, 160, TAPS_UP_441>   g_16k_to_44k1  = make_poly_table<441, 160, TAPS_UP_441>();
+
+typedef struct resampler_ratio {
+    int inRate;
+    int outRate;
+    int L;              // 上采样倍数
+    int M;              // 下采样倍数
+    int taps;           // 每个相位的抽头数
+    const int16_t *coef;
+} resampler_ratio;
+
+static const resampler_ratio g_ratios[] = {
+    { 48000, 16000, 1,   3,   TAPS_DOWN_3,   &g_48k_to_16k.coef[0][0] },
+    { 16000, 48000, 3,   1,   TAPS_UP_3,     &g_16k_to_48k.coef[0][0] },
+    { 44100, 16000, 160, 441, TAPS_DOWN_441, &g_44k1_to_16k.coef[0][0] },
+    { 16000, 44100, 441, 160, TAPS_UP_441,   &g_16k_to_44k1.coef[0][0] },
+};
+
+/* ---------------- 内积 ---------------- */
+
+/* 每个相位系数绝对值之和约为 75k~80k, 满幅输入和系数同号时内积约 2.5e9, 超出 int32, 所以累加用 int64
+ * SIMD 中 16 位乘积成对相加 (madd) 的结果还是 int32: 系数没有 -32768 时 |a0*b0 + a1*b1| <= 32768*65534, 不会溢出
+ */
+template <int L, int M, int TAPS>
+static constexpr bool poly_table_madd_safe(const poly_table<L, M, TAPS> &t) {
+    for (int p = 0; p < L; ++p)
+        for (int k = 0; k < TAPS; ++k)
+            if (t.coef[p][k] == -32768)
+                return false;
+    return true;
+}
+static_assert(poly_table_madd_safe(g_48k_to_16k) && poly_table_madd_safe(g_16k_to_48k) &&
+              poly_table_madd_safe(g_44k1_to_16k) && poly_table_madd_safe(g_16k_to_44k1),
+              "coefficient -32768 can overflow the int32 pair sums");
+
+typedef int64_t (*dot_fn_t)(const int16_t *a, const int16_t *b, int n);
+
+// n 必须是 16 的倍数
+static int64_t dot_scalar(const int16_t *a, const int16_t *b, int n) {
+    int64_t sum = 0;
+    for (int i = 0; i < n; ++i)
+        sum += (int32_t)a[i] * b[i];
+    return sum;
+}
+
+#ifdef RESAMPLER_X86
+// SSE2 没有 32 位到 64 位的符号扩展, 和符号位交织得到两个 int64
+static inline __m128i add_epi32_to_epi64(__m128i acc, __m128i v) {
+    __m128i sign = _mm_srai_epi32(v, 31);
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, sign));
+    return _mm_add_epi64(acc, _mm_unpackhi_epi32(v, sign));
+}
+
+static int64_t dot_sse2(const int16_t *a, const int16_t *b, int n) {
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    for (int i = 0; i < n; i += 16) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(a + i + 8));
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(b + i + 8));
+        acc0 = add_epi32_to_epi64(acc0, _mm_madd_epi16(a0, b0));
+        acc1 = add_epi32_to_epi64(acc1, _mm_madd_epi16(a1, b1));
+    }
+    __m128i acc = _mm_add_epi64(acc0, acc1);
+    acc = _mm_add_epi64(acc, _mm_shuffle_epi32(acc, 0x4E));
+    int64_t sum;
+    _mm_storel_epi64((__m128i *)&sum, acc);
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static int64_t dot_avx2(const int16_t *a, const int16_t *b, int n) {
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    for (int i = 0; i < n; i += 16) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i m = _mm256_madd_epi16(va, vb);
+        acc0 = _mm256_add_epi64(acc0, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(m)));
+        acc1 = _mm256_add_epi64(acc1, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(m, 1)));
+    }
+    __m256i acc = _mm256_add_epi64(acc0, acc1);
+    __m128i s = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi64(s, _mm_shuffle_epi32(s, 0x4E));
+    int64_t sum;
+    _mm_storel_epi64((__m128i *)&sum, s);
+    return sum;
+}
+#endif // RESAMPLER_X86
+
+#ifdef RESAMPLER_NEON
+// 单个 16 位乘积不会超出 int32, 成对相加时用 vpadal 扩展到 int64
+static int64_t dot_neon(const int16_t *a, const int16_t *b, int n) {
+    int64x2_t acc0 = vdupq_n_s64(0);
+    int64x2_t acc1 = vdupq_n_s64(0);
+    for (int i = 0; i < n; i += 8) {
+        int16x8_t va = vld1q_s16(a + i);
+        int16x8_t vb = vld1q_s16(b + i);
+        acc0 = vpadalq_s32(acc0, vmull_s16(vget_low_s16(va), vget_low_s16(vb)));
+        acc1 = vpadalq_s32(acc1, vmull_s16(vget_high_s16(va), vget_high_s16(vb)));
+    }
+    int64x2_t acc = vaddq_s64(acc0, acc1);
+    return vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1);
+}
+#endif // RESAMPLER_NEON
+
+typedef struct dot_kernel {
+    const char *name;
+    dot_fn_t fn;
+} dot_kernel;
+
+static const dot_kernel *active_dot_kernel(void) {
+    static const dot_kernel kernels[] = {
+        { "scalar", dot_scalar },
+#ifdef RESAMPLER_X86
+        { "sse2",   dot_sse2 },
+        { "avx2",   dot_avx2 },
+#endif
+#ifdef RESAMPLER_NEON
+        { "neon",   dot_neon },
+#endif
+    };
+    static const dot_kernel *best = [] {
+        const dot_kernel *k = &kernels[0];
+#ifdef RESAMPLER_X86
+        if (__builtin_cpu_supports("sse2"))
+            k = &kernels[1];
+        if (__builtin_cpu_supports("avx2"))
+            k = &kernels[2];
+#endif
+#ifdef RESAMPLER_NEON
+        k = &kernels[1];
+#endif
+        return k;
+    }();
+    return best;
+}
+
+/* ---------------- 流式处理 ---------------- */
+
+struct fixed_resampler {
+    const resampler_ratio *ratio;
+    dot_fn_t dot;
+    int phase;                   // 下一个输出点对应的相位
+    int base;                    // 下一个输出点窗口中最新的输入样本在 buf 中的位置
+    int filled;                  // buf 中有效样本数
+    std::vector<int16_t> buf;    // 前 taps-1 个是历史样本
+};
+
+static const resampler_ratio *find_ratio(int inRate, int outRate) {
+    for (unsigned int i = 0; i < sizeof(g_ratios) / sizeof(g_ratios[0]); ++i) {
+        if (g_ratios[i].inRate == inRate && g_ratios[i].outRate == outRate)
+            return &g_ratios[i];
+    }
+    return NULL;
+}
+
+int fixed_resampler_supported(int inRate, int outRate) {
+    return find_ratio(inRate, outRate) != NULL;
+}
+
+fixed_resampler *create_fixed_resampler(int inRate, int outRate) {
+    const resampler_ratio *ratio = find_ratio(inRate, outRate);
+    if (!ratio)
+        return NULL;
+
+    fixed_resampler *rs = new (std::nothrow) fixed_resampler();
+    if (!rs)
+        return NULL;
+    rs->ratio = ratio;
+    rs->dot = active_dot_kernel()->fn;
+    try {
+        rs->buf.resize(ratio->taps - 1 + RESAMPLER_BLOCK);
+    } catch (const std::bad_alloc &) {
+        delete rs;
+        return NULL;
+    }
+    fixed_resampler_reset(rs);
+    return rs;
+}
+
+void destroy_fixed_resampler(fixed_resampler *rs) {
+    delete rs;
+}
+
+void fixed_resampler_reset(fixed_resampler *rs) {
+    std::fill(rs->buf.begin(), rs->buf.end(), 0);
+    rs->phase = 0;
+    rs->base = rs->ratio->taps - 1;
+    rs->filled = rs->ratio->taps - 1;
+}
+
+int fixed_resampler_latency(fixed_resampler *rs) {
+    const resampler_ratio *r = rs->ratio;
+    return (r->L * r->taps - 1) / 2 / r->M;
+}
+
+const char *fixed_resampler_kernel_name(void) {
+    return active_dot_kernel()->name;
+}
+
+int fixed_resampler_process(fixed_resampler *rs, const int16_t *in, int inLen, int16_t *out, int outMax) {
+    const resampler_ratio *r = rs->ratio;
+    const int keep = r->taps - 1;
+    int16_t *buf = rs->buf.data();
+    int produced = 0;
+
+    while (inLen > 0) {
+        int n = (int)rs->buf.size() - rs->filled;
+        if (n > inLen)
+            n = inLen;
+        memcpy(buf + rs->filled, in, n * sizeof(int16_t));
+        rs->filled += n;
+        in += n;
+        inLen -= n;
+
+        while (rs->base < rs->filled) {
+            if (produced >= outMax)
+                return -1;
+            const int16_t *h = r->coef + rs->phase * r->taps;
+            int64_t acc = rs->dot(h, buf + rs->base - keep, r->taps);
+            acc = (acc + (1 << 14)) >> 15;
+            if (acc > 32767) acc = 32767;
+            if (acc < -32768) acc = -32768;
+            out[produced++] = (int16_t)acc;
+
+            rs->phase += r->M;
+            rs->base += rs->phase / r->L;
+            rs->phase %= r->L;
+        }
+
+        // 保留下一个输出点需要的历史样本
+        int shift = rs->base - keep;
+        if (shift > rs->filled)
+            shift = rs->filled;
+        if (shift > 0) {
+            memmove(buf, buf + shift, (rs->filled - shift) * sizeof(int16_t));
+            rs->filled -= shift;
+            rs->base -= shift;
+        }
+    }
+    return produced;
+}
+
+#ifdef TEST
+/* 测试: g++ -DTEST -O2 -I ./ -o resampler_test resampler.cpp -lspeexdsp
+ *   resampler_test snr            各比例下与 Speex 对比正弦信号的信噪比
+ *   resampler_test bench [frames] 各比例下与 Speex 对比每 60ms 帧的耗时
+ *   resampler_test clip           满幅且和系数同号的输入, 各内积实现必须和 int64 参考一致, 输出必须限幅而不是翻转
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <speex/speex_resampler.h>
+
+#define TEST_FRAME_MS 60
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static std::vector<int16_t> make_tone(int rate, double freq, int samples) {
+    std::vector<int16_t> pcm(samples);
+    for (int i = 0; i < samples; ++i)
+        pcm[i] = (int16_t)lrint(16000.0 * sin(2 * M_PI * freq * i / rate));
+    return pcm;
+}
+
+/* 用最小二乘拟合 a*sin + b*cos + dc, 残差即为噪声和失真, 不依赖重采样器的延迟 */
+static double tone_snr_db(const std::vector<int16_t> &x, int skip, int rate, double freq) {
+    double ss = 0, sc = 0, cc = 0, xs = 0, xc = 0;
+    int n = (int)x.size() - skip;
+    if (n <= 0)
+        return 0;
+    for (int i = skip; i < (int)x.size(); ++i) {
+        double s = sin(2 * M_PI * freq * i / rate), c = cos(2 * M_PI * freq * i / rate);
+        ss += s * s; sc += s * c; cc += c * c;
+        xs += x[i] * s; xc += x[i] * c;
+    }
+    double det = ss * cc - sc * sc;
+    double a = (xs * cc - xc * sc) / det, b = (xc * ss - xs * sc) / det;
+    double sig = 0, err = 0;
+    for (int i = skip; i < (int)x.size(); ++i) {
+        double fit = a * sin(2 * M_PI * freq * i / rate) + b * cos(2 * M_PI * freq * i / rate);
+        sig += fit * fit;
+        err += (x[i] - fit) * (x[i] - fit);
+    }
+    if (err <= 0)
+        return 200;
+    return 10 * log10(sig / err);
+}
+
+// 按 60ms 帧喂数据, 和 opus.cpp 中的用法一致
+static std::vector<int16_t> run_fixed(int inRate, int outRate, const std::vector<int16_t> &in) {
+    fixed_resampler *rs = create_fixed_resampler(inRate, outRate);
+    int inFrame = inRate * TEST_FRAME_MS / 1000, outFrame = outRate * TEST_FRAME_MS / 1000 + 16;
+    std::vector<int16_t> out;
+    std::vector<int16_t> tmp(outFrame);
+    for (size_t pos = 0; pos + inFrame <= in.size(); pos += inFrame) {
+        int n = fixed_resampler_process(rs, &in[pos], inFrame, tmp.data(), outFrame);
+        out.insert(out.end(), tmp.begin(), tmp.begin() + n);
+    }
+    destroy_fixed_resampler(rs);
+    return out;
+}
+
+static std::vector<int16_t> run_speex(int inRate, int outRate, const std::vector<int16_t> &in) {
+    int err;
+    SpeexResamplerState *rs = speex_resampler_init(1, inRate, outRate, SPEEX_RESAMPLER_QUALITY_DEFAULT, &err);
+    int inFrame = inRate * TEST_FRAME_MS / 1000, outFrame = outRate * TEST_FRAME_MS / 1000 + 16;
+    std::vector<int16_t> out;
+    std::vector<int16_t> tmp(outFrame);
+    for (size_t pos = 0; pos + inFrame <= in.size(); pos += inFrame) {
+        spx_uint32_t inLen = inFrame, outLen = outFrame;
+        speex_resampler_process_int(rs, 0, &in[pos], &inLen, tmp.data(), &outLen);
+        out.insert(out.end(), tmp.begin(), tmp.begin() + outLen);
+    }
+    speex_resampler_destroy(rs);
+    return out;
+}
+
+static const int g_test_ratios[][2] = {
+    { 48000, 16000 }, { 16000, 48000 }, { 44100, 16000 }, { 16000, 44100 },
+};
+
+static int test_snr(void) {
+    const double freqs[] = { 200, 1000, 3000, 6000, 7000 };
+    int fail = 0;
+    printf("kernel: %s\n", fixed_resampler_kernel_name());
+    printf("%-14s %6s %10s %10s\n", "ratio", "freq", "fixed(dB)", "speex(dB)");
+    for (auto &r : g_test_ratios) {
+        for (double f : freqs) {
+            std::vector<int16_t> in = make_tone(r[0], f, r[0]);
+            std::vector<int16_t> a = run_fixed(r[0], r[1], in);
+            std::vector<int16_t> b = run_speex(r[0], r[1], in);
+            int skip = r[1] / 10;  // 跳过开头的滤波器暂态
+            double snrA = tone_snr_db(a, skip, r[1], f);
+            double snrB = tone_snr_db(b, skip, r[1], f);
+            // 输出长度必须和输入帧严格对应, 信噪比不能明显低于 Speex
+            bool ok = a.size() == (size_t)(r[1] * (in.size() / (r[0] * TEST_FRAME_MS / 1000)) * TEST_FRAME_MS / 1000)
+                      && snrA >= std::min(snrB - 3.0, 60.0);
+            printf("%5d->%-7d %6.0f %10.1f %10.1f %s\n", r[0], r[1], f, snrA, snrB, ok ? "" : "FAIL");
+            if (!ok)
+                fail = 1;
+        }
+    }
+    return fail;
+}
+
+// 和系数同号的满幅窗口 (时间倒序, 和系数一一对应); neg 为1时取反号
+static void sign_matched_window(const int16_t *h, int taps, int neg, int16_t *x) {
+    for (int k = 0; k < taps; ++k)
+        x[k] = ((h[k] >= 0) != (neg != 0)) ? 32767 : -32768;
+}
+
+static int test_clip(void) {
+    struct { const char *name; dot_fn_t fn; int ok; } kernels[] = {
+        { "scalar", dot_scalar, 1 },
+#ifdef RESAMPLER_X86
+        { "sse2",   dot_sse2,   __builtin_cpu_supports("sse2") },
+        { "avx2",   dot_avx2,   __builtin_cpu_supports("avx2") },
+#endif
+#ifdef RESAMPLER_NEON
+        { "neon",   dot_neon,   1 },
+#endif
+    };
+    int fail = 0;
+    printf("%-14s %14s %8s %8s\n", "ratio", "max |dot|", "out+", "out-");
+    for (const resampler_ratio &r : g_ratios) {
+        // 1. 每个相位: 各内积实现和逐点 int64 累加的结果一致
+        std::vector<int16_t> x(r.taps);
+        int64_t maxDot = 0;
+        for (int p = 0; p < r.L; ++p) {
+            const int16_t *h = r.coef + p * r.taps;
+            for (int neg = 0; neg < 2; ++neg) {
+                sign_matched_window(h, r.taps, neg, x.data());
+                int64_t ref = 0;
+                for (int k = 0; k < r.taps; ++k)
+                    ref += (int64_t)h[k] * x[k];
+                if (ref > maxDot)
+                    maxDot = ref;
+                for (auto &k : kernels) {
+                    if (k.ok && k.fn(h, x.data(), r.taps) != ref) {
+                        printf("%5d->%-7d phase %d: %s mismatch FAIL\n", r.inRate, r.outRate, p, k.name);
+                        fail = 1;
+                    }
+                }
+            }
+        }
+
+        // 2. 流式处理: 按相位推进找到第一个窗口全是输入样本的输出点, 把该窗口设成同号满幅, 输出必须限幅到满幅
+        int16_t outv[2];
+        for (int neg = 0; neg < 2; ++neg) {
+            int keep = r.taps - 1, phase = 0, base = keep, j = 0;
+            while (base < 2 * keep) {
+                phase += r.M;
+                base += phase / r.L;
+                phase %= r.L;
+                ++j;
+            }
+            std::vector<int16_t> in(base - keep + 1, 0);
+            sign_matched_window(r.coef + phase * r.taps, r.taps, neg, &in[base - 2 * keep]);
+            std::vector<int16_t> out(in.size() * r.L / r.M + 16);
+            fixed_resampler *rs = create_fixed_resampler(r.inRate, r.outRate);
+            int n = fixed_resampler_process(rs, in.data(), (int)in.size(), out.data(), (int)out.size());
+            destroy_fixed_resampler(rs);
+            outv[neg] = n > j ? out[j] : 0;
+        }
+        bool ok = outv[0] == 32767 && outv[1] == -32768;
+        printf("%5d->%-7d %14lld %8d %8d %s\n", r.inRate, r.outRate, (long long)maxDot, outv[0], outv[1], ok ? "" : "FAIL");
+        if (!ok)
+            fail = 1;
+    }
+    return fail;
+}
+
+static int test_bench(int frames) {
+    printf("kernel: %s, %d frames of %d ms\n", fixed_resampler_kernel_name(), frames, TEST_FRAME_MS);
+    printf("%-14s %12s %12s %8s\n", "ratio", "fixed(us/f)", "speex(us/f)", "speedup");
+    for (auto &r : g_test_ratios) {
+        std::vector<int16_t> in = make_tone(r[0], 1000, r[0] * TEST_FRAME_MS / 1000 * frames);
+        double t0 = now_us();
+        run_fixed(r[0], r[1], in);
+        double t1 = now_us();
+        run_speex(r[0], r[1], in);
+        double t2 = now_us();
+        double a = (t1 - t0) / frames, b = (t2 - t1) / frames;
+        printf("%5d->%-7d %12.2f %12.2f %7.2fx\n", r[0], r[1], a, b, b / a);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s snr\n", argv[0]);
+        printf("       %s bench [frames]\n", argv[0]);
+        printf("       %s clip\n", argv[0]);
+        return -1;
+    }
+    if (!strcmp(argv[1], "snr"))
+        return test_snr();
+    if (!strcmp(argv[1], "bench"))
+        return test_bench(argc > 2 ? atoi(argv[2]) : 2000);
+    if (!strcmp(argv[1], "clip"))
+        return test_clip();
+    printf("unknown mode: %s\n", argv[1]);
+    return -1;
+}
+#endif
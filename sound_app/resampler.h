@@ -0,0 +1,66 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+
+/* 固定比例的多相滤波重采样器, 只支持单声道, 滤波器系数在编译期生成
+ * 支持的比例: 48000->16000, 16000->48000, 44100->16000, 16000->44100
+ */
+typedef struct fixed_resampler fixed_resampler;
+
+/**
+ * 判断是否有对应采样率比例的快速实现
+ * 
+ * @param inRate 输入采样率
+ * @param outRate 输出采样率
+ * @return 支持返回1，否则返回0
+ */
+int fixed_resampler_supported(int inRate, int outRate);
+
+/**
+ * 创建重采样器
+ * 
+ * @param inRate 输入采样率
+ * @param outRate 输出采样率
+ * @return 成功返回重采样器，比例不支持或内存不足时返回NULL
+ */
+fixed_resampler *create_fixed_resampler(int inRate, int outRate);
+
+/**
+ * 销毁重采样器
+ * 
+ * @param rs 重采样器，可以为NULL
+ */
+void destroy_fixed_resampler(fixed_resampler *rs);
+
+/**
+ * 处理一段单声道数据, 输入会被全部消耗, 输出样本数由累计的输入决定
+ * 每次输入整数个 60ms 帧时, 输出正好是对应的整数帧
+ * 
+ * @param rs 重采样器
+ * @param in 输入样本
+ * @param inLen 输入样本数
+ * @param out 输出样本
+ * @param outMax 输出缓冲区能容纳的样本数
+ * @return 输出的样本数, outMax 不够时返回-1
+ */
+int fixed_resampler_process(fixed_resampler *rs, const int16_t *in, int inLen, int16_t *out, int outMax);
+
+/**
+ * 清空历史数据, 回到刚创建时的状态
+ */
+void fixed_resampler_reset(fixed_resampler *rs);
+
+/**
+ * 获取重采样器引入的延迟
+ * 
+ * @return 延迟的输出样本数
+ */
+int fixed_resampler_latency(fixed_resampler *rs);
+
+/**
+ * 获取当前 CPU 上选用的内积实现名称 (scalar/sse2/avx2/neon)
+ */
+const char *fixed_resampler_kernel_name(void);
+
+#endif // RESAMPLER_H
@@ -28,8 +28,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <time.h>
+#include <string.h>
 #include <iostream>
 #include <thread>
+#include <atomic>
+#include <semaphore.h>
 #include <alsa/asoundlib.h>
 #include <pthread.h>
 #include <opus/opus.h>
@@ -37,71 +41,253 @@
 #include "aplay.h"
 #include "record.h"
 #include "opus.h"
+#include "bitrate_ctl.h"
+#include "vad_gate.h"
+#include "opus_repack.h"
+#include "jitter_buf.h"
+#include "spsc_ring.h"
+#include "pipeline.h"
 
 #include "ipc_udp.h"
 #include "cfg.h"
 
-#define BUFFER_SIZE (1024*30)  /* 上传60ms的数据,以441000的采样率,双通道,16bit,最大数据量:44100*2*2*60/1000=10584=10K, 给它3倍 */
-#define OPUS_BUF_SIZE (1024*5) /* 60ms的OPUS数据, 5K足够了 */
+#define BUFFER_SIZE (1024*72)  /* 每次上传一帧,最长120ms,以48000的采样率,双通道,16bit,最大数据量:48000*2*2*120/1000=23040=22.5K, 给它3倍 */
+#define OPUS_BUF_SIZE (1024*5) /* 120ms的OPUS数据, 5K足够了 */
 
 // Global buffer to hold audio data
 static char audio_buffer[BUFFER_SIZE];
 
 static unsigned char g_opus_record_buffer[OPUS_BUF_SIZE]; /* 把录音数据编码为OPUS后存在这里 */
-static unsigned char g_record_buffer[BUFFER_SIZE]; /* 读取到的录音原始数据 */
-static int g_record_buffer_offset;
+static spsc_ring<unsigned char> g_record_ring(48000 * 2 * 2 * AUDIO_CAPTURE_QUEUE_MS / 1000); /* 读取到的录音原始数据, 按 48kHz 双声道计算 */
+static unsigned char g_record_frame[BUFFER_SIZE / 3]; /* 跨越环形缓冲末尾的一帧拷贝到这里再编码 */
 static int g_originalPCMDataSize;
 static int g_totalPCMDataSize;
 
 static unsigned char g_opus_play_buffer[OPUS_BUF_SIZE]; /* 把要播放的OPUS码流存在这里 */
-static unsigned char g_play_buffer[BUFFER_SIZE]; /* OPUS解码后得到的PCM数据,暂存在这里 */
+static spsc_ring<unsigned char> g_play_ring(BUFFER_SIZE); /* OPUS解码后得到的PCM数据,暂存在这里 */
+static unsigned char g_play_frame[BUFFER_SIZE / 3]; /* 环形缓冲末尾放不下一个包的解码结果时先解码到这里 */
 
 static int file_number = 1;
 static p_ipc_endpoint_t g_ipc_ep;
+static int g_frame_duration_ms = AUDIO_FRAME_DURATION_MS; /* 本次会话的 Opus 帧时长 (发送的包长) */
+static int g_encode_frame_ms = AUDIO_ENCODE_FRAME_MS;     /* 采集和编码的帧时长, 合包后按 g_frame_duration_ms 发送 */
+static bitrate_ctl *g_bitrate_ctl;
+static vad_gate *g_vad_gate;
+static opus_repack *g_repack;
+static jitter_buf *g_jitter_buf;
+static unsigned char g_uplink_packet[OPUS_BUF_SIZE]; /* 合包后要发送的数据 */
+
+/* 上行流水线: 录音线程 (采集) -> g_record_ring -> 编码线程 (混音/重采样/编码/VAD/合包) -> g_send_queue -> 发送线程
+ * 各级之间是无锁队列, 编码或发送偶尔变慢时数据在队列里等待, 录音线程不会因为来不及读取而溢出 */
+typedef struct uplink_msg {
+    int64_t enqueue_us;                   /* 放入发送队列的时间 (us) */
+    int size;
+    unsigned char data[OPUS_BUF_SIZE];
+} uplink_msg;
+
+static spsc_ring<uplink_msg> g_send_queue(AUDIO_SEND_QUEUE_PACKETS);
+static sem_t g_encode_sem;              /* 录音线程放入数据后通知编码线程 */
+static sem_t g_send_sem;                /* 编码线程放入包后通知发送线程 */
+static pipeline_stage_stats g_capture_stats, g_encode_stats, g_send_stats;
+static int g_record_bytes_per_sec;      /* 录音数据的字节率, 用于把积压的字节数换算成时长 */
+static unsigned long g_backlog_events;  /* 积压超过 AUDIO_ENCODE_BACKLOG_MS 而降低编码复杂度的次数 */
+static unsigned long g_decode_errors;   /* 下行解码失败而丢弃的包, 播放线程里不打印, 退出时统计 */
+
+/* 码率控制在发送线程里根据发送结果进行, 而编码器只能在编码线程里修改, 用这几个原子变量传递 */
+static std::atomic<int> g_target_bitrate(0), g_target_complexity(0), g_target_loss(0);
+static std::atomic<unsigned> g_target_generation(0);
+
+/* control_center 回报的 websocket 发送队列: 由反馈接收线程写, 发送线程读 */
+static p_ipc_endpoint_t g_feedback_ep;
+static std::atomic<int> g_feedback_queue(-1);
+static std::atomic<int64_t> g_feedback_us(0);
+static std::atomic<unsigned long> g_feedback_reports(0);
+
+// 反馈接收线程: 4 字节大端的队列字节数
+static int feedback_callback(char *buffer, size_t size, void *user_data) {
+    if (size != 4)
+        return -1;
+    const unsigned char *p = (const unsigned char *)buffer;
+    uint32_t queued = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    g_feedback_queue.store(queued > 0x7fffffff ? 0x7fffffff : (int)queued, std::memory_order_relaxed);
+    g_feedback_us.store(pipeline_now_us(), std::memory_order_release);
+    g_feedback_reports.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
 
-// Callback function for recording
-void record_callback(unsigned char *buffer, size_t size, void *user_data) {
-    int opussize = 0;
-    static int cnt = 0;
-    static int init = 0;
+// 发送队列深度: 本机 UDP 和 websocket 两段中较深的一段, websocket 的回报过期后不再使用
+static int uplink_queue_bytes(void) {
+    int queued = g_ipc_ep->get_send_queue(g_ipc_ep);
+    int64_t at = g_feedback_us.load(std::memory_order_acquire);
+    if (at && pipeline_now_us() - at <= AUDIO_FEEDBACK_TIMEOUT_MS * 1000LL) {
+        int remote = g_feedback_queue.load(std::memory_order_relaxed);
+        if (remote > queued)
+            queued = remote;
+    }
+    return queued;
+}
 
-    g_totalPCMDataSize += size;    
+// 发送线程: 根据这个包的发送结果调整上行码率, 由编码线程在下一帧应用; 变化只记录在统计里, 不在这里打印
+static void update_uplink_bitrate(int send_failed) {
+    if (!g_bitrate_ctl)
+        return;
+    if (!bitrate_ctl_update(g_bitrate_ctl, uplink_queue_bytes(), send_failed))
+        return;
+
+    bitrate_ctl_stats stats;
+    bitrate_ctl_get_stats(g_bitrate_ctl, &stats);
+    g_target_bitrate.store(stats.bitrate, std::memory_order_relaxed);
+    g_target_complexity.store(stats.complexity, std::memory_order_relaxed);
+    g_target_loss.store(stats.loss_percent, std::memory_order_relaxed);
+    g_target_generation.fetch_add(1, std::memory_order_release);
+}
 
-    if (!init)
-    {
-        unsigned int inputSampleRate;
-        unsigned int inputChannels;
-        snd_pcm_format_t inputFormat;
-    
-        get_actual_record_settings(&inputSampleRate, &inputChannels, &inputFormat);
-        init_opus_encoder(inputSampleRate, inputChannels, 60, 16000, 1);
+// 告诉编码器的预期丢包率: 发送失败率, 打开 FEC 时不低于 AUDIO_UPLINK_FEC_MIN_LOSS, 否则编码器不会附带 FEC
+static int uplink_packet_loss(int measured) {
+    int min_loss = AUDIO_UPLINK_FEC ? AUDIO_UPLINK_FEC_MIN_LOSS : 0;
+    return measured > min_loss ? measured : min_loss;
+}
 
-        // 要上传60ms的数据，计算它的大小
-        g_originalPCMDataSize = inputSampleRate * 60 / 1000 * inputChannels * sizeof(opus_int16);
+// 编码线程: 应用发送线程算出的编码参数; 待编码的数据积压过多时临时降低复杂度, 追上后恢复
+static void apply_encoder_settings(size_t backlog_bytes) {
+    static unsigned applied_generation;
+    static int catching_up;
+
+    int backlog_ms = g_record_bytes_per_sec ? (int)(backlog_bytes * 1000 / g_record_bytes_per_sec) : 0;
+    int catch_up = catching_up ? backlog_ms >= g_encode_frame_ms : backlog_ms > AUDIO_ENCODE_BACKLOG_MS;
+    unsigned generation = g_target_generation.load(std::memory_order_acquire);
+    if (generation == applied_generation && catch_up == catching_up)
+        return;
+
+    // 编码线程可能是实时调度, 不在这里打印, 次数在退出时统计
+    if (catch_up && !catching_up)
+        g_backlog_events++;
+    applied_generation = generation;
+    catching_up = catch_up;
+
+    opus_encoder *enc = get_default_opus_encoder();
+    int bitrate = g_target_bitrate.load(std::memory_order_relaxed);
+    int complexity = catch_up ? AUDIO_BACKLOG_COMPLEXITY : g_target_complexity.load(std::memory_order_relaxed);
+    if (bitrate > 0)
+        opus_encoder_set_bitrate(enc, bitrate);
+    if (complexity > 0)
+        opus_encoder_set_complexity(enc, complexity);
+    opus_encoder_set_packet_loss(enc, uplink_packet_loss(g_target_loss.load(std::memory_order_relaxed)));
+}
 
-        printf("inputSampleRate = %d, inputChannels = %d, inputFormat = %d, g_originalPCMDataSize = %d\n", inputSampleRate, inputChannels, inputFormat, g_originalPCMDataSize);
+// 编码线程: 把一个包放入发送队列, 发送线程卡住、队列满时丢弃
+static void queue_uplink_packet(const unsigned char *data, int size) {
+    if (size <= 0)
+        return;
 
-        init = 1;
+    size_t n;
+    uplink_msg *msg = g_send_queue.write_span(&n);
+    if (n == 0) {
+        g_encode_stats.drops++;
+        return;
     }
+    msg->enqueue_us = pipeline_now_us();
+    msg->size = size;
+    memcpy(msg->data, data, size);
+    g_send_queue.commit_write(1);
+    sem_post(&g_send_sem);
+}
+
+// 编码线程第一次拿到数据时, 按录音的实际参数初始化编码器、码率控制、VAD 和合包
+static void init_uplink_encoder(void) {
+    unsigned int inputSampleRate;
+    unsigned int inputChannels;
+    snd_pcm_format_t inputFormat;
+
+    get_actual_record_settings(&inputSampleRate, &inputChannels, &inputFormat);
+    init_opus_encoder(inputSampleRate, inputChannels, g_encode_frame_ms, 16000, 1, AUDIO_ENCODE_RATE_MODE);
+    if (opus_encoder_set_profile(get_default_opus_encoder(), AUDIO_ENCODER_PROFILE) == 0) {
+        opus_encoder_stats stats;
+        opus_encoder_get_stats(get_default_opus_encoder(), &stats);
+        printf("encoder profile %s, lookahead %.1f ms, frame %d ms\n",
+               opus_encoder_profile_name(stats.profile), stats.lookahead_us / 1000.0, g_encode_frame_ms);
+    }
+
+    bitrate_ctl_config bitrate_cfg = {
+        AUDIO_BITRATE_MIN, AUDIO_BITRATE_MAX, AUDIO_BITRATE_START,
+        AUDIO_BITRATE_STEP_UP, AUDIO_BITRATE_BACKOFF,
+        AUDIO_SEND_QUEUE_HIGH, AUDIO_SEND_QUEUE_LOW,
+        AUDIO_BITRATE_STABLE_FRAMES, AUDIO_BITRATE_HOLDOFF_FRAMES,
+        AUDIO_COMPLEXITY_MIN, AUDIO_COMPLEXITY_MAX,
+    };
+    g_bitrate_ctl = create_bitrate_ctl(&bitrate_cfg);
+    if (g_bitrate_ctl) {
+        bitrate_ctl_stats stats;
+        bitrate_ctl_get_stats(g_bitrate_ctl, &stats);
+        opus_encoder_set_bitrate(get_default_opus_encoder(), stats.bitrate);
+        opus_encoder_set_complexity(get_default_opus_encoder(), stats.complexity);
+        g_target_bitrate.store(stats.bitrate, std::memory_order_relaxed);
+        g_target_complexity.store(stats.complexity, std::memory_order_relaxed);
+    }
+
+    vad_gate_config vad_cfg = {
+        AUDIO_UPLINK_DTX, AUDIO_VAD_THRESHOLD_DB, AUDIO_VAD_MIN_LEVEL_DB,
+        AUDIO_VAD_HANGOVER_FRAMES, AUDIO_VAD_KEEPALIVE_FRAMES, AUDIO_VAD_PREROLL,
+    };
+    g_vad_gate = create_vad_gate(&vad_cfg);
+    opus_encoder_set_dtx(get_default_opus_encoder(), AUDIO_UPLINK_DTX);
+    opus_encoder_set_fec(get_default_opus_encoder(), AUDIO_UPLINK_FEC);
+    opus_encoder_set_packet_loss(get_default_opus_encoder(), uplink_packet_loss(0));
+
+    opus_repack_config repack_cfg = {
+        g_frame_duration_ms / g_encode_frame_ms, AUDIO_REPACK_FLUSH_ON_SILENCE,
+    };
+    g_repack = create_opus_repack(&repack_cfg);
+
+    // 每次上传一帧的数据，计算它的大小
+    g_originalPCMDataSize = inputSampleRate * g_encode_frame_ms / 1000 * inputChannels * sizeof(opus_int16);
+    g_record_bytes_per_sec = inputSampleRate * inputChannels * sizeof(opus_int16);
+
+    printf("inputSampleRate = %d, inputChannels = %d, inputFormat = %d, g_originalPCMDataSize = %d\n", inputSampleRate, inputChannels, inputFormat, g_originalPCMDataSize);
+}
 
-    // 将数据存入g_record_buffer
-    memcpy(g_record_buffer + g_record_buffer_offset, buffer, size);
-    g_record_buffer_offset += size;
-
-    // 当g_record_buffer_offset大于或等于g_originalPCMDataSize时，调用pcm2opus来处理
-    int i = 0;
-    int pcmsize = 0;
-    if (g_record_buffer_offset >= g_originalPCMDataSize) {        
-        while (i < g_record_buffer_offset) {
-            pcmsize = g_record_buffer_offset - i;
-            if (pcmsize > g_originalPCMDataSize)
-                pcmsize = g_originalPCMDataSize;
-            else {
-                // 如果剩余的数据不足一个Opus包，则保留下来移动到最前面
-                memcpy(g_record_buffer, g_record_buffer + i, pcmsize);
-                break;
+// 录音回调 (采集线程): 只把数据放入队列, 不能在这里做耗时的处理或打印, 否则来不及读取会溢出
+void record_callback(unsigned char *buffer, size_t size, void *user_data) {
+    int64_t start = pipeline_now_us();
+
+    g_totalPCMDataSize += size;
+
+    // 编码跟不上: 只计数, 退出时和各级的积压一起统计
+    if (g_record_ring.write(buffer, size) != size)
+        g_capture_stats.drops++;
+    sem_post(&g_encode_sem);
+
+    pipeline_stage_record(&g_capture_stats, 0, pipeline_now_us() - start);
+}
+
+// 编码线程: 每攒够一帧就编码, 经过 VAD 和合包后放入发送队列
+static void *uplink_encode_thread(void *arg) {
+    int opussize = 0;
+    int init = 0;
+
+    while (1) {
+        sem_wait(&g_encode_sem);
+        if (!init) {
+            init_uplink_encoder();
+            init = 1;
+        }
+
+        while (g_record_ring.size() >= (size_t)g_originalPCMDataSize) {
+            int64_t start = pipeline_now_us();
+            int pcmsize = g_originalPCMDataSize;
+            size_t backlog = g_record_ring.size() - pcmsize;
+
+            apply_encoder_settings(backlog);
+
+            // 这一帧在环形缓冲中连续时直接使用, 跨越末尾时才拷贝出来
+            size_t contiguous;
+            unsigned char *pcm = const_cast<unsigned char *>(g_record_ring.read_span(&contiguous));
+            if (contiguous < (size_t)pcmsize) {
+                g_record_ring.read(g_record_frame, pcmsize);
+                pcm = g_record_frame;
+                contiguous = 0;
             }
-            pcm2opus(g_record_buffer + i, pcmsize, g_opus_record_buffer, &opussize);
+            pcm2opus(pcm, pcmsize, g_opus_record_buffer, &opussize);
 
             if (opussize) {
 #if 0
@@ -120,22 +306,95 @@ void record_callback(unsigned char *buffer, size_t size, void *user_data) {
                     fprintf(stderr, "Failed to open file %s for writing\n", filename);
                 }      
 #endif                      
-                g_ipc_ep->send(g_ipc_ep, (const char*)g_opus_record_buffer, opussize);
+                const unsigned char *packets[2] = { g_opus_record_buffer, NULL };
+                int sizes[2] = { opussize, 0 };
+                int count = 1;
+
+                // 静音帧不发送, 说话开始时可能需要先补发前一帧
+                if (g_vad_gate)
+                    count = vad_gate_push(g_vad_gate, (const int16_t *)pcm, pcmsize / sizeof(int16_t),
+                                          g_opus_record_buffer, opussize, packets, sizes);
+                for (int k = 0; k < count; k++) {
+                    if (g_repack)
+                        queue_uplink_packet(g_uplink_packet, opus_repack_push(g_repack, packets[k], sizes[k], g_uplink_packet, sizeof(g_uplink_packet)));
+                    else
+                        queue_uplink_packet(packets[k], sizes[k]);
+                }
+                // 人声结束, 不用等凑满一个包
+                if (count == 0 && g_repack)
+                    queue_uplink_packet(g_uplink_packet, opus_repack_end_of_speech(g_repack, g_uplink_packet, sizeof(g_uplink_packet)));
             }
 
-            i += pcmsize;
+            if (contiguous)
+                g_record_ring.commit_read(pcmsize);
+
+            // 这一帧的排队时间按它后面已经积压的数据时长估算
+            pipeline_stage_record(&g_encode_stats, (int64_t)backlog * 1000000 / g_record_bytes_per_sec,
+                                  pipeline_now_us() - start);
         }
+    }
+    return NULL;
+}
+
+// 发送线程: 逐个发送编码线程放入的包, 并根据发送结果调整码率
+static void *uplink_send_thread(void *arg) {
+    while (1) {
+        sem_wait(&g_send_sem);
 
-        // 重置g_record_buffer_offset
-        g_record_buffer_offset -= i;
+        size_t n;
+        const uplink_msg *msg = g_send_queue.read_span(&n);
+        if (n == 0)
+            continue;
+
+        int64_t start = pipeline_now_us();
+        int64_t wait = start - msg->enqueue_us;
+        int ret = g_ipc_ep->send(g_ipc_ep, (const char*)msg->data, msg->size);
+        g_send_queue.commit_read(1);
+        update_uplink_bitrate(ret != 0);
+
+        pipeline_stage_record(&g_send_stats, wait, pipeline_now_us() - start);
     }
+    return NULL;
+}
+
+static int64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 下行接收线程: 只负责把收到的包连同到达时间放入抖动缓冲, 解码和播放由播放线程按自己的节奏进行
+static void *downlink_thread(void *arg) {
+    static unsigned char packet[OPUS_BUF_SIZE];
+    uint32_t seq = 0;
+
+    while (1) {
+        int size = 0;
+        if (g_ipc_ep->recv(g_ipc_ep, packet, OPUS_BUF_SIZE, &size) != 0) {
+            fprintf(stderr, "Failed to receive data from WebSocket client\n");
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        const unsigned char *data = packet;
+#if AUDIO_DOWNLINK_SEQ_HEADER
+        if (size <= 4)
+            continue;
+        seq = ((uint32_t)packet[0] << 24) | ((uint32_t)packet[1] << 16) | ((uint32_t)packet[2] << 8) | packet[3];
+        data += 4;
+        size -= 4;
+#endif
+        if (size > 0)
+            jitter_buf_put(g_jitter_buf, seq, data, size, monotonic_ms());
+        seq++;
+    }
+    return NULL;
 }
 
 // Callback function for playing
 int play_get_data_callback(unsigned char *buffer, size_t size) {
-    static int play_buffer_offset = 0;
-
     static int init = 0;
+    static int last_packet_ms = g_frame_duration_ms;  /* 最近解码的包的时长, 下行包长由服务端决定 */
 
     if (!init)
     {
@@ -144,81 +403,218 @@ int play_get_data_callback(unsigned char *buffer, size_t size) {
         snd_pcm_format_t outputFormat;
     
         get_actual_play_settings(&outputSampleRate, &outputChannels, &outputFormat);
-        init_opus_decoder(16000, 1, 60, outputSampleRate, outputChannels);
+        init_opus_decoder(16000, 1, g_frame_duration_ms, outputSampleRate, outputChannels, AUDIO_DECODE_RATE_MODE);
 
         init = 1;
     }
     
-    // 如果 g_play_buffer 中没有足够的数据，则从 WebSocket 客户端接收数据并解码
-    while (play_buffer_offset < size) {
-        int opus_data_size = 0;
+    // 从抖动缓冲取包解码, 不在播放线程里等待网络
+    while (g_play_ring.size() < size) {
         int pcm_data_size = 0;
-        //std::cout << "play_get_data_callback ************************************** "<<std::endl;
-        // 从使用UDP接收数据
-        if (g_ipc_ep->recv(g_ipc_ep, g_opus_play_buffer, OPUS_BUF_SIZE, &opus_data_size) != 0) {
-            fprintf(stderr, "Failed to receive data from WebSocket client\n");
-            return 0; // 返回0表示没有数据可用
-        }
+        int opus_data_size = jitter_buf_get(g_jitter_buf, g_opus_play_buffer, OPUS_BUF_SIZE, NULL);
 
-#if 0
-        static int file_number = 1;
-        // 构造文件名
-        char filename[20];
-        snprintf(filename, sizeof(filename), "test%03d.opus", file_number);
-
-        // 打开文件
-        FILE *file = fopen(filename, "wb");
-        if (file) {
-            // 写入Opus数据
-            fwrite(g_opus_play_buffer, 1, opus_data_size, file);
-            fclose(file);
-            file_number++; // 增加文件编号
-        } else {
-            fprintf(stderr, "Failed to open file %s for writing\n", filename);
-        }        
-#endif
-        //std::cout << "get opus data "<<opus_data_size<< std::endl;
+        // 环形缓冲里连续的空间放得下一个最长的包时直接解码进去, 否则先解码到 g_play_frame
+        size_t contiguous;
+        unsigned char *pcm = g_play_ring.write_span(&contiguous);
+        if (contiguous < sizeof(g_play_frame))
+            pcm = g_play_frame;
 
-        // 解码 Opus 数据为 PCM 数据
         if (opus_data_size > 0) {
-            opus2pcm(g_opus_play_buffer, opus_data_size, g_play_buffer+play_buffer_offset, &pcm_data_size);
+            opus2pcm(g_opus_play_buffer, opus_data_size, pcm, &pcm_data_size);
             if (pcm_data_size <= 0) {
-                fprintf(stderr, "Failed to decode Opus data to PCM\n");
-                return 0; // 返回0表示没有数据可用
+                g_decode_errors++;
+                continue;
             }
+            int samples = opus_packet_get_nb_samples(g_opus_play_buffer, opus_data_size, 48000);
+            if (samples > 0)
+                last_packet_ms = samples / 48;
+        } else if (opus_data_size == 0) {
+            // 这个包没有按时到达: 下一个包已经在缓冲里时用它的 FEC 恢复, 否则用 PLC 补出, 时长按最近解码的包
+            int next_size = jitter_buf_peek(g_jitter_buf, g_opus_play_buffer, OPUS_BUF_SIZE);
+            opus2pcm_lost(get_default_opus_decoder(), next_size > 0 ? g_opus_play_buffer : NULL, next_size,
+                          last_packet_ms, pcm, &pcm_data_size);
         } else {
-            // 如果没有接收到数据，等待一段时间后重试
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            continue;
+            // 正在缓冲或没有数据: 把已有的交给播放线程, 不足的部分由它补静音
+            break;
         }
 
-        // 更新 g_play_buffer 的偏移量
-        play_buffer_offset += pcm_data_size;
+        if (pcm == g_play_frame)
+            g_play_ring.write(g_play_frame, pcm_data_size);
+        else
+            g_play_ring.commit_write(pcm_data_size);
     }
 
-    // 复制数据到 buffer
-    memcpy(buffer, g_play_buffer, size);
-    memmove(g_play_buffer, g_play_buffer+size, play_buffer_offset - size);
-    play_buffer_offset -= size;    
-
-    return size; 
+    // 复制数据到 buffer, 不足的部分由播放线程补静音
+    return (int)g_play_ring.read(buffer, size);
 }
 
 void handle_signal(int sig) {
     printf("Received signal %d, exiting..., g_totalPCMDataSize = %d, file_number = %d\n", sig, g_totalPCMDataSize, file_number);
+    if (g_bitrate_ctl) {
+        bitrate_ctl_stats stats;
+        bitrate_ctl_get_stats(g_bitrate_ctl, &stats);
+        printf("uplink bitrate %d complexity %d loss %d%%, queue %d bytes (%lu websocket reports), "
+               "send failures %lu, congestions %lu, decreases %lu, increases %lu\n",
+               stats.bitrate, stats.complexity, stats.loss_percent, stats.queue_bytes,
+               g_feedback_reports.load(std::memory_order_relaxed), stats.send_failures, stats.congestions,
+               stats.decreases, stats.increases);
+    }
+    if (g_vad_gate) {
+        vad_gate_stats stats;
+        vad_gate_get_stats(g_vad_gate, &stats);
+        printf("uplink frames %lu, sent %lu, suppressed %lu, bytes sent %lu, bytes saved %lu\n",
+               stats.frames, stats.frames_sent, stats.frames_suppressed, stats.bytes_sent, stats.bytes_saved);
+    }
+    pipeline_stage_print("uplink capture", &g_capture_stats);
+    pipeline_stage_print("uplink encode", &g_encode_stats);
+    pipeline_stage_print("uplink send", &g_send_stats);
+    record_stats rec_stats;
+    get_record_stats(&rec_stats);
+    printf("capture %s, periods %lu, overruns %lu, copied %lu bytes, cpu %.1f ms, delay %.1f ms (max %.1f), "
+           "encoder backlog events %lu\n",
+           rec_stats.mmap ? "mmap" : "readi", rec_stats.periods, rec_stats.overruns, rec_stats.copied_bytes,
+           rec_stats.cpu_us / 1000.0, rec_stats.delay_us / 1000.0, rec_stats.max_delay_us / 1000.0, g_backlog_events);
+    pcm_preprocess_stats pre_stats;
+    if (get_record_preprocess_stats(&pre_stats) == 0 && pre_stats.frames)
+        printf("capture preprocess frames %lu, voiced %lu, cpu avg %.1f us max %.1f us per %u ms frame (%.2f%%)\n",
+               pre_stats.frames, pre_stats.voiced_frames, pre_stats.cpu_ns / 1000.0 / pre_stats.frames,
+               pre_stats.max_cpu_ns / 1000.0, pre_stats.frame_us / 1000,
+               pre_stats.cpu_ns / 10.0 / pre_stats.frames / pre_stats.frame_us);
+    pcm_aec_stats aec_stats;
+    if (get_record_aec_stats(&aec_stats) == 0 && aec_stats.frames)
+        printf("echo canceller frames %lu, no reference %lu, resyncs %lu, reference age %.1f ms, ERLE %.1f dB, "
+               "cpu avg %.1f us max %.1f us per %u ms frame (%.2f%%)\n",
+               aec_stats.frames, aec_stats.no_ref_frames, aec_stats.resyncs, aec_stats.ref_age_us / 1000.0,
+               aec_stats.erle_db, aec_stats.cpu_ns / 1000.0 / aec_stats.frames, aec_stats.max_cpu_ns / 1000.0,
+               aec_stats.frame_us / 1000, aec_stats.cpu_ns / 10.0 / aec_stats.frames / aec_stats.frame_us);
+    if (g_repack) {
+        opus_repack_stats stats;
+        opus_repack_get_stats(g_repack, &stats);
+        printf("repack frames %lu, packets %lu, messages saved %lu (%.1f/s), silence flushes %lu\n",
+               stats.frames_in, stats.packets_out, stats.messages_saved,
+               stats.audio_ms ? stats.messages_saved * 1000.0 / stats.audio_ms : 0.0, stats.silence_flushes);
+    }
+    if (g_jitter_buf) {
+        jitter_buf_stats stats;
+        jitter_buf_get_stats(g_jitter_buf, &stats);
+        printf("jitter buffer depth %d (%d ms added latency), target %d ms, jitter %d ms, "
+               "played %lu, late %lu, lost %lu, underruns %lu, skipped %lu\n",
+               stats.depth_packets, stats.depth_ms, stats.target_ms, stats.jitter_ms,
+               stats.played, stats.late, stats.lost, stats.underruns, stats.skipped);
+    }
+    aplay_stats play_stats;
+    get_play_stats(&play_stats);
+    printf("playback %s, periods %lu, silence %lu, partial %lu, underruns %lu, wakeups %lu, ring %d bytes, "
+           "copied %lu bytes, delay %.1f ms (max %.1f), sound starts %lu, start delay %.1f ms (max %.1f), "
+           "cpu play %.1f ms feed %.1f ms\n",
+           play_stats.mmap ? "mmap" : "writei", play_stats.periods, play_stats.silence_periods, play_stats.partial_periods, play_stats.underruns,
+           play_stats.wakeups, play_stats.ring_bytes, play_stats.copied_bytes,
+           play_stats.delay_us / 1000.0, play_stats.max_delay_us / 1000.0, play_stats.starts,
+           play_stats.start_delay_us / 1000.0, play_stats.max_start_delay_us / 1000.0,
+           play_stats.play_cpu_us / 1000.0, play_stats.feed_cpu_us / 1000.0);
+    printf("xruns per thread: capture %lu overruns, play %lu underruns, feed %lu silent periods, "
+           "encode %lu capture queue overflows, send %lu packets dropped\n",
+           rec_stats.overruns, play_stats.underruns, play_stats.silence_periods,
+           g_capture_stats.drops, g_encode_stats.drops);
+    opus_decoder_stats dec_stats;
+    if (opus_decoder_get_stats(get_default_opus_decoder(), &dec_stats) == 0)
+        printf("downlink recovered by FEC %lu, concealed by PLC %lu, skipped %lu, decode errors %lu\n",
+               dec_stats.recovered, dec_stats.concealed, dec_stats.skipped, g_decode_errors);
 }
 
-int main() {
+// 用法: sound_app [录音设备 [播放设备 [速度]]], 设备的写法见 cfg.h 中的 AUDIO_CAPTURE_DEVICE
+int main(int argc, char **argv) {
 
     //signal(SIGINT, handle_signal);
 
+    const char *capture_spec = argc > 1 ? argv[1] : AUDIO_CAPTURE_DEVICE;
+    const char *play_spec = argc > 2 ? argv[2] : AUDIO_PLAY_DEVICE;
+    double speed = argc > 3 ? atof(argv[3]) : AUDIO_DEVICE_SPEED;
+
+    if (g_frame_duration_ms != 20 && g_frame_duration_ms != 40 && g_frame_duration_ms != 60 && g_frame_duration_ms != 120) {
+        fprintf(stderr, "Unsupported frame duration %d ms, use 60 ms\n", g_frame_duration_ms);
+        g_frame_duration_ms = 60;
+    }
+    if ((g_encode_frame_ms != 20 && g_encode_frame_ms != 40 && g_encode_frame_ms != 60 && g_encode_frame_ms != 120)
+        || g_frame_duration_ms % g_encode_frame_ms != 0) {
+        fprintf(stderr, "Unsupported encode frame %d ms for %d ms packets, disable repacketizing\n", g_encode_frame_ms, g_frame_duration_ms);
+        g_encode_frame_ms = g_frame_duration_ms;
+    }
+    set_record_latency(AUDIO_CAPTURE_LATENCY, g_encode_frame_ms);
+    set_play_latency(AUDIO_PLAY_LATENCY, g_frame_duration_ms);
+    set_record_mmap(AUDIO_ALSA_MMAP);
+    if (AUDIO_PREPROCESS) {
+        const pcm_preprocess_config preprocess_cfg = {
+            AUDIO_DENOISE, AUDIO_NOISE_SUPPRESS_DB, AUDIO_AGC, AUDIO_AGC_TARGET, AUDIO_AGC_MAX_GAIN_DB,
+            AUDIO_SPEEX_VAD, AUDIO_VAD_PROB_START, AUDIO_VAD_PROB_CONTINUE, AUDIO_PREPROCESS_FRAME_MS,
+        };
+        set_record_preprocess(&preprocess_cfg);
+    }
+    // 远端参考由播放线程写、录音线程读, 一直用到进程退出
+    if (AUDIO_AEC) {
+        const pcm_aec_config aec_cfg = { AUDIO_AEC_FRAME_MS, AUDIO_AEC_FILTER_MS, AUDIO_AEC_LEAD_MS, AUDIO_AEC_RESYNC_MS };
+        echo_ref *ref = create_echo_ref(AUDIO_AEC_HISTORY_MS);
+        if (ref) {
+            set_record_aec(&aec_cfg, ref);
+            set_play_echo_ref(ref);
+        }
+    }
+    set_play_mmap(AUDIO_ALSA_MMAP);
+
+    // 在创建任何线程之前锁定内存, 之后分配的栈和缓冲区也都会常驻内存
+    if (AUDIO_MLOCK)
+        pipeline_lock_memory(AUDIO_HEAP_RESERVE);
+
     g_ipc_ep = ipc_endpoint_create_udp(AUDIO_PORT_DOWN, AUDIO_PORT_UP, NULL, NULL);
     if (!g_ipc_ep) {
         fprintf(stderr, "Failed to create IPC endpoint\n");
         return -1;
     }
+    // 拥塞反馈只接收, 创建失败时码率控制只看本机发送队列
+    g_feedback_ep = ipc_endpoint_create_udp(AUDIO_PORT_FEEDBACK, AUDIO_PORT_UP, feedback_callback, NULL);
+    if (!g_feedback_ep)
+        fprintf(stderr, "Failed to create feedback endpoint, uplink bitrate follows the local queue only\n");
+
+    jitter_buf_config jitter_cfg = {
+        g_frame_duration_ms, AUDIO_JITTER_MIN_MS, AUDIO_JITTER_MAX_MS, AUDIO_JITTER_CAPACITY,
+    };
+    g_jitter_buf = create_jitter_buf(&jitter_cfg);
+    if (!g_jitter_buf) {
+        fprintf(stderr, "Failed to create jitter buffer\n");
+        return -1;
+    }
+
+    // Create a thread for receiving downlink audio
+    pthread_t downlink_tid;
+    if (pthread_create(&downlink_tid, NULL, downlink_thread, NULL) != 0) {
+        fprintf(stderr, "Failed to create downlink thread\n");
+        return -1;
+    }
+
+    // 上行流水线: 先启动编码和发送线程, 再开始录音
+    sem_init(&g_encode_sem, 0, 0);
+    sem_init(&g_send_sem, 0, 0);
+    const pipeline_thread_policy encode_policy = { AUDIO_ENCODE_CPU, AUDIO_RT_PRIORITY_ENCODE, AUDIO_THREAD_STACK };
+    const pipeline_thread_policy send_policy = { AUDIO_SEND_CPU, AUDIO_RT_PRIORITY_SEND, AUDIO_THREAD_STACK };
+    pthread_t encode_tid, send_tid;
+    if (pipeline_start_thread(&encode_tid, "uplink-encode", &encode_policy, uplink_encode_thread, NULL) != 0 ||
+        pipeline_start_thread(&send_tid, "uplink-send", &send_policy, uplink_send_thread, NULL) != 0)
+        return -1;
+
+    // 录音和播放设备; 两边都是 loopback 时共用一个设备, 播放的内容再被录下来
+    p_audio_dev_t capture_dev = audio_dev_create(capture_spec, speed);
+    p_audio_dev_t play_dev = !strcmp(capture_spec, "loopback") && !strcmp(play_spec, "loopback")
+                             ? capture_dev : audio_dev_create(play_spec, speed);
+    if (!capture_dev || !play_dev) {
+        fprintf(stderr, "Failed to create audio devices\n");
+        return -1;
+    }
+    set_record_device(capture_dev);
+    set_play_device(play_dev);
 
     // Create a thread for recording
+    const pipeline_thread_policy capture_policy = { AUDIO_CAPTURE_CPU, AUDIO_RT_PRIORITY_CAPTURE, AUDIO_THREAD_STACK };
+    set_record_thread_policy(&capture_policy);
     pthread_t record_thread = create_record_thread(record_callback, NULL);
     if (!record_thread) {
         fprintf(stderr, "Failed to create recording thread\n");
@@ -226,6 +622,9 @@ int main() {
     }
 
     // Create a thread for playing
+    const pipeline_thread_policy play_policy = { AUDIO_PLAY_CPU, AUDIO_RT_PRIORITY_PLAY, AUDIO_THREAD_STACK };
+    const pipeline_thread_policy feed_policy = { AUDIO_FEED_CPU, AUDIO_RT_PRIORITY_FEED, AUDIO_THREAD_STACK };
+    set_play_thread_policy(&play_policy, &feed_policy);
     pthread_t play_thread = create_play_thread(play_get_data_callback, NULL);
     if (!play_thread) {
         fprintf(stderr, "Failed to create playing thread\n");
@@ -240,6 +639,13 @@ int main() {
         fprintf(stderr, "Failed to join recording thread\n");
     }
 
+    // 录音来自 WAV 文件时读完就结束: 等编码和发送处理完剩下的数据, 打印统计后退出, 便于在测试机上比较
+    if (strcmp(capture_dev->name, "alsa")) {
+        sleep(1);
+        handle_signal(0);
+        return 0;
+    }
+
     if (pthread_join(play_thread, (void**)&play_thread_status) != 0) {
         fprintf(stderr, "Failed to join playing thread\n");
     }
@@ -0,0 +1,152 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+#include <type_traits>
+
+/* 单生产者/单消费者无锁环形缓冲
+ * 容量取 2 的幂, 下标单调递增、用掩码回绕; 读写下标放在不同的 cache line 上, 生产者和消费者各自缓存对方的下标,
+ * 只有缓存的值不够用时才去读对方的 cache line
+ * 可以直接在缓冲区内读写 (write_span/read_span + commit), 省去一次拷贝 */
+
+#define SPSC_CACHE_LINE 64
+
+template <typename T>
+class spsc_ring {
+    static_assert(std::is_trivially_copyable<T>::value, "spsc_ring 只能存放可以 memcpy 的类型");
+
+public:
+    /**
+     * @param min_capacity 最少能存放的元素个数, 向上取整为 2 的幂
+     */
+    explicit spsc_ring(size_t min_capacity) {
+        size_t capacity = 1;
+        while (capacity < min_capacity)
+            capacity <<= 1;
+        buffer_.resize(capacity);
+        mask_ = capacity - 1;
+    }
+
+    spsc_ring(const spsc_ring &) = delete;
+    spsc_ring &operator=(const spsc_ring &) = delete;
+
+    size_t capacity() const { return mask_ + 1; }
+
+    /* 可读的元素个数, 两个线程都可以调用, 结果可能马上过时 */
+    size_t size() const {
+        return write_.load(std::memory_order_acquire) - read_.load(std::memory_order_acquire);
+    }
+
+    /* 可写的元素个数, 两个线程都可以调用, 结果可能马上过时 */
+    size_t space() const { return capacity() - size(); }
+
+    /* ---- 以下只能由生产者调用 ---- */
+
+    /**
+     * 获取一段连续的可写区域
+     *
+     * @param n 返回这段区域的元素个数, 为0表示已满; 回绕时只返回到缓冲区末尾的部分
+     * @return 区域的起始地址
+     */
+    T *write_span(size_t *n) {
+        size_t w = write_.load(std::memory_order_relaxed);
+        size_t pos = w & mask_;
+        size_t contiguous = capacity() - pos;
+        size_t free = capacity() - (w - readCache_);
+        if (free < contiguous) {
+            readCache_ = read_.load(std::memory_order_acquire);
+            free = capacity() - (w - readCache_);
+        }
+        *n = free < contiguous ? free : contiguous;
+        return &buffer_[pos];
+    }
+
+    /* 提交 write_span 中写好的 n 个元素 */
+    void commit_write(size_t n) {
+        write_.store(write_.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    /**
+     * 写入数据, 空间不够时只写入一部分
+     *
+     * @return 实际写入的元素个数
+     */
+    size_t write(const T *data, size_t n) {
+        size_t w = write_.load(std::memory_order_relaxed);
+        if (capacity() - (w - readCache_) < n)
+            readCache_ = read_.load(std::memory_order_acquire);
+        size_t free = capacity() - (w - readCache_);
+        if (n > free)
+            n = free;
+        size_t pos = w & mask_;
+        size_t first = n < capacity() - pos ? n : capacity() - pos;
+        memcpy(&buffer_[pos], data, first * sizeof(T));
+        memcpy(&buffer_[0], data + first, (n - first) * sizeof(T));
+        write_.store(w + n, std::memory_order_release);
+        return n;
+    }
+
+    /* ---- 以下只能由消费者调用 ---- */
+
+    /**
+     * 获取一段连续的可读区域
+     *
+     * @param n 返回这段区域的元素个数, 为0表示为空; 回绕时只返回到缓冲区末尾的部分
+     * @return 区域的起始地址
+     */
+    const T *read_span(size_t *n) {
+        size_t r = read_.load(std::memory_order_relaxed);
+        size_t pos = r & mask_;
+        size_t contiguous = capacity() - pos;
+        size_t used = writeCache_ - r;
+        if (used < contiguous) {
+            writeCache_ = write_.load(std::memory_order_acquire);
+            used = writeCache_ - r;
+        }
+        *n = used < contiguous ? used : contiguous;
+        return &buffer_[pos];
+    }
+
+    /* 释放 read_span 中已经处理完的 n 个元素 */
+    void commit_read(size_t n) {
+        read_.store(read_.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    /**
+     * 读出数据, 数据不够时只读出一部分
+     *
+     * @return 实际读出的元素个数
+     */
+    size_t read(T *data, size_t n) {
+        size_t r = read_.load(std::memory_order_relaxed);
+        if (writeCache_ - r < n)
+            writeCache_ = write_.load(std::memory_order_acquire);
+        size_t used = writeCache_ - r;
+        if (n > used)
+            n = used;
+        size_t pos = r & mask_;
+        size_t first = n < capacity() - pos ? n : capacity() - pos;
+        memcpy(data, &buffer_[pos], first * sizeof(T));
+        memcpy(data + first, &buffer_[0], (n - first) * sizeof(T));
+        read_.store(r + n, std::memory_order_release);
+        return n;
+    }
+
+private:
+    /* 生产者修改的数据 */
+    alignas(SPSC_CACHE_LINE) std::atomic<size_t> write_{0};
+    size_t readCache_ = 0;                  // 生产者看到的读下标
+
+    /* 消费者修改的数据 */
+    alignas(SPSC_CACHE_LINE) std::atomic<size_t> read_{0};
+    size_t writeCache_ = 0;                 // 消费者看到的写下标
+
+    /* 创建后不再修改 */
+    alignas(SPSC_CACHE_LINE) size_t mask_;
+    std::vector<T> buffer_;
+};
+
+#endif // SPSC_RING_H
@@ -0,0 +1,210 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * 上行静音抑制: 帧能量 + 自适应噪声底的简单 VAD, 与 Opus DTX 配合使用
+ */
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <new>
+
+#include "opus.h"
+#include "vad_gate.h"
+
+#define NOISE_FLOOR_INIT_DB   -60.0f
+#define NOISE_FLOOR_RISE_DB   0.1f    // 噪声底在静音帧上每帧最多上升的 dB 数, 下降则立即跟随; 人声帧不上升
+#define LEVEL_SILENCE_DB      -96.0f
+
+struct vad_gate {
+    vad_gate_config cfg;
+    vad_gate_stats stats;
+    float noiseFloor;
+    int hangover;                                 // 剩余的 hangover 帧数
+    int silentRun;                                // 连续被抑制的帧数
+    int heldSize;                                 // 缓存的前导帧长度, 0 表示没有
+    unsigned char held[OPUS_MAX_PACKET_SIZE];     // 最近一个被抑制的帧
+    unsigned char out[OPUS_MAX_PACKET_SIZE];      // 返回给调用者的前导帧
+};
+
+static float frame_level_db(const int16_t *pcm, int samples) {
+    if (samples <= 0)
+        return LEVEL_SILENCE_DB;
+    int64_t sum = 0;
+    for (int i = 0; i < samples; ++i)
+        sum += (int32_t)pcm[i] * pcm[i];
+    double meanSquare = (double)sum / samples;
+    if (meanSquare < 1.0)
+        return LEVEL_SILENCE_DB;
+    return (float)(10.0 * log10(meanSquare / (32768.0 * 32768.0)));
+}
+
+vad_gate *create_vad_gate(const vad_gate_config *cfg) {
+    if (!cfg || cfg->hangover_frames < 0 || cfg->keepalive_frames < 0)
+        return NULL;
+    vad_gate *gate = new (std::nothrow) vad_gate();
+    if (!gate)
+        return NULL;
+    gate->cfg = *cfg;
+    gate->noiseFloor = NOISE_FLOOR_INIT_DB;
+    vad_gate_reset(gate);
+    return gate;
+}
+
+void destroy_vad_gate(vad_gate *gate) {
+    delete gate;
+}
+
+void vad_gate_reset(vad_gate *gate) {
+    memset(&gate->stats, 0, sizeof(gate->stats));
+    gate->stats.noise_floor_db = (int)gate->noiseFloor;
+    gate->hangover = 0;
+    gate->silentRun = 0;
+    gate->heldSize = 0;
+}
+
+int vad_gate_push(vad_gate *gate, const int16_t *pcm, int samples, const unsigned char *packet, int packetsize,
+                  const unsigned char *packets[2], int sizes[2]) {
+    const vad_gate_config *cfg = &gate->cfg;
+    vad_gate_stats *st = &gate->stats;
+    int count = 0;
+
+    float level = frame_level_db(pcm, samples);
+    int dtx = packetsize <= 2;
+    int voiced = !dtx && level >= cfg->min_level_db && level >= gate->noiseFloor + cfg->threshold_db;
+
+    /* 噪声底只在静音帧上慢慢上升: 人声帧也上升的话, 连续不停顿的大声说话几秒后噪声底就会追到人声附近, 开始丢语音
+     * 代价是噪声底初值低于实际噪声、又一直高于 min_level_db 时所有帧都判为人声而照常发送 */
+    if (level < gate->noiseFloor)
+        gate->noiseFloor = level;
+    else if (!voiced)
+        gate->noiseFloor += NOISE_FLOOR_RISE_DB;
+
+    st->frames++;
+    st->voiced = voiced;
+    st->level_db = (int)level;
+    st->noise_floor_db = (int)gate->noiseFloor;
+
+    int send;
+    if (!cfg->enabled) {
+        send = 1;
+    } else if (voiced) {
+        send = 1;
+        gate->hangover = cfg->hangover_frames;
+        // 人声开始: 先补发前一个静音帧, 它已经从"抑制"计入"发送"
+        if (cfg->preroll && gate->heldSize > 0) {
+            memcpy(gate->out, gate->held, gate->heldSize);
+            packets[count] = gate->out;
+            sizes[count++] = gate->heldSize;
+            st->frames_suppressed--;
+            st->bytes_saved -= gate->heldSize;
+            st->frames_sent++;
+            st->bytes_sent += gate->heldSize;
+        }
+    } else if (gate->hangover > 0) {
+        gate->hangover--;
+        send = !dtx;
+    } else {
+        send = cfg->keepalive_frames > 0 && (gate->silentRun + 1) % cfg->keepalive_frames == 0;
+    }
+    gate->heldSize = 0;
+
+    if (send && packetsize > 0) {
+        packets[count] = packet;
+        sizes[count++] = packetsize;
+        st->frames_sent++;
+        st->bytes_sent += packetsize;
+        gate->silentRun = 0;
+    } else {
+        st->frames_suppressed++;
+        st->bytes_saved += packetsize;
+        gate->silentRun++;
+        if (packetsize > 0 && packetsize <= OPUS_MAX_PACKET_SIZE) {
+            memcpy(gate->held, packet, packetsize);
+            gate->heldSize = packetsize;
+        }
+    }
+    return count;
+}
+
+void vad_gate_get_stats(vad_gate *gate, vad_gate_stats *stats) {
+    *stats = gate->stats;
+}
+
+#ifdef TEST
+/* 测试: g++ -DTEST -O2 -I ./ -o vad_gate_test vad_gate.cpp
+ * 用噪声 + 间歇的"语音"(调幅的多音信号) 检查: 语音帧全部发送, 静音帧大部分被抑制, 字头有前导帧
+ * 之后 40s 不停顿的语音也要全部发送, 噪声底不能跟着人声上升
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+int main(int argc, char **argv) {
+    vad_gate_config cfg = { 1, 9, -50, 8, 0, 1 };
+    vad_gate *gate = create_vad_gate(&cfg);
+    if (!gate)
+        return 1;
+
+    const int rate = 16000, frame = rate * 60 / 1000;
+    std::vector<int16_t> pcm(frame);
+    unsigned char packet[64];
+    int fail = 0;
+    int speechFrames = 0, speechSent = 0;
+    int lastSent = -1;
+    srand(1);
+
+    // 0~30s: 每 5s 中前 1.5s 是语音, 其余是 -65dBFS 左右的背景噪声; 30~70s: 连续的语音
+    int sustainedFrames = 0, sustainedSent = 0;
+    for (int f = 0; f < 1167; ++f) {
+        double t = f * 0.06;
+        bool sustained = t >= 30.0;
+        bool speech = sustained || (fmod(t, 5.0) < 1.5 && t > 1.0);
+        for (int i = 0; i < frame; ++i) {
+            double n = (rand() / (double)RAND_MAX - 0.5) * 40;
+            double s = 0;
+            if (speech) {
+                double x = (f * frame + i) / (double)rate;
+                // 连续的语音起伏较小 (拖长的元音), 帧能量几乎不会掉到噪声底附近
+                double am = sustained ? 0.85 + 0.15 * sin(2 * M_PI * 4 * x) : 0.6 + 0.4 * sin(2 * M_PI * 4 * x);
+                s = 6000 * am * (sin(2 * M_PI * 220 * x) + 0.5 * sin(2 * M_PI * 660 * x));
+            }
+            pcm[i] = (int16_t)(n + s);
+        }
+        // 模拟编码器: 语音帧较大, 静音帧很小
+        int size = speech ? 60 : 8;
+        memset(packet, f & 0xff, size);
+
+        const unsigned char *out[2];
+        int sizes[2];
+        int n = vad_gate_push(gate, pcm.data(), frame, packet, size, out, sizes);
+        int sent = n > 0 && out[n - 1] == packet;
+        if (sustained) {
+            sustainedFrames++;
+            sustainedSent += sent;
+        } else if (speech) {
+            speechFrames++;
+            speechSent += sent;
+        }
+        if (n == 2 && lastSent != f - 1 && lastSent >= 0)
+            printf("onset at %.2fs, preroll %d bytes\n", t, sizes[0]);
+        if (n > 0)
+            lastSent = f;
+    }
+
+    vad_gate_stats st;
+    vad_gate_get_stats(gate, &st);
+    printf("frames %lu, sent %lu, suppressed %lu, bytes sent %lu, saved %lu, noise floor %d dBFS\n",
+           st.frames, st.frames_sent, st.frames_suppressed, st.bytes_sent, st.bytes_saved, st.noise_floor_db);
+    printf("speech frames %d, sent %d; sustained speech frames %d, sent %d\n",
+           speechFrames, speechSent, sustainedFrames, sustainedSent);
+    if (speechSent != speechFrames || sustainedSent != sustainedFrames)
+        fail = 1;                                   // 语音帧不能丢
+    if (st.frames_suppressed < (st.frames - sustainedFrames) / 2)
+        fail = 1;                                   // 大部分静音帧应被抑制
+    if (st.frames_sent + st.frames_suppressed != st.frames)
+        fail = 1;
+
+    printf("%s\n", fail ? "FAIL" : "OK");
+    destroy_vad_gate(gate);
+    return fail;
+}
+#endif
@@ -0,0 +1,73 @@
+#ifndef VAD_GATE_H
+#define VAD_GATE_H
+
+#include <stdint.h>
+
+/* 上行静音抑制: 按帧能量和自适应噪声底判断是否有人声, 静音帧不发送
+ * 说话结束后再继续发送 hangover 帧, 说话开始时补发前一个静音帧, 避免切掉字头字尾
+ */
+
+typedef struct vad_gate_config {
+    int enabled;              /* 0 时所有帧都发送, 只做统计 */
+    int threshold_db;         /* 高于噪声底多少 dB 视为人声 */
+    int min_level_db;         /* 低于该电平 (dBFS) 一律视为静音 */
+    int hangover_frames;      /* 人声结束后继续发送的帧数 */
+    int keepalive_frames;     /* 静音期间每隔多少帧发送一帧, 0 表示完全不发送 */
+    int preroll;              /* 1: 人声开始时先补发前一个静音帧 */
+} vad_gate_config;
+
+typedef struct vad_gate_stats {
+    unsigned long frames;             /* 输入的帧数 */
+    unsigned long frames_sent;        /* 发送的帧数 */
+    unsigned long frames_suppressed;  /* 被抑制的帧数 */
+    unsigned long bytes_sent;         /* 发送的 Opus 字节数 */
+    unsigned long bytes_saved;        /* 被抑制的 Opus 字节数 */
+    int voiced;                       /* 最近一帧是否判断为人声 */
+    int level_db;                     /* 最近一帧的电平 (dBFS) */
+    int noise_floor_db;               /* 当前估计的噪声底 (dBFS) */
+} vad_gate_stats;
+
+typedef struct vad_gate vad_gate;
+
+/**
+ * 创建静音抑制器
+ * 
+ * @param cfg 配置, 会被复制
+ * @return 成功返回实例，失败返回NULL
+ */
+vad_gate *create_vad_gate(const vad_gate_config *cfg);
+
+/**
+ * 销毁静音抑制器
+ * 
+ * @param gate 实例，可以为NULL
+ */
+void destroy_vad_gate(vad_gate *gate);
+
+/**
+ * 输入一帧 PCM 和它编码后的 Opus 包, 得到需要发送的包
+ * 包长不超过 2 字节时是编码器 DTX 输出的静音帧, 同样视为静音
+ * 
+ * @param gate 实例
+ * @param pcm 这一帧的 PCM 数据 (交错的 S16, 各通道一起计算能量)
+ * @param samples 样本总数 (所有通道)
+ * @param packet 这一帧的 Opus 包
+ * @param packetsize Opus 包大小（字节）
+ * @param packets 返回需要发送的包, 最多2个, 按顺序发送; 指针在下一次调用前有效
+ * @param sizes 返回各个包的大小
+ * @return 需要发送的包个数 (0~2)
+ */
+int vad_gate_push(vad_gate *gate, const int16_t *pcm, int samples, const unsigned char *packet, int packetsize,
+                  const unsigned char *packets[2], int sizes[2]);
+
+/**
+ * 获取统计信息
+ */
+void vad_gate_get_stats(vad_gate *gate, vad_gate_stats *stats);
+
+/**
+ * 开始一个新的会话: 清零统计, 丢弃缓存的前导帧, 保留噪声底估计
+ */
+void vad_gate_reset(vad_gate *gate);
+
+#endif // VAD_GATE_H